@@ -0,0 +1,30 @@
+#pragma once
+
+#include <stdio.h>
+#include <time.h>
+
+/*
+ * bench - what the benchmarks under bench/ share.
+ *
+ * Each program measures one module against what it replaced, kept under
+ * bench/baseline/ as it was. `make bench` builds them at -O2 and runs
+ * them; BENCH_LABEL tells apart the builds of one program against either
+ * implementation.
+ */
+
+#ifndef BENCH_LABEL
+#define BENCH_LABEL "current"
+#endif
+
+static inline double bench_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+/* keeps a result alive, so the loop computing it is not dropped. */
+static inline void bench_sink(const void *p)
+{
+    __asm__ __volatile__("" : : "r"(p) : "memory");
+}
@@ -0,0 +1,196 @@
+/*
+ * concurrent reads of 100k path-like keys, in millions of lookups per
+ * second over all threads, for 1 to `max` threads (the argument, twice
+ * the cpus by default):
+ *
+ *   rwlock     one struct hash behind one rwlock, the cache before chash
+ *   locked     chash, through the shard read locks
+ *   lock-free  chash_find()
+ *
+ * then chash_find() again with a writer replacing values all along, each
+ * lookup reading the value it pinned, which frees go through the epochs.
+ */
+#define _GNU_SOURCE
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "chash.h"
+#include "bench.h"
+
+#define NKEYS 100000
+#define SHARDS 64
+#define RUN_SECONDS 0.5
+
+enum variant { RWLOCK, LOCKED, LOCK_FREE, LOCK_FREE_WRITER };
+
+static const char *const variant_names[] = {
+    [RWLOCK] = "rwlock",
+    [LOCKED] = "locked",
+    [LOCK_FREE] = "lock-free",
+    [LOCK_FREE_WRITER] = "+ writer",
+};
+
+static char *keys[NKEYS];
+
+static struct hash *global;
+static pthread_rwlock_t global_lock = PTHREAD_RWLOCK_INITIALIZER;
+static struct chash *sharded;
+
+static enum variant variant;
+static volatile int stop;
+
+struct reader_arg {
+    pthread_t thrd;
+    unsigned seed;
+    unsigned long lookups;
+    unsigned long sum;
+};
+
+static __thread unsigned long pinned;
+
+static void pin(void *value)
+{
+    pinned += *(unsigned *)value;
+}
+
+static void *reader(void *data)
+{
+    struct reader_arg *a = data;
+    unsigned long n = 0;
+    unsigned shard;
+
+    while (!stop) {
+        int i;
+        for (i = 0; i < 1024; i++) {
+            const char *key = keys[rand_r(&a->seed) % NKEYS];
+            switch (variant) {
+            case RWLOCK:
+                pthread_rwlock_rdlock(&global_lock);
+                bench_sink(hash_find(global, key));
+                pthread_rwlock_unlock(&global_lock);
+                break;
+            case LOCKED:
+                bench_sink(hash_find(chash_lock(sharded, key, false, &shard), key));
+                chash_unlock_shard(sharded, shard);
+                break;
+            case LOCK_FREE:
+                bench_sink(chash_find(sharded, key, NULL));
+                break;
+            case LOCK_FREE_WRITER:
+                chash_find(sharded, key, pin);
+                break;
+            }
+        }
+        n += 1024;
+    }
+    a->lookups = n;
+    a->sum = pinned;
+    return NULL;
+}
+
+/* new values, and keys, for random entries until stopped. */
+static void *writer(void *data)
+{
+    unsigned seed = 1, shard;
+    unsigned long *writes = data;
+
+    while (!stop) {
+        const char *key = keys[rand_r(&seed) % NKEYS];
+        char *k = strdup(key);
+        unsigned *v = malloc(sizeof(*v));
+        if (!k || !v) {
+            free(k);
+            free(v);
+            continue;
+        }
+        *v = seed;
+        hash_add(chash_lock(sharded, key, true, &shard), k, v);
+        chash_unlock_shard(sharded, shard);
+        (*writes)++;
+    }
+    return NULL;
+}
+
+static double run(int nthreads)
+{
+    struct reader_arg *args = calloc((size_t)nthreads, sizeof(*args));
+    unsigned long total = 0, writes = 0;
+    pthread_t wthrd;
+    int i;
+
+    if (!args)
+        return 0;
+    stop = 0;
+    if (variant == LOCK_FREE_WRITER
+            && pthread_create(&wthrd, NULL, writer, &writes) != 0) {
+        free(args);
+        return 0;
+    }
+    double t0 = bench_now();
+    for (i = 0; i < nthreads; i++) {
+        args[i].seed = (unsigned)i + 1;
+        pthread_create(&args[i].thrd, NULL, reader, &args[i]);
+    }
+    usleep((useconds_t)(RUN_SECONDS * 1e6));
+    stop = 1;
+    for (i = 0; i < nthreads; i++) {
+        pthread_join(args[i].thrd, NULL);
+        total += args[i].lookups;
+    }
+    double secs = bench_now() - t0;
+    if (variant == LOCK_FREE_WRITER)
+        pthread_join(wthrd, NULL);
+
+    free(args);
+    return (double)total / secs / 1e6;
+}
+
+int main(int argc, char **argv)
+{
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    int max = argc > 1 ? atoi(argv[1]) : (int)(cpus > 1 ? 2 * cpus : 4);
+    unsigned shard;
+    int i, n;
+
+    global = hash_str_new(NULL, NULL);
+    sharded = chash_str_new(SHARDS, free, free);
+    if (!global || !sharded || max < 1)
+        return 1;
+    for (i = 0; i < NKEYS; i++) {
+        unsigned *v = malloc(sizeof(*v));
+        char *k = malloc(48);
+        if (!v || !k)
+            return 1;
+        snprintf(k, 48, "./www/assets/img/file-%d.png", i);
+        *v = (unsigned)i;
+        keys[i] = strdup(k);
+        if (!keys[i])
+            return 1;
+        hash_add(global, keys[i], v);
+        hash_add(chash_lock(sharded, k, true, &shard), k, v);
+        chash_unlock_shard(sharded, shard);
+    }
+
+    printf("%ld cpus, Mlookups/s over all threads\n%-10s", cpus, "threads");
+    for (n = 1; n <= max; n *= 2)
+        printf("%8d", n);
+    printf("\n");
+    for (variant = RWLOCK; variant <= LOCK_FREE_WRITER; variant++) {
+        printf("%-10s", variant_names[variant]);
+        fflush(stdout);
+        for (n = 1; n <= max; n *= 2) {
+            printf("%8.1f", run(n));
+            fflush(stdout);
+        }
+        printf("\n");
+    }
+
+    chash_free(sharded);
+    hash_free(global);
+    for (i = 0; i < NKEYS; i++)
+        free(keys[i]);
+    return 0;
+}
@@ -0,0 +1,97 @@
+/*
+ * struct hash: add, and find hits and misses, on path-like keys, in ns
+ * per call. built against hash.c and against the bucket vectors it
+ * replaced, bench/baseline/hash.c.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "hash.h"
+#include "bench.h"
+
+#define ADD_ROUNDS 4
+#define FIND_CALLS 4000000
+
+static char **make_keys(size_t n, const char *fmt)
+{
+    char **keys = malloc(n * sizeof(*keys));
+    size_t i;
+
+    if (!keys)
+        return NULL;
+    for (i = 0; i < n; i++) {
+        keys[i] = malloc(48);
+        if (!keys[i])
+            return NULL;
+        snprintf(keys[i], 48, fmt, i);
+    }
+    return keys;
+}
+
+static void free_keys(char **keys, size_t n)
+{
+    size_t i;
+
+    for (i = 0; i < n; i++)
+        free(keys[i]);
+    free(keys);
+}
+
+static double find_all(const struct hash *h, char **keys, size_t n,
+        size_t rounds)
+{
+    double t0 = bench_now();
+    size_t r, i;
+
+    for (r = 0; r < rounds; r++)
+        for (i = 0; i < n; i++)
+            bench_sink(hash_find(h, keys[i]));
+    return (bench_now() - t0) * 1e9 / (double)(n * rounds);
+}
+
+static int run(size_t n)
+{
+    char **hits = make_keys(n, "./www/assets/img/file-%zu.png");
+    char **misses = make_keys(n, "./www/assets/img/miss-%zu.png");
+    size_t rounds = n < FIND_CALLS ? FIND_CALLS / n : 1;
+    size_t add_rounds = rounds < ADD_ROUNDS ? rounds : ADD_ROUNDS;
+    struct hash *h = NULL;
+    double add = 0;
+    size_t r, i;
+
+    if (!hits || !misses)
+        return -1;
+
+    for (r = 0; r < add_rounds; r++) {
+        hash_free(h);
+        if (!(h = hash_str_new(NULL, NULL)))
+            return -1;
+        double t0 = bench_now();
+        for (i = 0; i < n; i++)
+            hash_add(h, hits[i], hits[i]);
+        add += bench_now() - t0;
+    }
+
+    printf("%-8s %8zu keys   add %7.1f   find hit %7.1f   find miss %7.1f\n",
+            BENCH_LABEL, n, add * 1e9 / (double)(n * add_rounds),
+            find_all(h, hits, n, rounds), find_all(h, misses, n, rounds));
+
+    hash_free(h);
+    free_keys(hits, n);
+    free_keys(misses, n);
+    return 0;
+}
+
+int main(void)
+{
+    static const size_t sizes[] = { 1000, 100000, 1000000 };
+    size_t i;
+
+    for (i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        if (run(sizes[i]) != 0) {
+            fprintf(stderr, "out of memory\n");
+            return 1;
+        }
+    }
+    return 0;
+}
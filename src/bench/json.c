@@ -0,0 +1,220 @@
+/*
+ * json: the blog posts decoded, decoded in place into their members, and
+ * validated, in MB/s. built against json.c and against the one scanning
+ * strings a byte at a time, bench/baseline/json.c.
+ *
+ *   blogs   the posts in data/blogs, as the server reads them
+ *   big     the same posts, each with its content 30 times over
+ */
+#include <glob.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "json.h"
+#include "bench.h"
+
+#define MAX_DOCS 64
+#define BIG_REPEAT 30
+#define RUN_BYTES (64u << 20)
+#define ROUNDS 3
+
+static const char *const members[] = {
+    "heading", "sub_heading", "author", "author_link", "timestamp", "content"
+};
+#define NMEMBERS (sizeof(members) / sizeof(members[0]))
+
+struct docs {
+    char *src[MAX_DOCS];
+    size_t len[MAX_DOCS];
+    size_t n, total, longest;
+};
+
+static void docs_add(struct docs *d, char *src)
+{
+    if (d->n == MAX_DOCS) {
+        free(src);
+        return;
+    }
+    d->src[d->n] = src;
+    d->len[d->n] = strlen(src);
+    d->total += d->len[d->n];
+    if (d->len[d->n] > d->longest)
+        d->longest = d->len[d->n];
+    d->n++;
+}
+
+static char *read_file(const char *path)
+{
+    FILE *f = fopen(path, "rb");
+    char *buf = NULL;
+    long len;
+
+    if (!f)
+        return NULL;
+    if (fseek(f, 0, SEEK_END) == 0 && (len = ftell(f)) >= 0
+            && fseek(f, 0, SEEK_SET) == 0 && (buf = malloc((size_t)len + 1))) {
+        if (fread(buf, 1, (size_t)len, f) == (size_t)len) {
+            buf[len] = '\0';
+        } else {
+            free(buf);
+            buf = NULL;
+        }
+    }
+    fclose(f);
+    return buf;
+}
+
+/* the post again, its content repeated. */
+static char *make_big(const char *src)
+{
+    JsonNode *post = json_decode(src), *content;
+    char *big = NULL, *json = NULL;
+    size_t len, i;
+
+    if (!post || !(content = json_find_member(post, "content"))
+            || content->tag != JSON_STRING) {
+        json_delete(post);
+        return NULL;
+    }
+    len = strlen(content->string_);
+    if ((big = malloc(len * BIG_REPEAT + 1))) {
+        for (i = 0; i < BIG_REPEAT; i++)
+            memcpy(big + i * len, content->string_, len);
+        big[len * BIG_REPEAT] = '\0';
+        json_remove_from_parent(content);
+        json_delete(content);
+        json_append_member(post, "content", json_mkstring(big));
+        json = json_encode(post);
+        free(big);
+    }
+    json_delete(post);
+    return json;
+}
+
+static int decode(const struct docs *d, size_t rounds, char *copy)
+{
+    size_t r, i;
+
+    (void)copy;
+    for (r = 0; r < rounds; r++)
+        for (i = 0; i < d->n; i++) {
+            JsonNode *node = json_decode(d->src[i]);
+            if (!node)
+                return -1;
+            json_delete(node);
+        }
+    return 0;
+}
+
+/* the copy is part of it: the server decodes its own buffer in place. */
+static int decode_members(const struct docs *d, size_t rounds, char *copy)
+{
+    size_t r, i;
+
+    for (r = 0; r < rounds; r++)
+        for (i = 0; i < d->n; i++) {
+            JsonNode *out[NMEMBERS];
+            char stack[NMEMBERS * sizeof(JsonNode) + 16];
+            JsonArena arena;
+
+            memcpy(copy, d->src[i], d->len[i] + 1);
+            json_arena_init(&arena, stack, sizeof(stack));
+            int found = json_decode_members(copy, members, out, NMEMBERS, &arena);
+            json_arena_free(&arena);
+            if (found != (int)NMEMBERS)
+                return -1;
+        }
+    return 0;
+}
+
+static int validate(const struct docs *d, size_t rounds, char *copy)
+{
+    size_t r, i;
+
+    (void)copy;
+    for (r = 0; r < rounds; r++)
+        for (i = 0; i < d->n; i++)
+            if (!json_validate(d->src[i]))
+                return -1;
+    return 0;
+}
+
+typedef int (*run_fn)(const struct docs *d, size_t rounds, char *copy);
+
+/* best of ROUNDS, MB/s; -1 if a document did not parse. */
+static double mb_per_s(run_fn run, const struct docs *d, char *copy)
+{
+    size_t rounds = RUN_BYTES / d->total + 1;
+    double best = 0;
+    int r;
+
+    for (r = 0; r < ROUNDS; r++) {
+        double t0 = bench_now();
+        if (run(d, rounds, copy) != 0)
+            return -1;
+        double secs = bench_now() - t0;
+        if (!r || secs < best)
+            best = secs;
+    }
+    return (double)d->total * (double)rounds / best / 1e6;
+}
+
+static int report(const char *name, const struct docs *d)
+{
+    char *copy = malloc(d->longest + 1);
+    double dec, mem, val;
+
+    if (!copy)
+        return -1;
+    dec = mb_per_s(decode, d, copy);
+    mem = mb_per_s(decode_members, d, copy);
+    val = mb_per_s(validate, d, copy);
+    free(copy);
+    if (dec < 0 || mem < 0 || val < 0) {
+        fprintf(stderr, "%s: a post did not parse\n", name);
+        return -1;
+    }
+    printf("%-8s %-6s %2zu docs %7zu bytes   decode %6.0f   members %6.0f   validate %6.0f\n",
+            BENCH_LABEL, name, d->n, d->total, dec, mem, val);
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    const char *dir = argc > 1 ? argv[1] : "../data/blogs";
+    struct docs blogs = { 0 }, big = { 0 };
+    char pattern[4096];
+    glob_t g;
+    size_t i;
+
+    snprintf(pattern, sizeof(pattern), "%s/*", dir);
+    if (glob(pattern, 0, NULL, &g) != 0) {
+        fprintf(stderr, "no posts in %s\n", dir);
+        return 1;
+    }
+    for (i = 0; i < g.gl_pathc; i++) {
+        char *src = read_file(g.gl_pathv[i]), *b;
+        if (!src || !json_validate(src)) {
+            free(src);
+            continue;
+        }
+        if ((b = make_big(src)))
+            docs_add(&big, b);
+        docs_add(&blogs, src);
+    }
+    globfree(&g);
+    if (!blogs.n || !big.n) {
+        fprintf(stderr, "no posts in %s\n", dir);
+        return 1;
+    }
+
+    if (report("blogs", &blogs) != 0 || report("big", &big) != 0)
+        return 1;
+
+    for (i = 0; i < blogs.n; i++)
+        free(blogs.src[i]);
+    for (i = 0; i < big.n; i++)
+        free(big.src[i]);
+    return 0;
+}
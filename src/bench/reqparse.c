@@ -0,0 +1,149 @@
+/*
+ * request heads, in ns each, parsed by reqparse() and by http_parser,
+ * which parsed every request before it and still takes what reqparse
+ * leaves. http_parser gets callbacks that only count the bytes of the
+ * url and the headers, the least the server could ask of it; both must
+ * find the same bytes.
+ */
+#include <stdio.h>
+#include <string.h>
+
+#include "http_parser.h"
+#include "reqparse.h"
+#include "bench.h"
+
+#define PARSES 500000
+#define ROUNDS 5
+
+/* what the browsers sent for the blog, and curl for the status. */
+static const struct {
+    const char *name;
+    const char *head;
+} samples[] = {
+    { "chrome",
+      "GET /blogs/12 HTTP/1.1\r\n"
+      "Host: www.example.com\r\n"
+      "Connection: keep-alive\r\n"
+      "sec-ch-ua: \"Chromium\";v=\"118\", \"Google Chrome\";v=\"118\", \"Not=A?Brand\";v=\"99\"\r\n"
+      "sec-ch-ua-mobile: ?0\r\n"
+      "sec-ch-ua-platform: \"Windows\"\r\n"
+      "Upgrade-Insecure-Requests: 1\r\n"
+      "User-Agent: Mozilla/5.0 (Windows NT 10.0; Win64; x64) AppleWebKit/537.36 (KHTML, like Gecko) Chrome/118.0.0.0 Safari/537.36\r\n"
+      "Accept: text/html,application/xhtml+xml,application/xml;q=0.9,image/avif,image/webp,image/apng,*/*;q=0.8,application/signed-exchange;v=b3;q=0.7\r\n"
+      "Sec-Fetch-Site: same-origin\r\n"
+      "Sec-Fetch-Mode: navigate\r\n"
+      "Sec-Fetch-User: ?1\r\n"
+      "Sec-Fetch-Dest: document\r\n"
+      "Referer: https://www.example.com/\r\n"
+      "Accept-Encoding: gzip, deflate, br\r\n"
+      "Accept-Language: en-US,en;q=0.9\r\n"
+      "Cookie: _ga=GA1.1.1234567890.1697000000; _ga_ABCDEF=GS1.1.1697000000.1.1.1697000100.0.0.0\r\n"
+      "\r\n" },
+    { "firefox",
+      "GET /css/clean-blog.min.css HTTP/1.1\r\n"
+      "Host: www.example.com\r\n"
+      "User-Agent: Mozilla/5.0 (X11; Linux x86_64; rv:109.0) Gecko/20100101 Firefox/119.0\r\n"
+      "Accept: text/css,*/*;q=0.1\r\n"
+      "Accept-Language: en-US,en;q=0.5\r\n"
+      "Accept-Encoding: gzip, deflate, br\r\n"
+      "Connection: keep-alive\r\n"
+      "Referer: https://www.example.com/blogs/12\r\n"
+      "Sec-Fetch-Dest: style\r\n"
+      "Sec-Fetch-Mode: no-cors\r\n"
+      "Sec-Fetch-Site: same-origin\r\n"
+      "If-Modified-Since: Sun, 18 Oct 2026 16:50:39 GMT\r\n"
+      "If-None-Match: \"6530d1ef-22f1\"\r\n"
+      "Cache-Control: max-age=0\r\n"
+      "\r\n" },
+    { "safari",
+      "GET /?page=2 HTTP/1.1\r\n"
+      "Host: www.example.com\r\n"
+      "User-Agent: Mozilla/5.0 (iPhone; CPU iPhone OS 17_0 like Mac OS X) AppleWebKit/605.1.15 (KHTML, like Gecko) Version/17.0 Mobile/15E148 Safari/604.1\r\n"
+      "Accept: text/html,application/xhtml+xml,application/xml;q=0.9,*/*;q=0.8\r\n"
+      "Accept-Language: en-GB,en;q=0.9\r\n"
+      "Accept-Encoding: gzip, deflate, br\r\n"
+      "Connection: keep-alive\r\n"
+      "\r\n" },
+    { "curl",
+      "GET /status HTTP/1.1\r\n"
+      "Host: 127.0.0.1:8089\r\n"
+      "User-Agent: curl/7.88.1\r\n"
+      "Accept: */*\r\n"
+      "\r\n" },
+};
+#define NSAMPLES (sizeof(samples) / sizeof(samples[0]))
+
+static int count_bytes(http_parser *p, const char *at, size_t len)
+{
+    (void)at;
+    *(size_t *)p->data += len;
+    return 0;
+}
+
+static size_t parse_http_parser(const http_parser_settings *s, const char *buf,
+        size_t len, size_t *bytes)
+{
+    http_parser p;
+
+    http_parser_init(&p, HTTP_REQUEST);
+    p.data = bytes;
+    return http_parser_execute(&p, s, buf, len);
+}
+
+static size_t slice_bytes(const struct reqparse *r)
+{
+    size_t n = r->url.len;
+    int i;
+
+    for (i = 0; i < r->nheaders; i++)
+        n += r->headers[i].name.len + r->headers[i].value.len;
+    return n;
+}
+
+int main(void)
+{
+    http_parser_settings s;
+    struct reqparse r;
+    unsigned i;
+
+    http_parser_settings_init(&s);
+    s.on_url = count_bytes;
+    s.on_header_field = count_bytes;
+    s.on_header_value = count_bytes;
+
+    printf("%-10s %6s %8s %12s %9s\n", "ns", "bytes", "headers",
+            "http_parser", "reqparse");
+    for (i = 0; i < NSAMPLES; i++) {
+        const char *buf = samples[i].head;
+        size_t len = strlen(buf), bytes = 0;
+        double best_hp = 0, best_rp = 0;
+        int round, q;
+
+        if (reqparse(buf, len, &r) != len
+                || parse_http_parser(&s, buf, len, &bytes) != len
+                || bytes != slice_bytes(&r)) {
+            fprintf(stderr, "%s: the parsers disagree\n", samples[i].name);
+            return 1;
+        }
+
+        for (round = 0; round < ROUNDS; round++) {
+            double t0 = bench_now();
+            for (q = 0; q < PARSES; q++)
+                bench_sink((void *)parse_http_parser(&s, buf, len, &bytes));
+            double t1 = bench_now();
+            for (q = 0; q < PARSES; q++) {
+                bench_sink((void *)reqparse(buf, len, &r));
+                bench_sink(&r);
+            }
+            double t2 = bench_now();
+            double hp = (t1 - t0) * 1e9 / PARSES, rp = (t2 - t1) * 1e9 / PARSES;
+            if (!round || hp < best_hp)
+                best_hp = hp;
+            if (!round || rp < best_rp)
+                best_rp = rp;
+        }
+        printf("%-10s %6zu %8d %12.0f %9.0f\n", samples[i].name, len,
+                r.nheaders, best_hp, best_rp);
+    }
+    return 0;
+}
@@ -0,0 +1,150 @@
+/*
+ * route lookups, in ns each, the radix tree of router.c against the
+ * nibble trie it replaced, bench/baseline/trie.c:
+ *
+ *   1000 routes   /<section>/resN/, looked up with /<section>/resN/item/M;
+ *                 prefixes to the trie, ending in a *rest wildcard to the
+ *                 router
+ *   same path     one of those paths over and over
+ *   site          the server's own table, old and new, on its own paths
+ *   2 params      /<section>/resN/:id/:sub, the router only
+ *
+ * the trie answers some paths with the wrong route; how many is counted.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "router.h"
+#include "baseline/trie.h"
+#include "bench.h"
+
+#define NROUTES 1000
+#define LOOKUPS 2000000
+#define ROUNDS 5
+
+static const char *const sections[] = {
+    "api", "blogs", "users", "static", "admin", "v2/items", "v2/orders", "feeds"
+};
+#define NSECTIONS (sizeof(sections) / sizeof(sections[0]))
+
+static char paths[NROUTES][64];
+static int values[NROUTES];
+
+/* the tables of main.c, before and after the router. */
+static const char *const site_prefixes[] = {
+    "/blogs/", "/page/", "/status", "/"
+};
+static const char *const site_routes[] = {
+    "/blogs", "/blogs/:id", "/page/:n", "/status", "/status.json",
+    "/api/blogs", "/api/blogs/:id", "/search", "/*"
+};
+static const char *const site_paths[] = {
+    "/", "/blogs/3", "/page/2", "/status", "/css/clean-blog.min.css",
+    "/img/home-bg.jpg", "/about.html", "/js/clean-blog.min.js"
+};
+#define NSITE_PATHS (sizeof(site_paths) / sizeof(site_paths[0]))
+
+/* a path for the q-th lookup, in an order that defeats the prefetcher. */
+static inline unsigned pick(unsigned q, unsigned n)
+{
+    return (q * 7919u) % n;
+}
+
+typedef void *(*lookup_fn)(void *table, const char *path);
+
+static void *trie_find(void *table, const char *path)
+{
+    return trie_lookup_prefix(table, path);
+}
+
+static void *router_find(void *table, const char *path)
+{
+    struct route_match m;
+    return router_lookup(table, path, 1, &m) ? m.data : NULL;
+}
+
+/* best of ROUNDS, ns per lookup. */
+static double time_lookups(lookup_fn find, void *table, const char *const *set,
+        unsigned n)
+{
+    double best = 0;
+    int r;
+
+    for (r = 0; r < ROUNDS; r++) {
+        double t0 = bench_now();
+        unsigned q;
+        for (q = 0; q < LOOKUPS; q++)
+            bench_sink(find(table, set[pick(q, n)]));
+        double ns = (bench_now() - t0) * 1e9 / LOOKUPS;
+        if (!r || ns < best)
+            best = ns;
+    }
+    return best;
+}
+
+int main(void)
+{
+    static const char *set[NROUTES], *same[1];
+    struct trie trie, site_trie;
+    struct router *router = router_new(), *params = router_new();
+    struct router *site_router = router_new();
+    char pattern[64];
+    unsigned i, wrong = 0;
+
+    if (!router || !params || !site_router || !trie_init(&trie, NULL)
+            || !trie_init(&site_trie, NULL))
+        return 1;
+
+    for (i = 0; i < NROUTES; i++) {
+        const char *s = sections[i % NSECTIONS];
+        char *prefix = malloc(64);
+        if (!prefix)
+            return 1;
+        values[i] = (int)i;
+        snprintf(prefix, 64, "/%s/res%u/", s, i);
+        trie_add(&trie, prefix, &values[i]);
+        snprintf(pattern, sizeof(pattern), "/%s/res%u/*rest", s, i);
+        router_add(router, pattern, 0, &values[i]);
+        snprintf(pattern, sizeof(pattern), "/%s/res%u/:id/:sub", s, i);
+        router_add(params, pattern, 0, &values[i]);
+        snprintf(paths[i], sizeof(paths[i]), "/%s/res%u/item/%u", s, i, i * 7);
+        set[i] = paths[i];
+    }
+    for (i = 0; i < sizeof(site_prefixes) / sizeof(site_prefixes[0]); i++)
+        trie_add(&site_trie, strdup(site_prefixes[i]), &values[i]);
+    for (i = 0; i < sizeof(site_routes) / sizeof(site_routes[0]); i++)
+        router_add(site_router, site_routes[i], 0, &values[i]);
+    if (!router_build(router) || !router_build(params)
+            || !router_build(site_router))
+        return 1;
+
+    for (i = 0; i < NROUTES; i++) {
+        int *t = trie_find(&trie, paths[i]), *r = router_find(router, paths[i]);
+        if (!r || *r != (int)i)
+            return fprintf(stderr, "router got %s wrong\n", paths[i]), 1;
+        wrong += !t || *t != (int)i;
+    }
+
+    same[0] = paths[NROUTES / 2];
+    printf("%-28s %8s %8s\n", "ns per lookup", "trie", "router");
+    printf("%-28s %8.1f %8.1f\n", "1000 routes",
+            time_lookups(trie_find, &trie, set, NROUTES),
+            time_lookups(router_find, router, set, NROUTES));
+    printf("%-28s %8.1f %8.1f\n", "1000 routes, same path",
+            time_lookups(trie_find, &trie, same, 1),
+            time_lookups(router_find, router, same, 1));
+    printf("%-28s %8.1f %8.1f\n", "site",
+            time_lookups(trie_find, &site_trie, site_paths, NSITE_PATHS),
+            time_lookups(router_find, site_router, site_paths, NSITE_PATHS));
+    printf("%-28s %8s %8.1f\n", "1000 routes, 2 params", "-",
+            time_lookups(router_find, params, set, NROUTES));
+    printf("wrong routes of 1000: trie %u, router 0\n", wrong);
+
+    trie_destroy(&trie);
+    trie_destroy(&site_trie);
+    router_free(router, NULL);
+    router_free(params, NULL);
+    router_free(site_router, NULL);
+    return 0;
+}
@@ -0,0 +1,51 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include <zlib.h>
+
+#include "bundle.h"
+
+const struct bundle_asset *bundle_find(const char *path)
+{
+    if (!bundle_nassets)
+        return NULL;
+
+    const struct bundle_asset *a = &bundle_assets[phf_slot(bundle_disp,
+            bundle_ndisp, bundle_nassets, path, strlen(path))];
+
+    return strcmp(a->path, path) ? NULL : a;
+}
+
+/* the file as it was, nul terminated; free() it. */
+char *bundle_read(const struct bundle_asset *a, size_t *len)
+{
+    char *buf = malloc(a->raw_len + 1);
+    if (!buf)
+        return NULL;
+
+    if (!a->gzipped) {
+        memcpy(buf, a->data, a->raw_len);
+    } else {
+        z_stream zs;
+        memset(&zs, 0, sizeof(zs));
+        if (inflateInit2(&zs, 15 + 16) != Z_OK) {
+            free(buf);
+            return NULL;
+        }
+        zs.next_in = (Bytef *)a->data;
+        zs.avail_in = (uInt)a->len;
+        zs.next_out = (Bytef *)buf;
+        zs.avail_out = (uInt)a->raw_len;
+        int ret = inflate(&zs, Z_FINISH);
+        inflateEnd(&zs);
+        if (ret != Z_STREAM_END || zs.total_out != a->raw_len) {
+            free(buf);
+            return NULL;
+        }
+    }
+
+    buf[a->raw_len] = 0;
+    if (len)
+        *len = a->raw_len;
+    return buf;
+}
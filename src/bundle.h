@@ -0,0 +1,37 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "phf.h"
+
+/*
+ * bundle - the site compiled into the binary, built with `make BUNDLE=1`.
+ *
+ * mkbundle turns www/ and tmpl/ into bundle_data.c: every file gzipped
+ * when that pays off, with its response headers formatted beforehand,
+ * found by path through a minimal perfect hash. Files on disk still take
+ * precedence; the bundle answers what is not there.
+ */
+
+struct bundle_asset {
+    const char *path;           /* "www/css/main.css" */
+    const unsigned char *data;
+    size_t len;                 /* of data */
+    size_t raw_len;             /* of the file */
+    bool gzipped;               /* data is the gzip of the file */
+    time_t mtime;
+    const char *last_modified;  /* mtime as an http date */
+    const char *etag;
+};
+
+/* generated by mkbundle. */
+extern const struct bundle_asset bundle_assets[];
+extern const size_t bundle_nassets;
+extern const uint32_t bundle_disp[];
+extern const size_t bundle_ndisp;
+
+const struct bundle_asset *bundle_find(const char *path);
+char *bundle_read(const struct bundle_asset *a, size_t *len);
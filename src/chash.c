@@ -0,0 +1,328 @@
+#define _GNU_SOURCE
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "chash.h"
+#include "phf.h"
+
+#define CACHE_LINE 64
+#define SHARD_SEED 0x9e3779b9
+#define MAX_READERS 256
+
+struct chash_shard {
+    pthread_rwlock_t lock;
+    unsigned seq;       /* odd while a writer has the shard */
+    bool writing;
+    struct hash *hash;
+} __attribute__((aligned(CACHE_LINE)));
+
+/* freed once the readers that could still see it are gone. */
+struct retired {
+    struct retired *next;
+    void (*free_fn)(void *ptr);
+    void *ptr;
+    unsigned long epoch;
+};
+
+struct chash {
+    struct chash_shard *shards;
+    unsigned nshards;   /* a power of 2 */
+
+    pthread_mutex_t limbo_mtx;
+    struct retired *limbo;  /* newest first */
+};
+
+/*
+ * epochs. a reader publishes the epoch it starts in, a writer tags what
+ * it retires with the current one. the epoch only moves on once every
+ * reader inside has seen it, so two moves after a retire none of them
+ * can hold what was retired. readers are threads, each takes a slot of
+ * its own on first use and gives it back when it exits.
+ */
+struct reader {
+    unsigned long epoch;    /* 0 outside */
+    unsigned depth;
+    bool used;
+} __attribute__((aligned(CACHE_LINE)));
+
+static struct reader readers[MAX_READERS];
+static unsigned nreaders;       /* slots ever taken */
+static unsigned long global_epoch = 1;
+
+static __thread struct reader *self;
+static pthread_key_t reader_key;
+static pthread_once_t reader_once = PTHREAD_ONCE_INIT;
+
+static void reader_put(void *data)
+{
+    struct reader *r = data;
+    __atomic_store_n(&r->used, false, __ATOMIC_RELEASE);
+}
+
+static void reader_key_init(void)
+{
+    pthread_key_create(&reader_key, reader_put);
+}
+
+/* the slot of this thread; NULL when all are taken, it locks then. */
+static struct reader *reader_get(void)
+{
+    unsigned i;
+
+    if (self)
+        return self;
+    pthread_once(&reader_once, reader_key_init);
+    for (i = 0; i < MAX_READERS; i++) {
+        bool expected = false;
+        if (__atomic_compare_exchange_n(&readers[i].used, &expected, true,
+                    false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+            break;
+    }
+    if (i == MAX_READERS)
+        return NULL;
+
+    unsigned n = __atomic_load_n(&nreaders, __ATOMIC_RELAXED);
+    while (n <= i && !__atomic_compare_exchange_n(&nreaders, &n, i + 1,
+                true, __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+        ;
+    if (pthread_setspecific(reader_key, &readers[i])) {
+        reader_put(&readers[i]);
+        return NULL;
+    }
+    return self = &readers[i];
+}
+
+static void reader_enter(struct reader *r)
+{
+    if (r->depth++)
+        return;
+    __atomic_store_n(&r->epoch, __atomic_load_n(&global_epoch, __ATOMIC_RELAXED),
+            __ATOMIC_RELAXED);
+    /* seen inside before reading anything shared. */
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+}
+
+static void reader_exit(struct reader *r)
+{
+    if (!--r->depth)
+        __atomic_store_n(&r->epoch, 0, __ATOMIC_RELEASE);
+}
+
+/* the epoch, moved on if every reader inside has seen it. */
+static unsigned long epoch_advance(void)
+{
+    unsigned long e = __atomic_load_n(&global_epoch, __ATOMIC_RELAXED);
+    unsigned i, n = __atomic_load_n(&nreaders, __ATOMIC_ACQUIRE);
+
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    for (i = 0; i < n; i++) {
+        unsigned long re = __atomic_load_n(&readers[i].epoch, __ATOMIC_ACQUIRE);
+        if (re && re != e)
+            return e;
+    }
+    __atomic_compare_exchange_n(&global_epoch, &e, e + 1, false,
+            __ATOMIC_SEQ_CST, __ATOMIC_RELAXED);
+    return __atomic_load_n(&global_epoch, __ATOMIC_RELAXED);
+}
+
+static void free_retired(struct retired *r)
+{
+    struct retired *next;
+
+    for (; r; r = next) {
+        next = r->next;
+        r->free_fn(r->ptr);
+        free(r);
+    }
+}
+
+/*
+ * the reclaimer of the shards' hashes. it runs with the shard locked for
+ * writing; what is old enough is freed after the limbo is let go.
+ */
+static void chash_retire(void *data, void (*free_fn)(void *ptr), void *ptr)
+{
+    struct chash *h = data;
+    struct retired *r = malloc(sizeof(*r)), *ready = NULL, **p;
+
+    if (!r) {
+        /* wait the readers out instead. */
+        unsigned long e = __atomic_load_n(&global_epoch, __ATOMIC_SEQ_CST);
+        while (epoch_advance() < e + 2)
+            sched_yield();
+        free_fn(ptr);
+        return;
+    }
+    r->free_fn = free_fn;
+    r->ptr = ptr;
+
+    pthread_mutex_lock(&h->limbo_mtx);
+    r->epoch = __atomic_load_n(&global_epoch, __ATOMIC_SEQ_CST);
+    r->next = h->limbo;
+    h->limbo = r;
+
+    unsigned long e = epoch_advance();
+    for (p = &h->limbo; *p; ) {
+        if ((*p)->epoch + 2 <= e) {
+            r = *p;
+            *p = r->next;
+            r->next = ready;
+            ready = r;
+        } else {
+            p = &(*p)->next;
+        }
+    }
+    pthread_mutex_unlock(&h->limbo_mtx);
+
+    free_retired(ready);
+}
+
+/* `nshards` is rounded up to a power of 2. */
+struct chash *chash_str_new(unsigned nshards, void (*free_key)(void *value),
+        void (*free_value)(void *value))
+{
+    struct chash *h = calloc(1, sizeof(*h));
+    unsigned n = 1, i;
+
+    if (!h)
+        return NULL;
+    while (n < nshards)
+        n <<= 1;
+
+    if (posix_memalign((void **)&h->shards, CACHE_LINE, n * sizeof(*h->shards))) {
+        free(h);
+        return NULL;
+    }
+    memset(h->shards, 0, n * sizeof(*h->shards));
+    pthread_mutex_init(&h->limbo_mtx, NULL);
+
+    for (i = 0; i < n; i++) {
+        h->shards[i].hash = hash_str_new(free_key, free_value);
+        if (!h->shards[i].hash) {
+            h->nshards = i;
+            chash_free(h);
+            return NULL;
+        }
+        hash_set_reclaim(h->shards[i].hash, chash_retire, h);
+        pthread_rwlock_init(&h->shards[i].lock, NULL);
+    }
+    h->nshards = n;
+    return h;
+}
+
+/* nothing may be reading any more. */
+void chash_free(struct chash *h)
+{
+    unsigned i;
+
+    if (!h)
+        return;
+    free_retired(h->limbo);
+    for (i = 0; i < h->nshards; i++) {
+        hash_free(h->shards[i].hash);
+        pthread_rwlock_destroy(&h->shards[i].lock);
+    }
+    pthread_mutex_destroy(&h->limbo_mtx);
+    free(h->shards);
+    free(h);
+}
+
+/*
+ * the shard comes from a hash of its own, so its bits do not repeat
+ * those the struct hash within probes with.
+ */
+static inline unsigned shard_of(const struct chash *h, const char *key)
+{
+    return phf_hash(key, strlen(key), SHARD_SEED) & (h->nshards - 1);
+}
+
+/* lock the shard of `key`, unlock it with chash_unlock_shard(*shard). */
+struct hash *chash_lock(struct chash *h, const char *key, bool write,
+        unsigned *shard)
+{
+    *shard = shard_of(h, key);
+    return chash_lock_shard(h, *shard, write);
+}
+
+unsigned chash_nshards(const struct chash *h)
+{
+    return h->nshards;
+}
+
+struct hash *chash_lock_shard(struct chash *h, unsigned shard, bool write)
+{
+    struct chash_shard *s = &h->shards[shard];
+
+    if (write) {
+        pthread_rwlock_wrlock(&s->lock);
+        s->writing = true;
+        __atomic_store_n(&s->seq, s->seq + 1, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_RELEASE);
+    } else {
+        pthread_rwlock_rdlock(&s->lock);
+    }
+    return s->hash;
+}
+
+void chash_unlock_shard(struct chash *h, unsigned shard)
+{
+    struct chash_shard *s = &h->shards[shard];
+
+    if (s->writing) {
+        s->writing = false;
+        __atomic_store_n(&s->seq, s->seq + 1, __ATOMIC_RELEASE);
+    }
+    pthread_rwlock_unlock(&s->lock);
+}
+
+/*
+ * a lookup that takes no lock: the shard's hash is read as it is, and
+ * read again if a writer had it meanwhile. a writer that holds on makes
+ * it wait on the lock after all, rather than spin.
+ */
+void *chash_find(struct chash *h, const char *key, void (*pin)(void *value))
+{
+    struct chash_shard *s = &h->shards[shard_of(h, key)];
+    struct reader *r = reader_get();
+    void *value = NULL;
+    int tries;
+
+    if (r) {
+        reader_enter(r);
+        for (tries = 0; tries < 2; tries++) {
+            unsigned seq = __atomic_load_n(&s->seq, __ATOMIC_ACQUIRE);
+            if (seq & 1)
+                break;
+            value = hash_find_relaxed(s->hash, key);
+            __atomic_thread_fence(__ATOMIC_ACQUIRE);
+            if (__atomic_load_n(&s->seq, __ATOMIC_RELAXED) == seq) {
+                /* retired or not, it is not freed while we are inside. */
+                if (value && pin)
+                    pin(value);
+                reader_exit(r);
+                return value;
+            }
+        }
+        reader_exit(r);
+    }
+
+    pthread_rwlock_rdlock(&s->lock);
+    value = hash_find(s->hash, key);
+    if (value && pin)
+        pin(value);
+    pthread_rwlock_unlock(&s->lock);
+    return value;
+}
+
+/* a sum over the shards, each counted at a different time. */
+unsigned chash_get_count(struct chash *h)
+{
+    unsigned i, count = 0;
+
+    for (i = 0; i < h->nshards; i++) {
+        count += hash_get_count(chash_lock_shard(h, i, false));
+        chash_unlock_shard(h, i);
+    }
+    return count;
+}
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <stdbool.h>
+#include <pthread.h>
+
+#include "hash.h"
+
+/*
+ * chash - a struct hash for many threads, split into shards by key.
+ *
+ * Each shard is a plain struct hash behind its own rwlock, on its own
+ * cache line, so threads only contend when their keys share a shard.
+ * Callers lock the shard of a key, use the struct hash it returns with
+ * the usual hash_* calls, then unlock it; values found are only safe to
+ * use, or take a reference on, while the shard is locked. Whole table
+ * walks go shard by shard.
+ *
+ * chash_find() looks a key up without the lock, so readers write no
+ * shared cache line. A shard counts its writers in a sequence number, a
+ * lookup that overlapped one is done again; what writers replace or
+ * delete is freed only once every lookup that started before is over,
+ * which makes the value found safe to `pin` before it returns.
+ *
+ * Keys and values are owned as with hash_str_new().
+ */
+
+struct chash;
+
+struct chash *chash_str_new(unsigned nshards, void (*free_key)(void *value),
+        void (*free_value)(void *value));
+void chash_free(struct chash *h);
+
+struct hash *chash_lock(struct chash *h, const char *key, bool write,
+        unsigned *shard);
+unsigned chash_nshards(const struct chash *h);
+struct hash *chash_lock_shard(struct chash *h, unsigned shard, bool write);
+void chash_unlock_shard(struct chash *h, unsigned shard);
+
+void *chash_find(struct chash *h, const char *key, void (*pin)(void *value));
+
+unsigned chash_get_count(struct chash *h);
@@ -76,6 +76,16 @@
 #define HAVE_EPOLL 1
 #endif
 
+/* Test for file change notification */
+#ifdef __linux__
+#define HAVE_INOTIFY 1
+#endif
+
+/* Test for sendfile() */
+#ifdef __linux__
+#define HAVE_SENDFILE 1
+#endif
+
 #if (defined(__APPLE__) && defined(MAC_OS_X_VERSION_10_6)) || defined(__FreeBSD__) || defined(__OpenBSD__) || defined (__NetBSD__)
 #define HAVE_KQUEUE 1
 #endif
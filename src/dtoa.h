@@ -0,0 +1,17 @@
+#pragma once
+
+#include <stddef.h>
+
+/*
+ * dtoa - doubles to the shortest decimal that reads back the same.
+ *
+ * The digits come from Schubfach (R. Giulietti, "The Schubfach way to
+ * render doubles", 2020): of the decimals that round to the double, the
+ * shortest, and of those the closest. They are laid out the way
+ * JavaScript prints numbers: 0.1, 123, 1.5e-7, 1e+21.
+ */
+
+#define DTOA_BUF_SZ 32
+
+/* writes nul terminated text into `buf`, returns its length; 0 for nan and inf. */
+size_t dtoa_shortest(double v, char buf[DTOA_BUF_SZ]);
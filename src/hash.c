@@ -34,11 +34,32 @@
 #include "murmur3.h"
 #include "reallocarray.h"
 
+/*
+ * open addressing, swiss table style. slots come in groups of 16, each
+ * with one control byte: empty, deleted, or 7 bits of the hash of the key
+ * in the slot. a probe compares the 16 control bytes of a group at once
+ * against those 7 bits and only looks at the keys that match.
+ *
+ * a full table is not rehashed at once: entries move to the new one a
+ * few at a time, with each later change, looked up in both meanwhile.
+ *
+ * a table is one block: its capacity, the control bytes, the slots. a
+ * slot is filled before its control byte says so, and a table before it
+ * is put in place, so hash_find_relaxed() can read one while it changes.
+ */
 enum {
-	n_buckets = 512,
-	steps = 64,
+	group_size = 16,
+	min_capacity = group_size,
+	migrate_steps = 2 * group_size,	/* slots moved per change */
 	default_odd_constant = 0x27d4eb2d
 };
+
+enum {
+	ctrl_empty = 0x80,
+	ctrl_deleted = 0xfe,
+	/* full: 0x00 - 0x7f */
+};
+
 static unsigned odd_constant = default_odd_constant;
 
 struct hash_entry {
@@ -47,10 +68,15 @@ struct hash_entry {
 	unsigned hashval;
 };
 
-struct hash_bucket {
-	struct hash_entry *entries;
-	unsigned used;
-	unsigned total;
+struct table_head {
+	unsigned capacity;
+} __attribute__((aligned(group_size)));
+
+struct hash_table {
+	uint8_t *ctrl;		/* right after its table_head */
+	struct hash_entry *slots;
+	unsigned capacity;	/* a power of 2, at least a group */
+	unsigned growth_left;	/* empty slots usable before 7/8 are taken */
 };
 
 struct hash {
@@ -59,9 +85,276 @@ struct hash {
 	int (*key_compare)(const void *k1, const void *k2);
 	void (*free_value)(void *value);
 	void (*free_key)(void *value);
-	struct hash_bucket buckets[];
+	struct hash_table table;
+	struct hash_table old;	/* moving into table while capacity != 0 */
+	unsigned migrated;	/* slots of old moved so far */
+	void (*reclaim)(void *data, void (*free_fn)(void *ptr), void *ptr);
+	void *reclaim_data;
 };
 
+/*
+ * group_match() gives a mask of the lanes of a group holding a byte,
+ * group_match_free() of those empty or deleted; lane i is bit i with
+ * sse2, the top bit of nibble i with neon.
+ */
+#if defined(__SSE2__)
+#include <emmintrin.h>
+
+#define LANE_SHIFT 0
+
+static inline uint64_t group_match(const uint8_t *ctrl, uint8_t b)
+{
+	__m128i g = _mm_loadu_si128((const __m128i *)ctrl);
+	return (unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(g, _mm_set1_epi8((char)b)));
+}
+
+static inline uint64_t group_match_free(const uint8_t *ctrl)
+{
+	return (unsigned)_mm_movemask_epi8(_mm_loadu_si128((const __m128i *)ctrl));
+}
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+
+#define LANE_SHIFT 2
+
+static inline uint64_t neon_mask(uint8x16_t eq)
+{
+	uint8x8_t nibbles = vshrn_n_u16(vreinterpretq_u16_u8(eq), 4);
+	return vget_lane_u64(vreinterpret_u64_u8(nibbles), 0) & 0x8888888888888888ull;
+}
+
+static inline uint64_t group_match(const uint8_t *ctrl, uint8_t b)
+{
+	return neon_mask(vceqq_u8(vld1q_u8(ctrl), vdupq_n_u8(b)));
+}
+
+static inline uint64_t group_match_free(const uint8_t *ctrl)
+{
+	return neon_mask(vtstq_u8(vld1q_u8(ctrl), vdupq_n_u8(0x80)));
+}
+#else
+#define LANE_SHIFT 0
+
+static inline uint64_t group_match(const uint8_t *ctrl, uint8_t b)
+{
+	uint64_t mask = 0;
+	int i;
+	for (i = 0; i < group_size; i++)
+		mask |= (uint64_t)(ctrl[i] == b) << i;
+	return mask;
+}
+
+static inline uint64_t group_match_free(const uint8_t *ctrl)
+{
+	uint64_t mask = 0;
+	int i;
+	for (i = 0; i < group_size; i++)
+		mask |= (uint64_t)(ctrl[i] >> 7) << i;
+	return mask;
+}
+#endif
+
+static inline unsigned mask_lane(uint64_t mask)
+{
+	return (unsigned)__builtin_ctzll(mask) >> LANE_SHIFT;
+}
+
+static inline unsigned h1(unsigned hashval)
+{
+	return hashval >> 7;
+}
+
+static inline uint8_t h2(unsigned hashval)
+{
+	return hashval & 0x7f;
+}
+
+static inline struct table_head *table_head(const uint8_t *ctrl)
+{
+	return (struct table_head *)ctrl - 1;
+}
+
+static inline struct hash_entry *table_slots(uint8_t *ctrl, unsigned capacity)
+{
+	/* capacity is a multiple of the group size, the slots stay aligned. */
+	return (struct hash_entry *)(ctrl + capacity);
+}
+
+static int table_init(struct hash_table *t, unsigned capacity)
+{
+	struct table_head *head;
+
+	/* one unit more than the slots, for the head. */
+	head = reallocarray(NULL, (size_t)capacity + 1, 1 + sizeof(*t->slots));
+	if (head == NULL)
+		return -ENOMEM;
+	head->capacity = capacity;
+	t->ctrl = (uint8_t *)(head + 1);
+	t->slots = table_slots(t->ctrl, capacity);
+	memset(t->ctrl, ctrl_empty, capacity);
+	t->capacity = capacity;
+	t->growth_left = capacity - capacity / 8;
+	return 0;
+}
+
+static void table_fini(struct hash_table *t)
+{
+	if (t->ctrl)
+		free(table_head(t->ctrl));
+	memset(t, 0, sizeof(*t));
+}
+
+/* free, or hand to the reclaimer, what the hash no longer holds. */
+static void hash_release(const struct hash *hash, void (*free_fn)(void *ptr),
+			void *ptr)
+{
+	if (free_fn == NULL)
+		return;
+	if (hash->reclaim)
+		hash->reclaim(hash->reclaim_data, free_fn, ptr);
+	else
+		free_fn(ptr);
+}
+
+static void table_release(const struct hash *hash, struct hash_table *t)
+{
+	uint8_t *ctrl = t->ctrl;
+
+	__atomic_store_n(&t->ctrl, NULL, __ATOMIC_RELAXED);
+	memset(t, 0, sizeof(*t));
+	hash_release(hash, free, table_head(ctrl));
+}
+
+/*
+ * groups are probed in triangular steps, which visit all of them. a
+ * relaxed probe reads the control bytes before the slots they vouch for.
+ */
+static inline int probe(const struct hash *hash,
+			const uint8_t *ctrls, const struct hash_entry *slots,
+			unsigned capacity, const void *key, unsigned hashval,
+			bool relaxed)
+{
+	unsigned groups_mask = capacity / group_size - 1;
+	unsigned group = h1(hashval) & groups_mask;
+	unsigned step;
+
+	for (step = 1; ; step++) {
+		const uint8_t *ctrl = ctrls + group * group_size;
+		uint64_t mask = group_match(ctrl, h2(hashval));
+
+		if (relaxed)
+			__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		for (; mask; mask &= mask - 1) {
+			unsigned i = group * group_size + mask_lane(mask);
+			if (slots[i].hashval == hashval
+				&& hash->key_compare(key, slots[i].key) == 0)
+				return (int)i;
+		}
+		if (group_match(ctrl, ctrl_empty) || step > groups_mask)
+			return -1;
+		group = (group + step) & groups_mask;
+	}
+}
+
+static inline int table_find(const struct hash *hash,
+			const struct hash_table *t, const void *key, unsigned hashval)
+{
+	return probe(hash, t->ctrl, t->slots, t->capacity, key, hashval, false);
+}
+
+/* the slot for a key known to be absent, growth_left must allow one. */
+static unsigned table_insert(struct hash_table *t, const void *key,
+			const void *value, unsigned hashval)
+{
+	unsigned groups_mask = t->capacity / group_size - 1;
+	unsigned group = h1(hashval) & groups_mask;
+	unsigned step, i;
+	uint64_t mask;
+
+	for (step = 1; ; step++) {
+		mask = group_match_free(t->ctrl + group * group_size);
+		if (mask)
+			break;
+		group = (group + step) & groups_mask;
+	}
+
+	i = group * group_size + mask_lane(mask);
+	if (t->ctrl[i] == ctrl_empty)
+		t->growth_left--;
+	t->slots[i].key = key;
+	t->slots[i].value = value;
+	t->slots[i].hashval = hashval;
+	__atomic_store_n(&t->ctrl[i], h2(hashval), __ATOMIC_RELEASE);
+	return i;
+}
+
+/*
+ * a probe only goes past a group that has no empty slot, so a slot may
+ * become empty again if its group still has one; deleted otherwise.
+ */
+static void table_erase(struct hash_table *t, unsigned i)
+{
+	const uint8_t *ctrl = t->ctrl + (i & ~(unsigned)(group_size - 1));
+
+	if (group_match(ctrl, ctrl_empty)) {
+		t->ctrl[i] = ctrl_empty;
+		t->growth_left++;
+	} else {
+		t->ctrl[i] = ctrl_deleted;
+	}
+}
+
+static void hash_migrate(struct hash *hash, unsigned n)
+{
+	struct hash_table *old = &hash->old;
+
+	if (old->capacity == 0)
+		return;
+
+	for (; n && hash->migrated < old->capacity; n--, hash->migrated++) {
+		unsigned i = hash->migrated;
+		if (old->ctrl[i] & 0x80)
+			continue;
+		table_insert(&hash->table, old->slots[i].key, old->slots[i].value,
+				old->slots[i].hashval);
+		old->ctrl[i] = ctrl_deleted;
+	}
+
+	if (hash->migrated == old->capacity)
+		table_release(hash, old);
+}
+
+/*
+ * make room for one more entry. a table full of deleted slots is moved
+ * into one of the same size, one really full into one twice as large.
+ */
+static int hash_reserve(struct hash *hash)
+{
+	struct hash_table t;
+	unsigned capacity = hash->table.capacity;
+
+	if (hash->table.growth_left)
+		return 0;
+
+	/* a move under way always fits in the table, finish it first. */
+	hash_migrate(hash, UINT32_MAX);
+
+	if (hash->count >= capacity / 2 - capacity / 16)
+		capacity *= 2;
+	if (table_init(&t, capacity) < 0)
+		return -errno;
+
+	hash->old = hash->table;
+	hash->table.slots = t.slots;
+	hash->table.capacity = t.capacity;
+	hash->table.growth_left = t.growth_left;
+	/* readers find the table through ctrl, it goes last. */
+	__atomic_store_n(&hash->table.ctrl, t.ctrl, __ATOMIC_RELEASE);
+	hash->migrated = 0;
+	hash_migrate(hash, migrate_steps);
+	return 0;
+}
+
 static unsigned get_random_unsigned(void)
 {
 	unsigned value;
@@ -158,10 +451,13 @@ static struct hash *hash_internal_new(
 			void (*free_key)(void *value),
 			void (*free_value)(void *value))
 {
-	struct hash *hash = calloc(1, sizeof(struct hash) +
-				n_buckets * sizeof(struct hash_bucket));
+	struct hash *hash = calloc(1, sizeof(struct hash));
 	if (hash == NULL)
 		return NULL;
+	if (table_init(&hash->table, min_capacity) < 0) {
+		free(hash);
+		return NULL;
+	}
 	hash->hash_value = hash_value;
 	hash->key_compare = key_compare;
 	hash->free_value = free_value;
@@ -201,177 +497,170 @@ struct hash *hash_str_new(void (*free_key)(void *value),
 			free_value);
 }
 
-void hash_free(struct hash *hash)
+static void table_free_entries(const struct hash *hash, const struct hash_table *t)
 {
-	struct hash_bucket *bucket, *bucket_end;
+	unsigned i;
+
+	for (i = 0; i < t->capacity; i++) {
+		if (t->ctrl[i] & 0x80)
+			continue;
+		if (hash->free_value)
+			hash->free_value((void *)t->slots[i].value);
+		if (hash->free_key)
+			hash->free_key((void *)t->slots[i].key);
+	}
+}
 
+void hash_free(struct hash *hash)
+{
 	if (hash == NULL)
 		return;
 
-	bucket = hash->buckets;
-	bucket_end = bucket + n_buckets;
-	for (; bucket < bucket_end; bucket++) {
-		struct hash_entry *entry, *entry_end;
-		entry = bucket->entries;
-		entry_end = entry + bucket->used;
-		for (; entry < entry_end; entry++) {
-			if (hash->free_value)
-				hash->free_value((void *)entry->value);
-			if (hash->free_key)
-				hash->free_key((void *)entry->key);
-		}
-		free(bucket->entries);
-	}
+	table_free_entries(hash, &hash->table);
+	table_free_entries(hash, &hash->old);
+	table_fini(&hash->table);
+	table_fini(&hash->old);
 	free(hash);
 }
 
-/*
- * add or replace key in hash map.
- *
- * none of key or value are copied, just references are remembered as is,
- * make sure they are live while pair exists in hash!
- */
-int hash_add(struct hash *hash, const void *key, const void *value)
+/* the table and slot of key, NULL if absent. */
+static struct hash_table *hash_find_slot(const struct hash *hash,
+			const void *key, unsigned hashval, int *slot)
 {
-	unsigned hashval = hash->hash_value(key);
-	unsigned pos = hashval & (n_buckets - 1);
-	struct hash_bucket *bucket = hash->buckets + pos;
-	struct hash_entry *entry, *entry_end;
-
-	if (bucket->used + 1 >= bucket->total) {
-		unsigned new_total = bucket->total + steps;
-		struct hash_entry *tmp = reallocarray(bucket->entries, new_total, sizeof(*tmp));
-		if (tmp == NULL)
-			return -errno;
-		bucket->entries = tmp;
-		bucket->total = new_total;
-	}
-
-	entry = bucket->entries;
-	entry_end = entry + bucket->used;
-	for (; entry < entry_end; entry++) {
-		if (hashval != entry->hashval)
-			continue;
-		if (hash->key_compare(key, entry->key) != 0)
-			continue;
-		if (hash->free_value)
-			hash->free_value((void *)entry->value);
-		if (hash->free_key)
-			hash->free_key((void *)entry->key);
-
-		entry->key = key;
-		entry->value = value;
-		return 0;
+	*slot = table_find(hash, &hash->table, key, hashval);
+	if (*slot >= 0)
+		return (struct hash_table *)&hash->table;
+
+	if (hash->old.capacity) {
+		*slot = table_find(hash, &hash->old, key, hashval);
+		if (*slot >= 0)
+			return (struct hash_table *)&hash->old;
 	}
 
-	entry->key = key;
-	entry->value = value;
-	entry->hashval = hashval;
-	bucket->used++;
-	hash->count++;
-	return 0;
+	return NULL;
 }
 
-/* similar to hash_add(), but fails if key already exists */
-int hash_add_unique(struct hash *hash, const void *key, const void *value)
+static int hash_insert(struct hash *hash, const void *key, const void *value,
+			bool replace)
 {
 	unsigned hashval = hash->hash_value(key);
-	unsigned pos = hashval & (n_buckets - 1);
-	struct hash_bucket *bucket = hash->buckets + pos;
-	struct hash_entry *entry, *entry_end;
-
-	if (bucket->used + 1 >= bucket->total) {
-		unsigned new_total = bucket->total + steps;
-		struct hash_entry *tmp = reallocarray(bucket->entries, new_total, sizeof(*tmp));
-		if (tmp == NULL)
-			return -errno;
-		bucket->entries = tmp;
-		bucket->total = new_total;
-	}
+	struct hash_table *t;
+	int slot;
 
-	entry = bucket->entries;
-	entry_end = entry + bucket->used;
-	for (; entry < entry_end; entry++) {
-		if (hashval != entry->hashval)
-			continue;
-		if (hash->key_compare(key, entry->key) == 0)
+	hash_migrate(hash, migrate_steps);
+
+	t = hash_find_slot(hash, key, hashval, &slot);
+	if (t) {
+		struct hash_entry *entry = &t->slots[slot];
+		struct hash_entry old = *entry;
+
+		if (!replace)
 			return -EEXIST;
+		/* out of the table before it is let go. */
+		entry->key = key;
+		entry->value = value;
+		hash_release(hash, hash->free_value, (void *)old.value);
+		hash_release(hash, hash->free_key, (void *)old.key);
+		return 0;
 	}
 
-	entry->key = key;
-	entry->value = value;
-	entry->hashval = hashval;
-	bucket->used++;
+	if (hash_reserve(hash) < 0)
+		return -errno;
+
+	table_insert(&hash->table, key, value, hashval);
 	hash->count++;
 	return 0;
 }
 
-static inline struct hash_entry *hash_find_entry(const struct hash *hash,
-								const char *key,
-								unsigned hashval)
+/*
+ * add or replace key in hash map.
+ *
+ * none of key or value are copied, just references are remembered as is,
+ * make sure they are live while pair exists in hash!
+ */
+int hash_add(struct hash *hash, const void *key, const void *value)
 {
-	unsigned pos = hashval & (n_buckets - 1);
-	const struct hash_bucket *bucket = hash->buckets + pos;
-	struct hash_entry *entry, *entry_end;
-
-	entry = bucket->entries;
-	entry_end = entry + bucket->used;
-	for (; entry < entry_end; entry++) {
-		if (hashval != entry->hashval)
-			continue;
-		if (hash->key_compare(key, entry->key) == 0)
-			return entry;
-	}
+	return hash_insert(hash, key, value, true);
+}
 
-	return NULL;
+/* similar to hash_add(), but fails if key already exists */
+int hash_add_unique(struct hash *hash, const void *key, const void *value)
+{
+	return hash_insert(hash, key, value, false);
 }
 
 void *hash_find(const struct hash *hash, const void *key)
 {
-	const struct hash_entry *entry;
+	struct hash_table *t;
+	int slot;
 
-	entry = hash_find_entry(hash, key, hash->hash_value(key));
-	if (entry)
-		return (void *)entry->value;
+	t = hash_find_slot(hash, key, hash->hash_value(key), &slot);
+	if (t)
+		return (void *)t->slots[slot].value;
 	return NULL;
 }
 
 int hash_del(struct hash *hash, const void *key)
 {
-	unsigned hashval = hash->hash_value(key);
-	unsigned pos = hashval & (n_buckets - 1);
-	unsigned steps_used, steps_total;
-	struct hash_bucket *bucket = hash->buckets + pos;
-	struct hash_entry *entry, *entry_end;
-
-	entry = hash_find_entry(hash, key, hashval);
-	if (entry == NULL)
-		return -ENOENT;
+	struct hash_table *t;
+	struct hash_entry *entry;
+	int slot;
 
-	if (hash->free_value)
-		hash->free_value((void *)entry->value);
-	if (hash->free_key)
-		hash->free_key((void *)entry->key);
+	hash_migrate(hash, migrate_steps);
 
-	entry_end = bucket->entries + bucket->used;
-	memmove(entry, entry + 1,
-		(size_t)(entry_end - entry) * sizeof(struct hash_entry));
+	t = hash_find_slot(hash, key, hash->hash_value(key), &slot);
+	if (t == NULL)
+		return -ENOENT;
 
-	bucket->used--;
+	entry = &t->slots[slot];
+	table_erase(t, (unsigned)slot);
 	hash->count--;
+	hash_release(hash, hash->free_value, (void *)entry->value);
+	hash_release(hash, hash->free_key, (void *)entry->key);
+	return 0;
+}
 
-	steps_used = bucket->used / steps;
-	steps_total = bucket->total / steps;
-	if (steps_used + 1 < steps_total) {
-		struct hash_entry *tmp = reallocarray(bucket->entries, steps_used + 1,
-			steps * sizeof(*tmp));
-		if (tmp) {
-			bucket->entries = tmp;
-			bucket->total = (steps_used + 1) * steps;
-		}
+/*
+ * hash_find() for a reader that races with the writer. it reads only
+ * what the writer has published, so it stays within the tables and the
+ * keys it compares are whole; but what it returns may be torn, or gone
+ * already, and the caller has to check it, as chash does with a sequence
+ * count. the memory it reads must outlive it, see hash_set_reclaim().
+ */
+void *hash_find_relaxed(const struct hash *hash, const void *key)
+{
+	unsigned hashval = hash->hash_value(key);
+	uint8_t *tables[2];
+	int i, slot;
+
+	tables[0] = __atomic_load_n(&hash->table.ctrl, __ATOMIC_ACQUIRE);
+	tables[1] = __atomic_load_n(&hash->old.ctrl, __ATOMIC_ACQUIRE);
+	for (i = 0; i < 2; i++) {
+		uint8_t *ctrl = tables[i];
+		if (ctrl == NULL)
+			continue;
+
+		unsigned capacity = table_head(ctrl)->capacity;
+		struct hash_entry *slots = table_slots(ctrl, capacity);
+		slot = probe(hash, ctrl, slots, capacity, key, hashval, true);
+		if (slot >= 0)
+			return (void *)__atomic_load_n(&slots[slot].value,
+					__ATOMIC_RELAXED);
 	}
+	return NULL;
+}
 
-	return 0;
+/*
+ * hand what the hash lets go of - replaced and deleted keys and values,
+ * and the tables it moved out of - to `reclaim` rather than freeing it,
+ * for it to free once no reader can be looking at it any more.
+ */
+void hash_set_reclaim(struct hash *hash,
+		void (*reclaim)(void *data, void (*free_fn)(void *ptr), void *ptr),
+		void *data)
+{
+	hash->reclaim = reclaim;
+	hash->reclaim_data = data;
 }
 
 unsigned hash_get_count(const struct hash *hash)
@@ -382,39 +671,32 @@ unsigned hash_get_count(const struct hash *hash)
 void hash_iter_init(const struct hash *hash, struct hash_iter *iter)
 {
 	iter->hash = hash;
-	iter->bucket = 0;
-	iter->entry = -1;
+	iter->table = 0;
+	iter->slot = -1;
 }
 
+/* the entries of the table, then those not moved out of the old one. */
 bool hash_iter_next(struct hash_iter *iter, const void **key,
 							const void **value)
 {
-	const struct hash_bucket *b = iter->hash->buckets + iter->bucket;
+	const struct hash_table *t;
 	const struct hash_entry *e;
 
-	iter->entry++;
-
-	if ((unsigned)iter->entry >= b->used) {
-		iter->entry = 0;
+	for (; iter->table < 2; iter->table++, iter->slot = -1) {
+		t = iter->table ? &iter->hash->old : &iter->hash->table;
 
-		for (iter->bucket++; iter->bucket < n_buckets;
-							iter->bucket++) {
-			b = iter->hash->buckets + iter->bucket;
+		for (iter->slot++; (unsigned)iter->slot < t->capacity; iter->slot++) {
+			if (t->ctrl[iter->slot] & 0x80)
+				continue;
 
-			if (b->used > 0)
-				break;
+			e = t->slots + iter->slot;
+			if (value != NULL)
+				*value = e->value;
+			if (key != NULL)
+				*key = e->key;
+			return true;
 		}
-
-		if (iter->bucket >= n_buckets)
-			return false;
 	}
 
-	e = b->entries + iter->entry;
-
-	if (value != NULL)
-		*value = e->value;
-	if (key != NULL)
-		*key = e->key;
-
-	return true;
+	return false;
 }
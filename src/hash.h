@@ -7,8 +7,8 @@ struct hash;
 
 struct hash_iter {
 	const struct hash *hash;
-	unsigned int bucket;
-	int entry;
+	unsigned int table;
+	int slot;
 };
 
 struct hash *hash_int_new(void (*free_key)(void *value),
@@ -20,6 +20,10 @@ int hash_add(struct hash *hash, const void *key, const void *value);
 int hash_add_unique(struct hash *hash, const void *key, const void *value);
 int hash_del(struct hash *hash, const void *key);
 void *hash_find(const struct hash *hash, const void *key);
+void *hash_find_relaxed(const struct hash *hash, const void *key);
+void hash_set_reclaim(struct hash *hash,
+		void (*reclaim)(void *data, void (*free_fn)(void *ptr), void *ptr),
+		void *data);
 unsigned int hash_get_count(const struct hash *hash);
 void hash_iter_init(const struct hash *hash, struct hash_iter *iter);
 bool hash_iter_next(struct hash_iter *iter, const void **key,
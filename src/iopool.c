@@ -0,0 +1,112 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "iopool.h"
+
+struct io_job {
+    struct list_node node;
+    void (*work)(void *data);
+    void (*done)(void *data);
+    void *data;
+    struct jobq *done_q;
+};
+
+static void *iopool_thread(void *arg)
+{
+    struct iopool *p = arg;
+    struct io_job *job;
+
+    for (;;) {
+        pthread_mutex_lock(&p->mtx);
+        while (list_empty(&p->jobs) && !p->stopping)
+            pthread_cond_wait(&p->cond, &p->mtx);
+        if (p->stopping) {
+            pthread_mutex_unlock(&p->mtx);
+            break;
+        }
+        job = list_pop(&p->jobs, struct io_job, node);
+        p->queued--;
+        pthread_mutex_unlock(&p->mtx);
+
+        job->work(job->data);
+        if (job->done && !jobq_push(job->done_q, job->done, job->data))
+            fprintf(stderr, "iopool: lost a completion.\n");
+        free(job);
+    }
+
+    return NULL;
+}
+
+bool iopool_init(struct iopool *p, int nthreads, int max_queued)
+{
+    p->threads = calloc(nthreads, sizeof(pthread_t));
+    if (!p->threads)
+        return false;
+
+    pthread_mutex_init(&p->mtx, NULL);
+    pthread_cond_init(&p->cond, NULL);
+    list_head_init(&p->jobs);
+    p->queued = 0;
+    p->max_queued = max_queued;
+    p->stopping = false;
+
+    for (p->nthreads = 0; p->nthreads < nthreads; p->nthreads++) {
+        if (pthread_create(&p->threads[p->nthreads], NULL, iopool_thread, p))
+            break;
+    }
+    if (p->nthreads)
+        return true;
+
+    iopool_destroy(p);
+    return false;
+}
+
+bool iopool_submit(struct iopool *p, void (*work)(void *data),
+        void (*done)(void *data), void *data, struct jobq *done_q)
+{
+    struct io_job *job = malloc(sizeof(*job));
+    if (!job)
+        return false;
+
+    job->work = work;
+    job->done = done;
+    job->data = data;
+    job->done_q = done_q;
+
+    pthread_mutex_lock(&p->mtx);
+    if (p->queued >= p->max_queued || p->stopping) {
+        pthread_mutex_unlock(&p->mtx);
+        free(job);
+        return false;
+    }
+    list_add_tail(&p->jobs, &job->node);
+    p->queued++;
+    pthread_cond_signal(&p->cond);
+    pthread_mutex_unlock(&p->mtx);
+
+    return true;
+}
+
+/* stops the threads; jobs not started yet are dropped. */
+void iopool_destroy(struct iopool *p)
+{
+    struct io_job *job, *next;
+    int i;
+
+    pthread_mutex_lock(&p->mtx);
+    p->stopping = true;
+    pthread_cond_broadcast(&p->cond);
+    pthread_mutex_unlock(&p->mtx);
+
+    for (i = 0; i < p->nthreads; i++)
+        pthread_join(p->threads[i], NULL);
+    free(p->threads);
+    p->threads = NULL;
+
+    list_for_each_safe(&p->jobs, job, next, node) {
+        list_del(&job->node);
+        free(job);
+    }
+    pthread_cond_destroy(&p->cond);
+    pthread_mutex_destroy(&p->mtx);
+}
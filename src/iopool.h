@@ -0,0 +1,33 @@
+#pragma once
+
+#include <stdbool.h>
+#include <pthread.h>
+
+#include "jobq.h"
+#include "list.h"
+
+/*
+ * iopool - threads that run blocking work, such as reading files, off the
+ * event loops.
+ *
+ * A submitted job runs `work` on one of the pool threads, then `done` on
+ * the loop of the given jobq. The queue is bounded: submitting to a full
+ * pool fails, and the caller falls back to doing the work itself.
+ */
+
+struct iopool {
+    pthread_t *threads;
+    int nthreads;
+
+    pthread_mutex_t mtx;
+    pthread_cond_t cond;
+    struct list_head jobs;
+    int queued;
+    int max_queued;
+    bool stopping;
+};
+
+bool iopool_init(struct iopool *p, int nthreads, int max_queued);
+bool iopool_submit(struct iopool *p, void (*work)(void *data),
+        void (*done)(void *data), void *data, struct jobq *done_q);
+void iopool_destroy(struct iopool *p);
@@ -0,0 +1,98 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+
+#include "jobq.h"
+
+struct job {
+    struct list_node node;
+    void (*fn)(void *data);
+    void *data;
+};
+
+bool jobq_init(struct jobq *q)
+{
+    if (!q)
+        return false;
+
+    q->loop = NULL;
+    if (pipe2(q->fds, O_NONBLOCK | O_CLOEXEC) < 0)
+        return false;
+    pthread_mutex_init(&q->mtx, NULL);
+    list_head_init(&q->jobs);
+
+    return true;
+}
+
+static void jobq_proc(aeEventLoop *loop, int fd, void *data, int mask)
+{
+    struct jobq *q = data;
+    struct list_head jobs;
+    struct job *job, *next;
+    char buf[64];
+
+    (void)(loop);
+    (void)(mask);
+
+    while (read(fd, buf, sizeof(buf)) > 0)
+        ;
+
+    list_head_init(&jobs);
+    pthread_mutex_lock(&q->mtx);
+    list_append_list(&jobs, &q->jobs);
+    pthread_mutex_unlock(&q->mtx);
+
+    list_for_each_safe(&jobs, job, next, node) {
+        list_del(&job->node);
+        job->fn(job->data);
+        free(job);
+    }
+}
+
+bool jobq_attach(struct jobq *q, aeEventLoop *loop)
+{
+    if (aeCreateFileEvent(loop, q->fds[0], AE_READABLE, jobq_proc, q) == AE_ERR)
+        return false;
+
+    q->loop = loop;
+    return true;
+}
+
+bool jobq_push(struct jobq *q, void (*fn)(void *data), void *data)
+{
+    struct job *job = malloc(sizeof(*job));
+    if (!job)
+        return false;
+
+    job->fn = fn;
+    job->data = data;
+
+    pthread_mutex_lock(&q->mtx);
+    bool was_empty = list_empty(&q->jobs);
+    list_add_tail(&q->jobs, &job->node);
+    pthread_mutex_unlock(&q->mtx);
+
+    /* a full pipe already means a wakeup is pending. */
+    if (was_empty && write(q->fds[1], "", 1) < 0 && errno != EAGAIN)
+        return false;
+
+    return true;
+}
+
+void jobq_destroy(struct jobq *q)
+{
+    struct job *job, *next;
+
+    if (q->loop)
+        aeDeleteFileEvent(q->loop, q->fds[0], AE_READABLE);
+    close(q->fds[0]);
+    close(q->fds[1]);
+
+    list_for_each_safe(&q->jobs, job, next, node) {
+        list_del(&job->node);
+        free(job);
+    }
+    pthread_mutex_destroy(&q->mtx);
+}
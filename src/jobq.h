@@ -0,0 +1,27 @@
+#pragma once
+
+#include <stdbool.h>
+#include <pthread.h>
+
+#include "ae.h"
+#include "list.h"
+
+/*
+ * jobq - a queue of callbacks drained by one ae event loop.
+ *
+ * Any thread may push; the jobs run on the loop the queue is attached to,
+ * in push order. A pipe is used to wake the loop up. Jobs pushed before
+ * the queue is attached are kept and run once the loop starts.
+ */
+
+struct jobq {
+    aeEventLoop *loop;
+    int fds[2];
+    pthread_mutex_t mtx;
+    struct list_head jobs;
+};
+
+bool jobq_init(struct jobq *q);
+bool jobq_attach(struct jobq *q, aeEventLoop *loop);
+bool jobq_push(struct jobq *q, void (*fn)(void *data), void *data);
+void jobq_destroy(struct jobq *q);
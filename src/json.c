@@ -326,12 +326,12 @@ static void to_surrogate_pair(uchar_t unicode, uint16_t *uc, uint16_t *lc)
 #define is_space(c) ((c) == '\t' || (c) == '\n' || (c) == '\r' || (c) == ' ')
 #define is_digit(c) ((c) >= '0' && (c) <= '9')
 
-static bool parse_value     (const char **sp, JsonNode        **out);
-static bool parse_string    (const char **sp, char            **out);
-static bool parse_number    (const char **sp, double           *out);
-static bool parse_array     (const char **sp, JsonNode        **out);
-static bool parse_object    (const char **sp, JsonNode        **out);
-static bool parse_hex16     (const char **sp, uint16_t         *out);
+static bool parse_value     (const char **sp, const char *end, JsonNode        **out, JsonArena *arena);
+static bool parse_string    (const char **sp, const char *end, char            **out, JsonArena *arena);
+static bool parse_number    (const char **sp,                  double           *out);
+static bool parse_array     (const char **sp, const char *end, JsonNode        **out, JsonArena *arena);
+static bool parse_object    (const char **sp, const char *end, JsonNode        **out, JsonArena *arena);
+static bool parse_hex16     (const char **sp,                  uint16_t         *out);
 
 static bool expect_literal  (const char **sp, const char *str);
 static void skip_space      (const char **sp);
@@ -348,6 +348,7 @@ static void emit_object_indented    (SB *out, const JsonNode *object, const char
 static int write_hex16(char *out, uint16_t val);
 
 static JsonNode *mknode(JsonTag tag);
+static JsonNode *mknode_in(JsonArena *arena, JsonTag tag);
 static void append_node(JsonNode *parent, JsonNode *child);
 static void prepend_node(JsonNode *parent, JsonNode *child);
 static void append_member(JsonNode *object, char *key, JsonNode *value);
@@ -359,10 +360,11 @@ static bool number_is_valid(const char *num);
 JsonNode *json_decode(const char *json)
 {
 	const char *s = json;
+	const char *end = json + strlen(json);
 	JsonNode *ret;
 	
 	skip_space(&s);
-	if (!parse_value(&s, &ret))
+	if (!parse_value(&s, end, &ret, NULL))
 		return NULL;
 	
 	skip_space(&s);
@@ -374,6 +376,77 @@ JsonNode *json_decode(const char *json)
 	return ret;
 }
 
+JsonNode *json_decode_insitu(char *json, JsonArena *arena)
+{
+	const char *s = json;
+	const char *end = json + strlen(json);
+	JsonNode *ret;
+	
+	skip_space(&s);
+	if (!parse_value(&s, end, &ret, arena))
+		return NULL;
+	
+	skip_space(&s);
+	if (*s != 0)
+		return NULL;
+	
+	return ret;
+}
+
+int json_decode_members(char *json, const char *const keys[], JsonNode *out[],
+                        int count, JsonArena *arena)
+{
+	const char *s = json;
+	const char *end = json + strlen(json);
+	char *key;
+	int found = 0;
+	int i;
+	
+	for (i = 0; i < count; i++)
+		out[i] = NULL;
+	
+	skip_space(&s);
+	if (*s++ != '{')
+		return -1;
+	skip_space(&s);
+	
+	if (*s == '}')
+		return 0;
+	
+	for (;;) {
+		if (!parse_string(&s, end, &key, arena))
+			return -1;
+		skip_space(&s);
+		
+		if (*s++ != ':')
+			return -1;
+		skip_space(&s);
+		
+		/* The first of duplicate keys wins, as with json_find_member. */
+		for (i = 0; i < count; i++)
+			if (out[i] == NULL && strcmp(keys[i], key) == 0)
+				break;
+		
+		/* Values nobody asked for are only stepped over. */
+		if (!parse_value(&s, end, i < count ? &out[i] : NULL, arena))
+			return -1;
+		skip_space(&s);
+		
+		if (i < count) {
+			out[i]->key = key;
+			if (++found == count)
+				return found;
+		}
+		
+		if (*s == '}')
+			return found;
+		
+		if (*s++ != ',')
+			return -1;
+		skip_space(&s);
+	}
+}
+
 char *json_encode(const JsonNode *node)
 {
 	return json_stringify(node, NULL);
@@ -444,9 +517,10 @@ void json_delete(JsonNode *node)
 bool json_validate(const char *json)
 {
 	const char *s = json;
+	const char *end = json + strlen(json);
 	
 	skip_space(&s);
-	if (!parse_value(&s, NULL))
+	if (!parse_value(&s, end, NULL, NULL))
 		return false;
 	
 	skip_space(&s);
@@ -503,6 +577,65 @@ static JsonNode *mknode(JsonTag tag)
 	return ret;
 }
 
+#define ARENA_ALIGN  8 /* for pointers and doubles */
+#define ARENA_CHUNK  4096
+
+struct JsonArenaChunk
+{
+	JsonArenaChunk *next;
+};
+
+void json_arena_init(JsonArena *arena, void *buf, size_t size)
+{
+	arena->cur = (char*) buf;
+	arena->end = buf != NULL ? arena->cur + size : NULL;
+	arena->chunks = NULL;
+}
+
+void json_arena_free(JsonArena *arena)
+{
+	JsonArenaChunk *chunk, *next;
+	
+	for (chunk = arena->chunks; chunk != NULL; chunk = next) {
+		next = chunk->next;
+		free(chunk);
+	}
+	json_arena_init(arena, NULL, 0);
+}
+
+static void *arena_alloc(JsonArena *arena, size_t size)
+{
+	char *p = (char*) (((uintptr_t)arena->cur + ARENA_ALIGN - 1) & ~(uintptr_t)(ARENA_ALIGN - 1));
+	
+	if (arena->cur == NULL || p > arena->end || (size_t)(arena->end - p) < size) {
+		size_t chunk_size = size + ARENA_ALIGN > ARENA_CHUNK ? size + ARENA_ALIGN : ARENA_CHUNK;
+		JsonArenaChunk *chunk = (JsonArenaChunk*) malloc(sizeof(JsonArenaChunk) + chunk_size);
+		if (chunk == NULL)
+			out_of_memory();
+		chunk->next = arena->chunks;
+		arena->chunks = chunk;
+		arena->cur = (char*) (chunk + 1);
+		arena->end = arena->cur + chunk_size;
+		p = (char*) (((uintptr_t)arena->cur + ARENA_ALIGN - 1) & ~(uintptr_t)(ARENA_ALIGN - 1));
+	}
+	
+	arena->cur = p + size;
+	return p;
+}
+
+static JsonNode *mknode_in(JsonArena *arena, JsonTag tag)
+{
+	JsonNode *ret;
+	
+	if (arena == NULL)
+		return mknode(tag);
+	
+	ret = (JsonNode*) arena_alloc(arena, sizeof(JsonNode));
+	memset(ret, 0, sizeof(JsonNode));
+	ret->tag = tag;
+	return ret;
+}
+
 JsonNode *json_mknull(void)
 {
 	return mknode(JSON_NULL);
@@ -631,7 +764,11 @@ void json_remove_from_parent(JsonNode *node)
 	}
 }
 
-static bool parse_value(const char **sp, JsonNode **out)
+/*
+ * With an arena, nodes come from it and strings are unescaped in place, in
+ * the buffer being parsed; nothing is freed on failure, the arena is.
+ */
+static bool parse_value(const char **sp, const char *end, JsonNode **out, JsonArena *arena)
 {
 	const char *s = *sp;
 	
@@ -639,7 +776,7 @@ static bool parse_value(const char **sp, JsonNode **out)
 		case 'n':
 			if (expect_literal(&s, "null")) {
 				if (out)
-					*out = json_mknull();
+					*out = mknode_in(arena, JSON_NULL);
 				*sp = s;
 				return true;
 			}
@@ -647,8 +784,10 @@ static bool parse_value(const char **sp, JsonNode **out)
 		
 		case 'f':
 			if (expect_literal(&s, "false")) {
-				if (out)
-					*out = json_mkbool(false);
+				if (out) {
+					*out = mknode_in(arena, JSON_BOOL);
+					(*out)->bool_ = false;
+				}
 				*sp = s;
 				return true;
 			}
@@ -656,8 +795,10 @@ static bool parse_value(const char **sp, JsonNode **out)
 		
 		case 't':
 			if (expect_literal(&s, "true")) {
-				if (out)
-					*out = json_mkbool(true);
+				if (out) {
+					*out = mknode_in(arena, JSON_BOOL);
+					(*out)->bool_ = true;
+				}
 				*sp = s;
 				return true;
 			}
@@ -665,9 +806,11 @@ static bool parse_value(const char **sp, JsonNode **out)
 		
 		case '"': {
 			char *str;
-			if (parse_string(&s, out ? &str : NULL)) {
-				if (out)
-					*out = mkstring(str);
+			if (parse_string(&s, end, out ? &str : NULL, arena)) {
+				if (out) {
+					*out = mknode_in(arena, JSON_STRING);
+					(*out)->string_ = str;
+				}
 				*sp = s;
 				return true;
 			}
@@ -675,14 +818,14 @@ static bool parse_value(const char **sp, JsonNode **out)
 		}
 		
 		case '[':
-			if (parse_array(&s, out)) {
+			if (parse_array(&s, end, out, arena)) {
 				*sp = s;
 				return true;
 			}
 			return false;
 		
 		case '{':
-			if (parse_object(&s, out)) {
+			if (parse_object(&s, end, out, arena)) {
 				*sp = s;
 				return true;
 			}
@@ -691,8 +834,10 @@ static bool parse_value(const char **sp, JsonNode **out)
 		default: {
 			double num;
 			if (parse_number(&s, out ? &num : NULL)) {
-				if (out)
-					*out = json_mknumber(num);
+				if (out) {
+					*out = mknode_in(arena, JSON_NUMBER);
+					(*out)->number_ = num;
+				}
 				*sp = s;
 				return true;
 			}
@@ -701,10 +846,10 @@ static bool parse_value(const char **sp, JsonNode **out)
 	}
 }
 
-static bool parse_array(const char **sp, JsonNode **out)
+static bool parse_array(const char **sp, const char *end, JsonNode **out, JsonArena *arena)
 {
 	const char *s = *sp;
-	JsonNode *ret = out ? json_mkarray() : NULL;
+	JsonNode *ret = out ? mknode_in(arena, JSON_ARRAY) : NULL;
 	JsonNode *element;
 	
 	if (*s++ != '[')
@@ -717,7 +862,7 @@ static bool parse_array(const char **sp, JsonNode **out)
 	}
 	
 	for (;;) {
-		if (!parse_value(&s, out ? &element : NULL))
+		if (!parse_value(&s, end, out ? &element : NULL, arena))
 			goto failure;
 		skip_space(&s);
 		
@@ -741,14 +886,15 @@ success:
 	return true;
 
 failure:
-	json_delete(ret);
+	if (arena == NULL)
+		json_delete(ret);
 	return false;
 }
 
-static bool parse_object(const char **sp, JsonNode **out)
+static bool parse_object(const char **sp, const char *end, JsonNode **out, JsonArena *arena)
 {
 	const char *s = *sp;
-	JsonNode *ret = out ? json_mkobject() : NULL;
+	JsonNode *ret = out ? mknode_in(arena, JSON_OBJECT) : NULL;
 	char *key;
 	JsonNode *value;
 	
@@ -762,7 +908,7 @@ static bool parse_object(const char **sp, JsonNode **out)
 	}
 	
 	for (;;) {
-		if (!parse_string(&s, out ? &key : NULL))
+		if (!parse_string(&s, end, out ? &key : NULL, arena))
 			goto failure;
 		skip_space(&s);
 		
@@ -770,7 +916,7 @@ static bool parse_object(const char **sp, JsonNode **out)
 			goto failure_free_key;
 		skip_space(&s);
 		
-		if (!parse_value(&s, out ? &value : NULL))
+		if (!parse_value(&s, end, out ? &value : NULL, arena))
 			goto failure_free_key;
 		skip_space(&s);
 		
@@ -794,14 +940,99 @@ success:
 	return true;
 
 failure_free_key:
-	if (out)
+	if (out && arena == NULL)
 		free(key);
 failure:
-	json_delete(ret);
+	if (arena == NULL)
+		json_delete(ret);
 	return false;
 }
 
-bool parse_string(const char **sp, char **out)
+/*
+ * scan_plain() gives the first byte at or after @s that a string cannot just
+ * copy: a quote, a backslash, a control character, or the lead of a UTF-8
+ * sequence to validate.  The nul at @end stops it.  Runs are checked 32 or
+ * 16 bytes at a time with AVX2 or SSE2, else 8 at a time in 64 bit words.
+ * Read as signed, control and UTF-8 bytes alike are below ' '.
+ */
+static inline bool is_plain(unsigned char c)
+{
+	return c >= 0x20 && c < 0x80 && c != '"' && c != '\\';
+}
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+
+static inline const char *scan_plain(const char *s, const char *end)
+{
+	const __m256i quote = _mm256_set1_epi8('"');
+	const __m256i backslash = _mm256_set1_epi8('\\');
+	const __m256i space = _mm256_set1_epi8(0x20);
+	
+	for (; end - s >= 32; s += 32) {
+		__m256i v = _mm256_loadu_si256((const __m256i *)s);
+		__m256i hit = _mm256_or_si256(_mm256_cmpgt_epi8(space, v),
+			_mm256_or_si256(_mm256_cmpeq_epi8(v, quote), _mm256_cmpeq_epi8(v, backslash)));
+		unsigned mask = (unsigned)_mm256_movemask_epi8(hit);
+		if (mask)
+			return s + __builtin_ctz(mask);
+	}
+	while (s < end && is_plain((unsigned char)*s))
+		s++;
+	return s;
+}
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+
+static inline const char *scan_plain(const char *s, const char *end)
+{
+	const __m128i quote = _mm_set1_epi8('"');
+	const __m128i backslash = _mm_set1_epi8('\\');
+	const __m128i space = _mm_set1_epi8(0x20);
+	
+	for (; end - s >= 16; s += 16) {
+		__m128i v = _mm_loadu_si128((const __m128i *)s);
+		__m128i hit = _mm_or_si128(_mm_cmplt_epi8(v, space),
+			_mm_or_si128(_mm_cmpeq_epi8(v, quote), _mm_cmpeq_epi8(v, backslash)));
+		unsigned mask = (unsigned)_mm_movemask_epi8(hit);
+		if (mask)
+			return s + __builtin_ctz(mask);
+	}
+	while (s < end && is_plain((unsigned char)*s))
+		s++;
+	return s;
+}
+#else
+#define ONES  0x0101010101010101ull
+#define HIGHS 0x8080808080808080ull
+
+/*
+ * A lane below 0x20, equal to a quote or a backslash, or with its top bit
+ * set, sets its top bit.  A borrow can only flag lanes above a real hit,
+ * which is then found byte by byte.
+ */
+static inline const char *scan_plain(const char *s, const char *end)
+{
+	for (; end - s >= 8; s += 8) {
+		uint64_t v, q, b;
+		memcpy(&v, s, sizeof(v));
+		q = v ^ (ONES * '"');
+		b = v ^ (ONES * '\\');
+		if ((((v - ONES * 0x20) & ~v) | v | ((q - ONES) & ~q) | ((b - ONES) & ~b)) & HIGHS)
+			break;
+	}
+	while (s < end && is_plain((unsigned char)*s))
+		s++;
+	return s;
+}
+#endif
+
+/*
+ * In place, with an arena, the string is written back over itself: an
+ * escape or a character never decodes to more bytes than it takes, so b
+ * stays behind s, and the closing quote makes room for the terminator.
+ */
+bool parse_string(const char **sp, const char *end, char **out, JsonArena *arena)
 {
 	const char *s = (char *)*sp;
 	SB sb = { };
@@ -812,7 +1043,9 @@ bool parse_string(const char **sp, char **out)
 	if (*s++ != '"')
 		return false;
 	
-	if (out) {
+	if (out && arena) {
+		b = (char *)s;
+	} else if (out) {
 		sb_init(&sb);
 		sb_need(&sb, 4);
 		b = sb.cur;
@@ -821,7 +1054,28 @@ bool parse_string(const char **sp, char **out)
 	}
 	
 	while (*s != '"') {
-		char c = *s++;
+		const char *plain = scan_plain(s, end);
+		char c;
+		
+		/* Copy a run of characters that need no decoding in one go. */
+		if (plain != s) {
+			size_t len = (size_t)(plain - s);
+			
+			if (out && arena) {
+				if (b != s)
+					memmove(b, s, len);
+				b += len;
+			} else if (out) {
+				sb.cur = b;
+				sb_put(&sb, s, len);
+				sb_need(&sb, 4);
+				b = sb.cur;
+			}
+			s = plain;
+			continue;
+		}
+		
+		c = *s++;
 		
 		/* Parse next character, and write it to b. */
 		if (c == '\\') {
@@ -875,7 +1129,7 @@ bool parse_string(const char **sp, char **out)
 					/* Invalid escape */
 					goto failed;
 			}
-		} else if (c <= 0x1F) {
+		} else if ((unsigned char)c <= 0x1F) {
 			/* Control characters are not allowed in string literals. */
 			goto failed;
 		} else {
@@ -895,7 +1149,9 @@ bool parse_string(const char **sp, char **out)
 		 * Update sb to know about the new bytes,
 		 * and set up b to write another character.
 		 */
-		if (out) {
+		if (out && arena) {
+			/* b is already where the next one goes. */
+		} else if (out) {
 			sb.cur = b;
 			sb_need(&sb, 4);
 			b = sb.cur;
@@ -905,13 +1161,17 @@ bool parse_string(const char **sp, char **out)
 	}
 	s++;
 	
-	if (out)
+	if (out && arena) {
+		*b = '\0';
+		*out = (char *)*sp + 1;
+	} else if (out) {
 		*out = sb_finish(&sb);
+	}
 	*sp = s;
 	return true;
 
 failed:
-	if (out)
+	if (out && !arena)
 		sb_free(&sb);
 	return false;
 }
@@ -65,6 +65,22 @@ struct JsonNode
 	};
 };
 
+/*
+ * A bump allocator for decoding without a malloc per node.  It starts in the
+ * caller's buffer, if one is given, and goes on in malloc'd chunks; all of it
+ * is released at once by json_arena_free.
+ */
+typedef struct JsonArenaChunk JsonArenaChunk;
+
+typedef struct
+{
+	char *cur, *end;
+	JsonArenaChunk *chunks;
+} JsonArena;
+
+void json_arena_init(JsonArena *arena, void *buf, size_t size);
+void json_arena_free(JsonArena *arena);
+
 /*** Encoding, decoding, and validation ***/
 
 JsonNode   *json_decode         (const char *json);
@@ -74,6 +90,23 @@ char       *json_stringify      (const JsonNode *node, const char *space);
 char       *json_stringify_length(const JsonNode *node, const char *space, size_t *length);
 void        json_delete         (JsonNode *node);
 
+/*
+ * Decode into @arena, with strings unescaped in place: keys and string
+ * values point into @json, which is overwritten and must outlive the tree.
+ * Never json_delete such a tree, free the arena instead.
+ */
+JsonNode   *json_decode_insitu  (char *json, JsonArena *arena);
+
+/*
+ * Like json_decode_insitu and json_find_member, without building the rest
+ * of the tree: scan the object in @json and decode the values of @keys only,
+ * into @out, NULL for a missing key.  The scan stops once all are found, so
+ * what follows is not validated.  Returns how many were found, -1 if @json
+ * is not an object.
+ */
+int         json_decode_members (char *json, const char *const keys[], JsonNode *out[],
+                                 int count, JsonArena *arena);
+
 bool        json_validate       (const char *json);
 
 /*** Lookup and traversal ***/
@@ -0,0 +1,293 @@
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "dtoa.h"
+#include "jsonw.h"
+
+/*
+ * scan_plain() gives the first byte at or after `p` that a string needs
+ * escaped: a quote, a backslash or a control byte. 32 or 16 bytes are
+ * checked at a time with avx2 or sse2, else 8 in 64 bit words.
+ */
+#if defined(__AVX2__)
+#include <immintrin.h>
+
+static inline const char *scan_plain(const char *p, const char *end)
+{
+    const __m256i quote = _mm256_set1_epi8('"'), backslash = _mm256_set1_epi8('\\');
+    const __m256i ctl = _mm256_set1_epi8(0x1f);
+
+    for (; end - p >= 32; p += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)p);
+        __m256i hit = _mm256_or_si256(_mm256_cmpeq_epi8(_mm256_max_epu8(v, ctl), ctl),
+                _mm256_or_si256(_mm256_cmpeq_epi8(v, quote), _mm256_cmpeq_epi8(v, backslash)));
+        unsigned mask = (unsigned)_mm256_movemask_epi8(hit);
+        if (mask)
+            return p + __builtin_ctz(mask);
+    }
+    return p;
+}
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+
+static inline const char *scan_plain(const char *p, const char *end)
+{
+    const __m128i quote = _mm_set1_epi8('"'), backslash = _mm_set1_epi8('\\');
+    const __m128i ctl = _mm_set1_epi8(0x1f);
+
+    for (; end - p >= 16; p += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)p);
+        __m128i hit = _mm_or_si128(_mm_cmpeq_epi8(_mm_max_epu8(v, ctl), ctl),
+                _mm_or_si128(_mm_cmpeq_epi8(v, quote), _mm_cmpeq_epi8(v, backslash)));
+        unsigned mask = (unsigned)_mm_movemask_epi8(hit);
+        if (mask)
+            return p + __builtin_ctz(mask);
+    }
+    return p;
+}
+#else
+#define ONES 0x0101010101010101ull
+#define HIGHS 0x8080808080808080ull
+
+/*
+ * a lane below 0x20, or equal to a quote or a backslash, sets its top
+ * bit; a borrow only flags lanes above a real hit.
+ */
+static inline const char *scan_plain(const char *p, const char *end)
+{
+    for (; end - p >= 8; p += 8) {
+        uint64_t v, q, b;
+        memcpy(&v, p, sizeof(v));
+        q = v ^ (ONES * '"');
+        b = v ^ (ONES * '\\');
+        if ((((v - ONES * 0x20) & ~v) | ((q - ONES) & ~q) | ((b - ONES) & ~b)) & HIGHS)
+            break;
+    }
+    return p;
+}
+#endif
+
+/* how each byte goes out: 0 as it is, 'u' as \u00XX, else a backslash and that. */
+static const char escapes[256] = {
+    [0x00] = 'u', [0x01] = 'u', [0x02] = 'u', [0x03] = 'u',
+    [0x04] = 'u', [0x05] = 'u', [0x06] = 'u', [0x07] = 'u',
+    [0x08] = 'b', [0x09] = 't', [0x0a] = 'n', [0x0b] = 'u',
+    [0x0c] = 'f', [0x0d] = 'r', [0x0e] = 'u', [0x0f] = 'u',
+    [0x10] = 'u', [0x11] = 'u', [0x12] = 'u', [0x13] = 'u',
+    [0x14] = 'u', [0x15] = 'u', [0x16] = 'u', [0x17] = 'u',
+    [0x18] = 'u', [0x19] = 'u', [0x1a] = 'u', [0x1b] = 'u',
+    [0x1c] = 'u', [0x1d] = 'u', [0x1e] = 'u', [0x1f] = 'u',
+    ['"'] = '"', ['\\'] = '\\',
+};
+
+/* room for `n` more bytes and the nul; NULL once anything failed. */
+static char *reserve(struct jsonw *w, size_t n)
+{
+    if (w->failed)
+        return NULL;
+    if (!strbuf_grow_to(w->out, w->out->len.buffer + n)) {
+        w->failed = true;
+        return NULL;
+    }
+    return w->out->value.buffer + w->out->len.buffer;
+}
+
+static void commit(struct jsonw *w, char *end)
+{
+    *end = '\0';
+    w->out->len.buffer = (size_t)(end - w->out->value.buffer);
+}
+
+/* the comma before a value or key, unless it follows a key or opens a level. */
+static char *begin_value(struct jsonw *w, size_t n)
+{
+    char *p = reserve(w, n + 1);
+    if (!p)
+        return NULL;
+    if (w->after_key)
+        w->after_key = false;
+    else if (w->more & (1ull << w->depth))
+        *p++ = ',';
+    w->more |= 1ull << w->depth;
+    return p;
+}
+
+static void write_char(struct jsonw *w, char c)
+{
+    char *p = reserve(w, 1);
+    if (!p)
+        return;
+    *p = c;
+    commit(w, p + 1);
+}
+
+static void write_value(struct jsonw *w, const char *s, size_t len)
+{
+    char *p = begin_value(w, len);
+    if (!p)
+        return;
+    memcpy(p, s, len);
+    commit(w, p + len);
+}
+
+void jsonw_init(struct jsonw *w, strbuf *out)
+{
+    w->out = out;
+    w->depth = 0;
+    w->more = 0;
+    w->after_key = false;
+    w->failed = false;
+}
+
+bool jsonw_finish(struct jsonw *w)
+{
+    return !w->failed && w->depth == 0;
+}
+
+static void open_level(struct jsonw *w, char c)
+{
+    if (w->depth + 1 == JSONW_MAX_DEPTH) {
+        w->failed = true;
+        return;
+    }
+    write_value(w, &c, 1);
+    w->depth++;
+    w->more &= ~(1ull << w->depth);
+}
+
+static void close_level(struct jsonw *w, char c)
+{
+    if (w->depth == 0) {
+        w->failed = true;
+        return;
+    }
+    w->depth--;
+    write_char(w, c);
+}
+
+void jsonw_object(struct jsonw *w)
+{
+    open_level(w, '{');
+}
+
+void jsonw_object_end(struct jsonw *w)
+{
+    close_level(w, '}');
+}
+
+void jsonw_array(struct jsonw *w)
+{
+    open_level(w, '[');
+}
+
+void jsonw_array_end(struct jsonw *w)
+{
+    close_level(w, ']');
+}
+
+/* the quoted string; room is made for it unescaped, escapes grow it. */
+static void write_string(struct jsonw *w, const char *s, size_t len)
+{
+    static const char hex[] = "0123456789abcdef";
+    const char *end = s + len, *q;
+    char *p = begin_value(w, len + 2);
+
+    if (!p)
+        return;
+    *p++ = '"';
+    for (;;) {
+        q = scan_plain(s, end);
+        while (q < end && !escapes[(unsigned char)*q])
+            q++;
+        memcpy(p, s, (size_t)(q - s));
+        p += q - s;
+        s = q;
+        if (s == end)
+            break;
+
+        /* up to 6 bytes for the 1 this takes, the rest as before. */
+        commit(w, p);
+        if (!(p = reserve(w, 6 + (size_t)(end - s - 1) + 1)))
+            return;
+        unsigned char c = (unsigned char)*s++;
+        *p++ = '\\';
+        if (escapes[c] == 'u') {
+            memcpy(p, "u00", 3);
+            p[3] = hex[c >> 4];
+            p[4] = hex[c & 0xf];
+            p += 5;
+        } else {
+            *p++ = escapes[c];
+        }
+    }
+    *p++ = '"';
+    commit(w, p);
+}
+
+void jsonw_key(struct jsonw *w, const char *key, size_t len)
+{
+    write_string(w, key, len ? len : strlen(key));
+    write_char(w, ':');
+    w->after_key = true;
+}
+
+void jsonw_string(struct jsonw *w, const char *s, size_t len)
+{
+    write_string(w, s, len ? len : strlen(s));
+}
+
+void jsonw_uint(struct jsonw *w, size_t v)
+{
+    char buf[INT2STR_BUF_SZ];
+    size_t len;
+    const char *s = uint_to_string(v, buf, &len);
+
+    write_value(w, s, len);
+}
+
+void jsonw_int(struct jsonw *w, ssize_t v)
+{
+    char buf[INT2STR_BUF_SZ];
+    size_t len;
+    const char *s = int_to_string(v, buf, &len);
+
+    write_value(w, s, len);
+}
+
+void jsonw_double(struct jsonw *w, double v)
+{
+    char buf[DTOA_BUF_SZ];
+    size_t len;
+
+    /* counters and timestamps are whole, skip the float work. */
+    if (v >= -9007199254740992.0 && v <= 9007199254740992.0 && v == (double)(int64_t)v
+            && (v != 0 || !signbit(v))) {
+        jsonw_int(w, (ssize_t)v);
+        return;
+    }
+    len = dtoa_shortest(v, buf);
+    if (len)
+        write_value(w, buf, len);
+    else
+        write_value(w, "null", 4);
+}
+
+void jsonw_bool(struct jsonw *w, bool v)
+{
+    if (v)
+        write_value(w, "true", 4);
+    else
+        write_value(w, "false", 5);
+}
+
+void jsonw_null(struct jsonw *w)
+{
+    write_value(w, "null", 4);
+}
+
+void jsonw_raw(struct jsonw *w, const char *json, size_t len)
+{
+    write_value(w, json, len ? len : strlen(json));
+}
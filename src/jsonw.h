@@ -0,0 +1,58 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "strext.h"
+
+/*
+ * jsonw - a JSON writer that appends straight to a strbuf.
+ *
+ * Nothing is built up first: each call writes its value, with the comma
+ * or colon it needs, at the end of the buffer. Strings are escaped as
+ * they are copied, numbers go through uint_to_string() and dtoa.
+ * Strings are taken to be UTF-8 and their bytes above 0x7f are written
+ * as they are.
+ *
+ * A failed allocation, or nesting deeper than JSONW_MAX_DEPTH, stops the
+ * output; jsonw_finish() tells.
+ *
+ *     jsonw_init(&w, buf);
+ *     jsonw_object(&w);
+ *     jsonw_key(&w, "id", 0);
+ *     jsonw_uint(&w, 3);
+ *     jsonw_object_end(&w);
+ *     if (!jsonw_finish(&w)) ...
+ */
+
+#define JSONW_MAX_DEPTH 64
+
+struct jsonw {
+    strbuf *out;
+    unsigned int depth;
+    uint64_t more;      /* bit n: depth n has a value already, comma next */
+    bool after_key;
+    bool failed;
+};
+
+void jsonw_init(struct jsonw *w, strbuf *out);
+bool jsonw_finish(struct jsonw *w);
+
+void jsonw_object(struct jsonw *w);
+void jsonw_object_end(struct jsonw *w);
+void jsonw_array(struct jsonw *w);
+void jsonw_array_end(struct jsonw *w);
+
+/* `len` 0 takes strlen(), as strbuf_append_str() does. */
+void jsonw_key(struct jsonw *w, const char *key, size_t len);
+void jsonw_string(struct jsonw *w, const char *s, size_t len);
+void jsonw_uint(struct jsonw *w, size_t v);
+void jsonw_int(struct jsonw *w, ssize_t v);
+void jsonw_double(struct jsonw *w, double v);  /* null for nan and inf */
+void jsonw_bool(struct jsonw *w, bool v);
+void jsonw_null(struct jsonw *w);
+
+/* a value that is already JSON. */
+void jsonw_raw(struct jsonw *w, const char *json, size_t len);
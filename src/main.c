@@ -14,7 +14,9 @@
 #include "anet.h"
 #include "http_parser.h"
 #include "hash.h"
+#include "chash.h"
 #include "tmpl.h"
+#include "search.h"
 
 #include "hiredis/hiredis.h"
 #include "hiredis/async.h"
@@ -52,19 +54,29 @@ void *accept_worker(void *arg) {
 void *task_worker(void *arg) {
     aeEventLoop *loop;
     
-    pthread_detach(pthread_self());
     loop = aeCreateEventLoop(64);
     if (!loop) {
         fprintf(stderr, "create ae event loop failed\n");
         pthread_exit(NULL);
     }
-    if (aeCreateTimeEvent(loop, 1, task_cron, NULL, NULL) == AE_ERR) {
+    if (aeCreateTimeEvent(loop, 1, task_cron, NULL, NULL) == AE_ERR
+            || aeCreateTimeEvent(loop, 1, server_cron, NULL, NULL) == AE_ERR) {
         fprintf(stderr, "Can not create event loop timers.\n");
         exit(1);
     }
+    if (!jobq_attach(&g_svr.render_q, loop)) {
+        fprintf(stderr, "Can not attach render queue.\n");
+        exit(1);
+    }
+    if (!watch_resources(loop))
+        WARN("file change notifications unavailable, polling instead.");
     
     aeMain(loop);
     
+    /* nothing is reloaded or rendered past here. */
+    if (g_svr.watching)
+        watcher_destroy(&g_svr.watcher);
+    jobq_destroy(&g_svr.render_q);
     aeDeleteEventLoop(loop);
     pthread_exit(NULL);
 }
@@ -73,15 +85,20 @@ void *worker(void *arg) {
     struct thrd *thread = arg;
     aeEventLoop *loop;
     
-    
-    pthread_detach(pthread_self());
-    
     loop = aeCreateEventLoop(1024);
     if (!loop) {
         fprintf(stderr, "create ae event loop failed\n");
         pthread_exit(NULL);
     }
     thread->loop = loop;
+    if (!jobq_attach(&thread->jobs, loop)) {
+        fprintf(stderr, "Can not attach worker queue.\n");
+        exit(1);
+    }
+    if (aeCreateTimeEvent(loop, 1, server_cron, NULL, NULL) == AE_ERR) {
+        fprintf(stderr, "Can not create event loop timers.\n");
+        exit(1);
+    }
     
     aeMain(loop);
     
@@ -94,20 +111,26 @@ static int cfg_def_init(struct cfg *cfg)
     cfg->port = 80;
     cfg->dir = "./www";
     cfg->thrd_nr = 4;
+    cfg->page_size = 10;
+    cfg->max_stale = 30;
+    cfg->io_thrd_nr = 4;
+    cfg->warm_budget = 0;
+    cfg->warm_timeout = 30;
+    cfg->snapshot = NULL;
     return 0;
 }
 
 
 static int parse_cmd_args(int argc, char **argv)
 {
-    int c, thrd_nr;
+    int c, thrd_nr, page_size, max_stale, io_thrd_nr, warm_mb, warm_timeout;
     long int port;
     
     DIR *d;
 
     opterr = 0;
 
-    while ((c = getopt(argc, argv, "p:a:d:t:?")) != -1) {
+    while ((c = getopt(argc, argv, "p:a:d:t:n:s:i:w:W:S:?")) != -1) {
         switch (c) {
             case 'p':
                 port = strtol(optarg, NULL, 10);
@@ -126,6 +149,49 @@ static int parse_cmd_args(int argc, char **argv)
                 }
                 g_svr.cfg.thrd_nr = (uint8_t)thrd_nr;
                 break;
+            case 'n':
+                page_size = strtol(optarg, NULL, 10);
+                if (page_size > 1000 || page_size < 1) {
+                    fprintf(stderr, "blogs per page is 1-1000.\n");
+                    abort();
+                }
+                g_svr.cfg.page_size = page_size;
+                break;
+            case 's':
+                max_stale = strtol(optarg, NULL, 10);
+                if (max_stale > 86400 || max_stale < 0) {
+                    fprintf(stderr, "max staleness is 0-86400 seconds.\n");
+                    abort();
+                }
+                g_svr.cfg.max_stale = max_stale;
+                break;
+            case 'i':
+                io_thrd_nr = strtol(optarg, NULL, 10);
+                if (io_thrd_nr > 64 || io_thrd_nr < 1) {
+                    fprintf(stderr, "io thread number is 1-64.\n");
+                    abort();
+                }
+                g_svr.cfg.io_thrd_nr = io_thrd_nr;
+                break;
+            case 'w':
+                warm_mb = strtol(optarg, NULL, 10);
+                if (warm_mb > 65536 || warm_mb < 0) {
+                    fprintf(stderr, "warm up budget is 0-65536 MB.\n");
+                    abort();
+                }
+                g_svr.cfg.warm_budget = (size_t)warm_mb << 20;
+                break;
+            case 'W':
+                warm_timeout = strtol(optarg, NULL, 10);
+                if (warm_timeout > 3600 || warm_timeout < 1) {
+                    fprintf(stderr, "warm up timeout is 1-3600 seconds.\n");
+                    abort();
+                }
+                g_svr.cfg.warm_timeout = warm_timeout;
+                break;
+            case 'S':
+                g_svr.cfg.snapshot = optarg;
+                break;
             case 'a':
                 g_svr.cfg.ip = optarg;
                 break;
@@ -149,7 +215,7 @@ static int parse_cmd_args(int argc, char **argv)
                     fprintf(stderr, "Unknown option `\\x%x`.\n", optopt);
                 return 1;
             default:
-                fprintf(stderr, "params: -p <port> -d <dir> -t <threads>.\n");
+                fprintf(stderr, "params: -p <port> -d <dir> -t <threads> -n <blogs per page> -s <max stale seconds> -i <io threads> -w <warm up MB> -W <warm up seconds> -S <snapshot file>.\n");
                 abort();
         }
     }
@@ -168,33 +234,91 @@ static int svr_init(void)
     g_svr.parser_settings.on_header_field = req_header_field_cb; 
     g_svr.parser_settings.on_header_value = req_header_value_cb; 
     g_svr.parser_settings.on_headers_complete = req_headers_complete_cb; 
+    g_svr.parser_settings.on_body = req_body_cb;
     
-    g_svr.threads = calloc(g_svr.cfg.thrd_nr, sizeof(struct thrd));
-    if (!g_svr.threads) {
-        fprintf(stderr, "failed to alloc memory.\n");
+    mime_tables_init();
+    g_svr.cache = chash_str_new(CACHE_SHARDS, free, content_free);
+    pthread_rwlock_init(&g_svr.paths_lock, NULL);
+    g_svr.rendering = hash_str_new(NULL, NULL);
+    pthread_mutex_init(&g_svr.render_mtx, NULL);
+    g_svr.flights = hash_str_new(NULL, NULL);
+    pthread_mutex_init(&g_svr.flights_mtx, NULL);
+    if (!jobq_init(&g_svr.render_q)) {
+        fprintf(stderr, "failed to init render queue.\n");
         abort();
     }
-    
-    mime_tables_init();
-    g_svr.cache = hash_str_new(free, content_free);
     g_svr.blogs = malloc(sizeof(struct list_head));
     list_head_init(g_svr.blogs);
+    g_svr.blog_ids = hash_int_new(NULL, NULL);
+    g_svr.search = search_new();
+    if (!g_svr.search) {
+        fprintf(stderr, "failed to alloc memory.\n");
+        abort();
+    }
 
-    refresh_index_page();
     return 0;
 }   
 
+/* after the args, -t sets the number of workers. */
+static int thrds_init(void)
+{
+    int i;
+
+    g_svr.threads = calloc(g_svr.cfg.thrd_nr, sizeof(struct thrd));
+    if (!g_svr.threads) {
+        fprintf(stderr, "failed to alloc memory.\n");
+        abort();
+    }
+    for (i = 0; i < g_svr.cfg.thrd_nr; i++) {
+        if (!jobq_init(&g_svr.threads[i].jobs)) {
+            fprintf(stderr, "failed to init worker queue.\n");
+            abort();
+        }
+    }
+    if (!iopool_init(&g_svr.iopool, g_svr.cfg.io_thrd_nr, IOPOOL_MAX_QUEUED)) {
+        fprintf(stderr, "failed to start io threads.\n");
+        abort();
+    }
+    return 0;
+}
+
+/* after the loops stopped, the io threads are the last to touch the cache. */
 static int svr_fini(void)
 {
+    int i;
+
     // clean threads.
+    iopool_destroy(&g_svr.iopool);
     if (g_svr.threads) {
+        for (i = 0; i < g_svr.cfg.thrd_nr; i++) {
+            jobq_destroy(&g_svr.threads[i].jobs);
+            if (g_svr.threads[i].loop)
+                aeDeleteEventLoop(g_svr.threads[i].loop);
+        }
         free(g_svr.threads);
         g_svr.threads = NULL;
     }
+
+    /* the cache as it is now, before what it was built from goes. */
+    if (g_svr.cfg.warm_budget)
+        save_hotness();
+    if (g_svr.cfg.snapshot)
+        snapshot_save(g_svr.cfg.snapshot);
+
     pthread_mutex_destroy(&g_svr.mtx);
- 
+    hash_free(g_svr.blog_ids);
     free_blogs_list(g_svr.blogs);
-    hash_free(g_svr.cache);
+    search_free(g_svr.search);
+    chash_free(g_svr.cache);
+    snapshot_unmap();
+    http_free_url_map(&g_svr);
+    templates_fini();
+    paths_fini();
+    pthread_rwlock_destroy(&g_svr.paths_lock);
+    hash_free(g_svr.rendering);
+    pthread_mutex_destroy(&g_svr.render_mtx);
+    hash_free(g_svr.flights);
+    pthread_mutex_destroy(&g_svr.flights_mtx);
     mime_tables_shutdown();
     return 0;
 }
@@ -214,6 +338,17 @@ int main (int argc, char **argv) {
     
     svr_init();
     parse_cmd_args(argc, argv);
+    thrds_init();
+    if (!templates_init())
+        DIE("could not load page templates from ./tmpl");
+    paths_rebuild();
+    if (g_svr.cfg.snapshot)
+        snapshot_load(g_svr.cfg.snapshot);
+    /* after the args, the pages depend on dir and page size. */
+    refresh_index_page();
+    /* before accepting, the first requests find the cache filled. */
+    if (g_svr.cfg.warm_budget)
+        warm_up();
     if (signal(SIGINT, sig_handler) == SIG_ERR
             || signal(SIGTERM, sig_handler) == SIG_ERR) {
         fprintf(stderr, "failed to bind signal handler.\n");
@@ -223,9 +358,27 @@ int main (int argc, char **argv) {
     signal(SIGPIPE, SIG_IGN);
     
     const struct url_map aehttpd_url_map[] = {
-        { .prefix = "/blogs/", .handler = blogs },
-        { .prefix = "/", .handler = static_files },
-        { .prefix = NULL }
+        { .route = "/blogs", .handler = blogs },
+        { .route = "/blogs/:id", .handler = blogs },
+        { .route = "/page/:n", .handler = index_pages },
+        { .route = "/status", .handler = status_page },
+        { .route = "/status.json", .handler = status_json },
+        { .route = "/api/blogs", .handler = api_blogs,
+          .flags = HANDLER_PARSE_QUERY_STRING
+                | HANDLER_PARSE_IF_NONE_MATCH
+                | HANDLER_PARSE_ACCEPT_ENCODING },
+        { .route = "/api/blogs/:id", .handler = api_blog,
+          .flags = HANDLER_PARSE_IF_NONE_MATCH | HANDLER_PARSE_ACCEPT_ENCODING },
+        { .route = "/search", .handler = search_blogs,
+          .flags = HANDLER_PARSE_QUERY_STRING
+                | HANDLER_PARSE_IF_NONE_MATCH
+                | HANDLER_PARSE_ACCEPT_ENCODING },
+        { .route = "/*", .handler = static_files,
+          .flags = HANDLER_PARSE_QUERY_STRING
+                | HANDLER_PARSE_IF_MODIFIED_SINCE
+                | HANDLER_PARSE_IF_NONE_MATCH
+                | HANDLER_PARSE_ACCEPT_ENCODING },
+        { .route = NULL }
     };
     
     http_set_url_map(&g_svr, aehttpd_url_map);
@@ -241,7 +394,11 @@ int main (int argc, char **argv) {
     }
     
 leave:    
+    /* every loop stops on its own once running is cleared. */
     pthread_join(accept_thrd, &res);
+    for (i = 0; i < g_svr.cfg.thrd_nr; i++)
+        pthread_join(g_svr.threads[i].self, &res);
+    pthread_join(task_thrd, &res);
 
     svr_fini();
     printf("aehttpd exited\n");
@@ -0,0 +1,203 @@
+/*
+ * mkbundle - writes the bundle of the site as C, see bundle.h.
+ *
+ *   mkbundle <out.c> <prefix>=<dir> ...
+ *
+ * every file under <dir> is bundled as <prefix><its path in dir>.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <zlib.h>
+
+#include "bundle.h"
+
+struct file {
+    char *path;
+    unsigned char *data;
+    size_t len;
+    size_t raw_len;
+    int gzipped;
+    time_t mtime;
+    size_t slot;
+};
+
+static struct file *files;
+static size_t nfiles, files_alloc;
+
+#define DIE(...) do { fprintf(stderr, "mkbundle: " __VA_ARGS__); \
+        fputc('\n', stderr); exit(1); } while (0)
+
+static unsigned char *read_all(const char *path, size_t len)
+{
+    FILE *f = fopen(path, "rb");
+    if (!f)
+        DIE("open %s failed", path);
+    unsigned char *buf = malloc(len + 1);
+    if (!buf || fread(buf, 1, len, f) != len)
+        DIE("read %s failed", path);
+    fclose(f);
+    return buf;
+}
+
+/* gzip `f` in place if that saves a tenth at least. */
+static void compress_file(struct file *f)
+{
+    uLong bound = compressBound(f->raw_len) + 32;
+    unsigned char *out = malloc(bound);
+    z_stream zs;
+
+    memset(&zs, 0, sizeof(zs));
+    if (!out || deflateInit2(&zs, 9, Z_DEFLATED, 15 + 16, 9, Z_DEFAULT_STRATEGY) != Z_OK)
+        DIE("deflate init failed");
+    zs.next_in = f->data;
+    zs.avail_in = (uInt)f->raw_len;
+    zs.next_out = out;
+    zs.avail_out = (uInt)bound;
+    if (deflate(&zs, Z_FINISH) != Z_STREAM_END)
+        DIE("deflate %s failed", f->path);
+    deflateEnd(&zs);
+
+    if (zs.total_out < f->raw_len - f->raw_len / 10) {
+        free(f->data);
+        f->data = out;
+        f->len = zs.total_out;
+        f->gzipped = 1;
+    } else {
+        free(out);
+    }
+}
+
+static void add_dir(const char *prefix, const char *dir)
+{
+    DIR *d = opendir(dir);
+    if (!d)
+        DIE("open dir %s failed", dir);
+
+    struct dirent *ptr;
+    while ((ptr = readdir(d)) != NULL) {
+        if (ptr->d_name[0] == '.')
+            continue;
+
+        char path[1024], name[1024];
+        struct stat st;
+        snprintf(path, sizeof(path), "%s/%s", dir, ptr->d_name);
+        snprintf(name, sizeof(name), "%s%s", prefix, ptr->d_name);
+        if (stat(path, &st) == -1)
+            DIE("stat %s failed", path);
+
+        if (S_ISDIR(st.st_mode)) {
+            strcat(name, "/");
+            add_dir(name, path);
+            continue;
+        }
+        if (!S_ISREG(st.st_mode))
+            continue;
+        if (strpbrk(name, "\"\\"))
+            DIE("can not bundle %s", path);
+
+        if (nfiles == files_alloc) {
+            files_alloc = files_alloc ? files_alloc * 2 : 64;
+            files = realloc(files, files_alloc * sizeof(*files));
+            if (!files)
+                DIE("out of memory");
+        }
+        struct file *f = &files[nfiles++];
+        memset(f, 0, sizeof(*f));
+        f->path = strdup(name);
+        f->raw_len = f->len = (size_t)st.st_size;
+        f->data = read_all(path, f->raw_len);
+        f->mtime = st.st_mtime;
+        if (f->raw_len)
+            compress_file(f);
+    }
+
+    closedir(d);
+}
+
+static void write_bytes(FILE *out, const unsigned char *data, size_t len)
+{
+    size_t i;
+    for (i = 0; i < len; i++)
+        fprintf(out, "0x%x,%s", data[i], i % 16 == 15 ? "\n" : " ");
+    if (!len)
+        fprintf(out, "0");
+    fprintf(out, "\n");
+}
+
+int main(int argc, char **argv)
+{
+    size_t i, j;
+
+    if (argc < 3)
+        DIE("usage: mkbundle <out.c> <prefix>=<dir> ...");
+
+    for (i = 2; i < (size_t)argc; i++) {
+        char *eq = strchr(argv[i], '=');
+        if (!eq)
+            DIE("expected <prefix>=<dir>, got %s", argv[i]);
+        *eq = 0;
+        add_dir(argv[i], eq + 1);
+    }
+
+    /* the assets are written in the order of their slots. */
+    const char **keys = malloc((nfiles + 1) * sizeof(*keys));
+    size_t *slots = malloc((nfiles + 1) * sizeof(*slots));
+    uint32_t *disp;
+    size_t ndisp;
+    if (!keys || !slots)
+        DIE("out of memory");
+    for (i = 0; i < nfiles; i++)
+        keys[i] = files[i].path;
+    if (!phf_build(keys, nfiles, &disp, &ndisp, slots))
+        DIE("no perfect hash found");
+    for (i = 0; i < nfiles; i++)
+        files[i].slot = slots[i];
+
+    FILE *out = fopen(argv[1], "w");
+    if (!out)
+        DIE("open %s failed", argv[1]);
+
+    fprintf(out, "/* generated by mkbundle, do not edit. */\n");
+    fprintf(out, "#include \"bundle.h\"\n\n");
+    for (i = 0; i < nfiles; i++) {
+        fprintf(out, "static const unsigned char asset_%zu[] = {\n", i);
+        write_bytes(out, files[i].data, files[i].len);
+        fprintf(out, "};\n\n");
+    }
+
+    fprintf(out, "const struct bundle_asset bundle_assets[] = {\n");
+    for (j = 0; j < nfiles; j++) {
+        for (i = 0; i < nfiles && files[i].slot != j; i++)
+            ;
+        const struct file *f = &files[i];
+        char date[64];
+        struct tm tm;
+        gmtime_r(&f->mtime, &tm);
+        strftime(date, sizeof(date), "%a, %d %b %Y %T GMT", &tm);
+        fprintf(out, "    { \"%s\", asset_%zu, %zu, %zu, %s, %lld, \"%s\", "
+                "\"\\\"%08x-%zx\\\"\" },\n",
+                f->path, i, f->len, f->raw_len, f->gzipped ? "true" : "false",
+                (long long)f->mtime, date,
+                phf_hash((const char *)f->data, f->len, 0), f->raw_len);
+    }
+    if (!nfiles)
+        fprintf(out, "    { 0 }\n");
+    fprintf(out, "};\n");
+    fprintf(out, "const size_t bundle_nassets = %zu;\n\n", nfiles);
+
+    fprintf(out, "const uint32_t bundle_disp[] = {\n");
+    for (i = 0; i < ndisp; i++)
+        fprintf(out, "%u,%s", disp[i], i % 8 == 7 ? "\n" : " ");
+    fprintf(out, "\n};\n");
+    fprintf(out, "const size_t bundle_ndisp = %zu;\n", ndisp);
+
+    if (fclose(out) != 0)
+        DIE("write %s failed", argv[1]);
+
+    fprintf(stderr, "mkbundle: %zu files\n", nfiles);
+    return 0;
+}
@@ -0,0 +1,92 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "phf.h"
+
+#define PHF_MAX_SEED (1u << 24)
+
+struct bucket {
+    size_t idx;
+    size_t n;
+    size_t first;   /* into the keys sorted by bucket */
+};
+
+static int compare_bucket(const void *a, const void *b)
+{
+    const struct bucket *b1 = a, *b2 = b;
+    return b1->n < b2->n ? 1 : b1->n > b2->n ? -1 : 0;
+}
+
+bool phf_build(const char *const keys[], size_t n, uint32_t **disp,
+        size_t *ndisp, size_t slots[])
+{
+    size_t nb = n / 4 + 1, i, j;
+    uint32_t *d = calloc(nb, sizeof(*d));
+    struct bucket *buckets = calloc(nb, sizeof(*buckets));
+    size_t *of = malloc((n + 1) * sizeof(*of));    /* bucket of each key */
+    size_t *order = malloc((n + 1) * sizeof(*order));
+    size_t *lens = malloc((n + 1) * sizeof(*lens));
+    char *taken = calloc(n + 1, 1);
+    bool ok = false;
+
+    if (!d || !buckets || !of || !order || !lens || !taken)
+        goto out;
+
+    for (i = 0; i < nb; i++)
+        buckets[i].idx = i;
+    for (i = 0; i < n; i++) {
+        lens[i] = strlen(keys[i]);
+        of[i] = phf_hash(keys[i], lens[i], 0) % nb;
+        buckets[of[i]].n++;
+    }
+    /* group the keys by bucket, counting sort. */
+    for (i = 0, j = 0; i < nb; i++) {
+        buckets[i].first = j;
+        j += buckets[i].n;
+        buckets[i].n = 0;
+    }
+    for (i = 0; i < n; i++) {
+        struct bucket *b = &buckets[of[i]];
+        order[b->first + b->n++] = i;
+    }
+
+    /* the largest buckets are the hardest to place, they go first. */
+    qsort(buckets, nb, sizeof(*buckets), compare_bucket);
+
+    for (i = 0; i < nb && buckets[i].n; i++) {
+        const struct bucket *b = &buckets[i];
+        const size_t *ks = &order[b->first];
+        uint32_t seed;
+
+        for (seed = 1; seed < PHF_MAX_SEED; seed++) {
+            for (j = 0; j < b->n; j++) {
+                slots[ks[j]] = phf_hash(keys[ks[j]], lens[ks[j]], seed) % n;
+                if (taken[slots[ks[j]]])
+                    break;
+                taken[slots[ks[j]]] = 1;
+            }
+            if (j == b->n)
+                break;
+            /* undo the part of the bucket placed. */
+            while (j--)
+                taken[slots[ks[j]]] = 0;
+        }
+        if (seed == PHF_MAX_SEED)
+            goto out;
+        d[b->idx] = seed;
+    }
+
+    *disp = d;
+    *ndisp = nb;
+    d = NULL;
+    ok = true;
+
+out:
+    free(d);
+    free(buckets);
+    free(of);
+    free(order);
+    free(lens);
+    free(taken);
+    return ok;
+}
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * phf - minimal perfect hashing of a fixed set of strings.
+ *
+ * Hash and displace: the keys are split into buckets by one hash, then
+ * each bucket gets the seed of a second hash that sends all of its keys
+ * to free slots. n keys take exactly n slots; a lookup is two hashes, the
+ * caller compares the key found in the slot to tell a miss.
+ */
+
+static inline uint32_t phf_hash(const char *s, size_t len, uint32_t seed)
+{
+    uint32_t h = 2166136261u ^ seed;
+    size_t i;
+    for (i = 0; i < len; i++) {
+        h ^= (unsigned char)s[i];
+        h *= 16777619u;
+    }
+    h ^= h >> 16;
+    h *= 0x85ebca6b;
+    h ^= h >> 13;
+    h *= 0xc2b2ae35;
+    h ^= h >> 16;
+    return h;
+}
+
+static inline size_t phf_slot(const uint32_t *disp, size_t ndisp, size_t n,
+        const char *key, size_t len)
+{
+    uint32_t d = disp[phf_hash(key, len, 0) % ndisp];
+    return phf_hash(key, len, d) % n;
+}
+
+/* the slot of keys[i] goes to slots[i]; free() *disp after use. */
+bool phf_build(const char *const keys[], size_t n, uint32_t **disp,
+        size_t *ndisp, size_t slots[]);
@@ -0,0 +1,190 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <strings.h>
+
+#include "http_parser.h"
+#include "reqparse.h"
+
+/*
+ * find_le() gives the first byte at or after `p` that is <= `le` or
+ * DEL: control bytes, and with le = ' ' a space too. bytes >= 0x80 pass,
+ * they are obs-text in values and urls alike.
+ */
+#if defined(__SSE2__)
+#include <emmintrin.h>
+
+static inline const char *find_le(const char *p, const char *end, unsigned char le)
+{
+    const __m128i max = _mm_set1_epi8((char)le), del = _mm_set1_epi8(0x7f);
+
+    for (; end - p >= 16; p += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)p);
+        __m128i hit = _mm_or_si128(_mm_cmpeq_epi8(_mm_max_epu8(v, max), max),
+                _mm_cmpeq_epi8(v, del));
+        unsigned mask = (unsigned)_mm_movemask_epi8(hit);
+        if (mask)
+            return p + __builtin_ctz(mask);
+    }
+    for (; p < end; p++) {
+        if ((unsigned char)*p <= le || *p == 0x7f)
+            break;
+    }
+    return p;
+}
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+
+static inline const char *find_le(const char *p, const char *end, unsigned char le)
+{
+    const uint8x16_t max = vdupq_n_u8(le), del = vdupq_n_u8(0x7f);
+
+    for (; end - p >= 16; p += 16) {
+        uint8x16_t v = vld1q_u8((const uint8_t *)p);
+        uint8x16_t hit = vorrq_u8(vcleq_u8(v, max), vceqq_u8(v, del));
+        uint64_t mask = vget_lane_u64(vreinterpret_u64_u8(
+                vshrn_n_u16(vreinterpretq_u16_u8(hit), 4)), 0);
+        if (mask)
+            return p + __builtin_ctzll(mask) / 4;
+    }
+    for (; p < end; p++) {
+        if ((unsigned char)*p <= le || *p == 0x7f)
+            break;
+    }
+    return p;
+}
+#else
+#define ONES 0x0101010101010101ull
+#define HIGHS 0x8080808080808080ull
+
+/*
+ * eight bytes at a time: a lane below le + 1, or equal to DEL, sets its
+ * top bit. a borrow can only flag lanes above a real hit, and the hit
+ * is then found byte by byte, whatever the byte order.
+ */
+static inline const char *find_le(const char *p, const char *end, unsigned char le)
+{
+    const uint64_t below = ONES * (uint64_t)(le + 1);
+
+    for (; end - p >= 8; p += 8) {
+        uint64_t v, d;
+        memcpy(&v, p, sizeof(v));
+        d = v ^ (ONES * 0x7f);
+        if (((v - below) & ~v & HIGHS) | ((d - ONES) & ~d & HIGHS))
+            break;
+    }
+    for (; p < end; p++) {
+        if ((unsigned char)*p <= le || *p == 0x7f)
+            break;
+    }
+    return p;
+}
+#endif
+
+/* the bytes of a header name, RFC 7230 tchar. */
+static const unsigned char tchar[256] = {
+    ['!'] = 1, ['#'] = 1, ['$'] = 1, ['%'] = 1, ['&'] = 1, ['\''] = 1,
+    ['*'] = 1, ['+'] = 1, ['-'] = 1, ['.'] = 1, ['^'] = 1, ['_'] = 1,
+    ['`'] = 1, ['|'] = 1, ['~'] = 1,
+    ['0'] = 1, ['1'] = 1, ['2'] = 1, ['3'] = 1, ['4'] = 1, ['5'] = 1,
+    ['6'] = 1, ['7'] = 1, ['8'] = 1, ['9'] = 1,
+    ['A'] = 1, ['B'] = 1, ['C'] = 1, ['D'] = 1, ['E'] = 1, ['F'] = 1,
+    ['G'] = 1, ['H'] = 1, ['I'] = 1, ['J'] = 1, ['K'] = 1, ['L'] = 1,
+    ['M'] = 1, ['N'] = 1, ['O'] = 1, ['P'] = 1, ['Q'] = 1, ['R'] = 1,
+    ['S'] = 1, ['T'] = 1, ['U'] = 1, ['V'] = 1, ['W'] = 1, ['X'] = 1,
+    ['Y'] = 1, ['Z'] = 1,
+    ['a'] = 1, ['b'] = 1, ['c'] = 1, ['d'] = 1, ['e'] = 1, ['f'] = 1,
+    ['g'] = 1, ['h'] = 1, ['i'] = 1, ['j'] = 1, ['k'] = 1, ['l'] = 1,
+    ['m'] = 1, ['n'] = 1, ['o'] = 1, ['p'] = 1, ['q'] = 1, ['r'] = 1,
+    ['s'] = 1, ['t'] = 1, ['u'] = 1, ['v'] = 1, ['w'] = 1, ['x'] = 1,
+    ['y'] = 1, ['z'] = 1,
+};
+
+static inline bool name_is(const struct reqparse_slice *name, const char *s,
+        size_t len)
+{
+    return name->len == len && !strncasecmp(name->at, s, len);
+}
+
+/* headers that bring a body or another protocol, http_parser's business. */
+static inline bool header_is_rare(const struct reqparse_slice *name)
+{
+    return name_is(name, "Content-Length", 14)
+        || name_is(name, "Transfer-Encoding", 17)
+        || name_is(name, "Upgrade", 7);
+}
+
+/*
+ * parse the request at the head of `buf`; returns its length, through
+ * the blank line, or 0 to leave it to http_parser.
+ */
+size_t reqparse(const char *buf, size_t len, struct reqparse *r)
+{
+    const char *p = buf, *end = buf + len, *q;
+
+    if (len >= 4 && !memcmp(p, "GET ", 4)) {
+        r->method = HTTP_GET;
+        p += 4;
+    } else if (len >= 5 && !memcmp(p, "HEAD ", 5)) {
+        r->method = HTTP_HEAD;
+        p += 5;
+    } else {
+        return 0;
+    }
+
+    /* origin-form only, an absolute url is for proxies. */
+    if (p == end || *p != '/')
+        return 0;
+    q = find_le(p, end, ' ');
+    if (q == end || *q != ' ')
+        return 0;
+    r->url.at = p;
+    r->url.len = (size_t)(q - p);
+    p = q + 1;
+
+    if (end - p < 10 || memcmp(p, "HTTP/1.", 7) || (p[7] != '0' && p[7] != '1')
+            || p[8] != '\r' || p[9] != '\n')
+        return 0;
+    r->http_major = 1;
+    r->http_minor = (unsigned short)(p[7] - '0');
+    p += 10;
+
+    r->nheaders = 0;
+    for (;;) {
+        struct reqparse_header *h;
+
+        if (end - p < 2)
+            return 0;
+        if (p[0] == '\r') {
+            if (p[1] != '\n')
+                return 0;
+            return (size_t)(p + 2 - buf);
+        }
+        if (r->nheaders == REQPARSE_MAX_HEADERS)
+            return 0;
+        h = &r->headers[r->nheaders];
+
+        /* a folded line starts with a space, not a tchar. */
+        for (q = p; q < end && tchar[(unsigned char)*q]; q++)
+            ;
+        if (q == p || q == end || *q != ':')
+            return 0;
+        h->name.at = p;
+        h->name.len = (size_t)(q - p);
+        if (header_is_rare(&h->name))
+            return 0;
+
+        for (p = q + 1; p < end && (*p == ' ' || *p == '\t'); p++)
+            ;
+        h->value.at = p;
+        for (q = find_le(p, end, 0x1f); q < end && *q == '\t'; q = find_le(q + 1, end, 0x1f))
+            ;
+        if (end - q < 2 || q[0] != '\r' || q[1] != '\n')
+            return 0;
+        p = q + 2;
+        while (q > h->value.at && (q[-1] == ' ' || q[-1] == '\t'))
+            q--;
+        h->value.len = (size_t)(q - h->value.at);
+        r->nheaders++;
+    }
+}
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <stddef.h>
+
+/*
+ * reqparse - a fast path for the requests browsers send.
+ *
+ * A complete GET or HEAD request, HTTP/1.0 or 1.1, with no body and
+ * nothing unusual in it, is split in one pass into slices of the buffer:
+ * the method, the url, the version, each header's name and value. The
+ * delimiters are found 16 bytes at a time, with sse2 or neon, or 8 with
+ * plain 64 bit words.
+ *
+ * Anything else, incomplete, malformed or merely rare (a body, folded
+ * headers, a bare LF, an upgrade), is left to http_parser: reqparse()
+ * returns 0 and has not touched the buffer.
+ */
+
+#define REQPARSE_MAX_HEADERS 64
+
+struct reqparse_slice {
+    const char *at;
+    size_t len;
+};
+
+struct reqparse_header {
+    struct reqparse_slice name;
+    struct reqparse_slice value;    /* without the spaces around it */
+};
+
+struct reqparse {
+    unsigned method;                /* HTTP_GET or HTTP_HEAD */
+    struct reqparse_slice url;
+    unsigned short http_major, http_minor;
+    struct reqparse_header headers[REQPARSE_MAX_HEADERS];
+    int nheaders;
+};
+
+size_t reqparse(const char *buf, size_t len, struct reqparse *r);
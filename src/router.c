@@ -0,0 +1,496 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+
+#include "router.h"
+
+/*
+ * routes are added to a tree of pointers, which router_build() lays out
+ * flat: the nodes in one array, the kids of each next to one another,
+ * their labels and kid tables in one block of bytes. a lookup then
+ * follows offsets into memory that stays warm, not pointers into the
+ * heap.
+ */
+
+/* a route ending at a node, the first added whose methods fit wins. */
+struct route_end {
+    uint64_t methods;
+    void *data;
+    char *names[ROUTER_MAX_PARAMS];
+    int nnames;
+    struct route_end *next;
+};
+
+struct route_node {
+    struct route_node **kids;   /* labels all start with different bytes */
+    size_t nkids;
+    struct route_node *param;   /* the `:name` kid */
+    struct route_end *ends;     /* routes ending here */
+    struct route_end *rest;     /* `*name` routes, ending anywhere below */
+    size_t len;
+    char label[];               /* the bytes on the edge leading here */
+};
+
+/*
+ * a scan over a few kids is cheap, over more its branches mispredict on
+ * every level: wider nodes look their kids up by a table instead. no
+ * label starts with a nul, so there are at most 255 kids to number.
+ */
+#define INDEX_KIDS 4
+#define NO_NODE 0           /* the root is no one's kid */
+
+struct flat_node {
+    uint32_t label;         /* into bytes */
+    uint32_t kids;          /* the first, into nodes */
+    uint32_t first;         /* into bytes: nkids first bytes, or the table */
+    uint32_t param;
+    uint32_t ends;          /* the first, into ends */
+    uint32_t rest;
+    uint16_t len;
+    uint8_t nkids;
+    uint8_t nends;
+    uint8_t nrest;
+};
+
+struct flat_end {
+    uint64_t methods;
+    void *data;
+    uint32_t names;         /* the first, into names */
+    uint32_t nnames;
+};
+
+struct router {
+    struct route_node *root;    /* until built */
+
+    struct flat_node *nodes;
+    struct flat_end *ends;
+    char **names;
+    unsigned char *bytes;
+    size_t nnodes, nends, nnames, nbytes;
+};
+
+static struct route_node *node_new(const char *label, size_t len)
+{
+    struct route_node *n = calloc(1, sizeof(*n) + len + 1);
+    if (!n)
+        return NULL;
+    memcpy(n->label, label, len);
+    n->len = len;
+    return n;
+}
+
+static void ends_free(struct route_end *e, void (*free_data)(void *data))
+{
+    while (e) {
+        struct route_end *next = e->next;
+        int i;
+
+        for (i = 0; i < e->nnames; i++)
+            free(e->names[i]);
+        if (free_data && e->data)
+            free_data(e->data);
+        free(e);
+        e = next;
+    }
+}
+
+static void node_free(struct route_node *n, void (*free_data)(void *data))
+{
+    size_t i;
+
+    if (!n)
+        return;
+    for (i = 0; i < n->nkids; i++)
+        node_free(n->kids[i], free_data);
+    node_free(n->param, free_data);
+    ends_free(n->ends, free_data);
+    ends_free(n->rest, free_data);
+    free(n->kids);
+    free(n);
+}
+
+struct router *router_new(void)
+{
+    struct router *r = calloc(1, sizeof(*r));
+    if (!r)
+        return NULL;
+    if (!(r->root = node_new("", 0))) {
+        free(r);
+        return NULL;
+    }
+    return r;
+}
+
+/* `free_data` is called on the data of every route, if not NULL. */
+void router_free(struct router *r, void (*free_data)(void *data))
+{
+    size_t i;
+
+    if (!r)
+        return;
+    node_free(r->root, free_data);
+    for (i = 0; i < r->nends && free_data; i++)
+        free_data(r->ends[i].data);
+    for (i = 0; i < r->nnames; i++)
+        free(r->names[i]);
+    free(r->nodes);
+    free(r->ends);
+    free(r->names);
+    free(r->bytes);
+    free(r);
+}
+
+static bool node_add_kid(struct route_node *n, struct route_node *kid)
+{
+    struct route_node **kids = realloc(n->kids, (n->nkids + 1) * sizeof(*kids));
+    if (!kids)
+        return false;
+    n->kids = kids;
+    n->kids[n->nkids++] = kid;
+    return true;
+}
+
+static ssize_t node_find_kid(const struct route_node *n, char c)
+{
+    size_t i;
+
+    for (i = 0; i < n->nkids; i++) {
+        if (n->kids[i]->label[0] == c)
+            return (ssize_t)i;
+    }
+    return -1;
+}
+
+/* the node `len` plain bytes below `n`, made by splitting edges as needed. */
+static struct route_node *node_insert(struct route_node *n, const char *s,
+        size_t len)
+{
+    while (len) {
+        ssize_t i = node_find_kid(n, *s);
+        struct route_node *kid = i < 0 ? NULL : n->kids[i];
+        size_t common = 0;
+
+        if (!kid) {
+            kid = node_new(s, len);
+            if (!kid || !node_add_kid(n, kid)) {
+                free(kid);
+                return NULL;
+            }
+            return kid;
+        }
+
+        while (common < kid->len && common < len && kid->label[common] == s[common])
+            common++;
+
+        if (common < kid->len) {
+            /* the kid keeps the tail of its edge, below a new node. */
+            struct route_node *mid = node_new(kid->label, common);
+            if (!mid || !node_add_kid(mid, kid)) {
+                free(mid);
+                return NULL;
+            }
+            kid->len -= common;
+            memmove(kid->label, kid->label + common, kid->len + 1);
+            n->kids[i] = mid;
+            kid = mid;
+        }
+
+        n = kid;
+        s += common;
+        len -= common;
+    }
+    return n;
+}
+
+static void ends_append(struct route_end **list, struct route_end *e)
+{
+    while (*list)
+        list = &(*list)->next;
+    *list = e;
+}
+
+/*
+ * a route for `pattern`, see router.h. a route matching the same paths
+ * and methods as one added before it is never picked.
+ */
+bool router_add(struct router *r, const char *pattern, uint64_t methods,
+        void *data)
+{
+    struct route_node *n = r->root;
+    struct route_end *e;
+    const char *p = pattern;
+
+    if (!n || !(e = calloc(1, sizeof(*e))))
+        return false;
+    e->methods = methods;
+    e->data = data;
+
+    while (*p) {
+        size_t len;
+
+        if (*p == ':') {
+            len = strcspn(++p, "/");
+            if (!len || e->nnames == ROUTER_MAX_PARAMS)
+                goto fail;
+            if (!n->param && !(n->param = node_new("", 0)))
+                goto fail;
+            if (!(e->names[e->nnames++] = strndup(p, len)))
+                goto fail;
+            n = n->param;
+        } else if (*p == '*') {
+            len = strlen(++p);
+            if (memchr(p, '/', len) || e->nnames == ROUTER_MAX_PARAMS)
+                goto fail;
+            if (!(e->names[e->nnames++] = strdup(len ? p : "*")))
+                goto fail;
+            ends_append(&n->rest, e);
+            return true;
+        } else {
+            len = strcspn(p, ":*");
+            if (!(n = node_insert(n, p, len)))
+                goto fail;
+        }
+        p += len;
+    }
+    ends_append(&n->ends, e);
+    return true;
+
+fail:
+    ends_free(e, NULL);
+    return false;
+}
+
+static void tree_count(const struct route_node *n, size_t *nodes, size_t *ends,
+        size_t *bytes)
+{
+    const struct route_end *e;
+    size_t i;
+
+    ++*nodes;
+    *bytes += n->len + (n->nkids > INDEX_KIDS ? 256 : n->nkids);
+    for (e = n->ends; e; e = e->next)
+        ++*ends;
+    for (e = n->rest; e; e = e->next)
+        ++*ends;
+    for (i = 0; i < n->nkids; i++)
+        tree_count(n->kids[i], nodes, ends, bytes);
+    if (n->param)
+        tree_count(n->param, nodes, ends, bytes);
+}
+
+/* move the ends of a list into a row of r->ends, returns how many. */
+static size_t flat_ends(struct router *r, struct route_end *e, uint32_t *first)
+{
+    size_t n = 0;
+
+    *first = (uint32_t)r->nends;
+    for (; e; e = e->next, n++) {
+        struct flat_end *f = &r->ends[r->nends++];
+        int i;
+
+        f->methods = e->methods;
+        f->data = e->data;
+        f->names = (uint32_t)r->nnames;
+        f->nnames = (uint32_t)e->nnames;
+        for (i = 0; i < e->nnames; i++)
+            r->names[r->nnames++] = e->names[i];
+        e->nnames = 0;
+        e->data = NULL;
+    }
+    return n;
+}
+
+/*
+ * lay out `n` in nodes[at], then what is below it: its kids take the
+ * next free slots in a row, its parameter the one after.
+ */
+static bool flat_node(struct router *r, const struct route_node *n, uint32_t at)
+{
+    struct flat_node *f = &r->nodes[at];
+    size_t i, nends, nrest;
+
+    if (n->len > UINT16_MAX)
+        return false;
+    f->label = (uint32_t)r->nbytes;
+    f->len = (uint16_t)n->len;
+    memcpy(r->bytes + r->nbytes, n->label, n->len);
+    r->nbytes += n->len;
+
+    f->nkids = (uint8_t)n->nkids;
+    f->first = (uint32_t)r->nbytes;
+    if (n->nkids > INDEX_KIDS) {
+        memset(r->bytes + r->nbytes, 0, 256);
+        for (i = 0; i < n->nkids; i++)
+            r->bytes[r->nbytes + (unsigned char)n->kids[i]->label[0]] = (unsigned char)(i + 1);
+        r->nbytes += 256;
+    } else {
+        for (i = 0; i < n->nkids; i++)
+            r->bytes[r->nbytes++] = (unsigned char)n->kids[i]->label[0];
+    }
+
+    nends = flat_ends(r, n->ends, &f->ends);
+    nrest = flat_ends(r, n->rest, &f->rest);
+    if (nends > UINT8_MAX || nrest > UINT8_MAX)
+        return false;
+    f->nends = (uint8_t)nends;
+    f->nrest = (uint8_t)nrest;
+
+    f->kids = (uint32_t)r->nnodes;
+    r->nnodes += n->nkids;
+    f->param = NO_NODE;
+    if (n->param)
+        f->param = (uint32_t)r->nnodes++;
+
+    for (i = 0; i < n->nkids; i++) {
+        if (!flat_node(r, n->kids[i], f->kids + (uint32_t)i))
+            return false;
+    }
+    return !n->param || flat_node(r, n->param, f->param);
+}
+
+/* done adding routes: lay them out for router_lookup(). */
+bool router_build(struct router *r)
+{
+    size_t nodes = 0, ends = 0, bytes = 0;
+
+    if (!r->root)
+        return false;
+    tree_count(r->root, &nodes, &ends, &bytes);
+    if (nodes > UINT32_MAX / 2 || bytes > UINT32_MAX / 2)
+        return false;
+
+    r->nodes = calloc(nodes, sizeof(*r->nodes));
+    r->ends = calloc(ends + 1, sizeof(*r->ends));
+    r->names = calloc(ends * ROUTER_MAX_PARAMS + 1, sizeof(*r->names));
+    r->bytes = malloc(bytes + 1);
+    if (!r->nodes || !r->ends || !r->names || !r->bytes)
+        return false;
+
+    r->nnodes = 1;
+    if (!flat_node(r, r->root, 0))
+        return false;
+    node_free(r->root, NULL);
+    r->root = NULL;
+    return true;
+}
+
+static inline const struct flat_end *ends_pick(const struct router *r,
+        uint32_t first, unsigned n, unsigned method)
+{
+    const struct flat_end *e = &r->ends[first], *last = e + n;
+
+    for (; e < last; e++) {
+        if (!e->methods || (method < 64 && (e->methods & ROUTE_METHOD(method))))
+            return e;
+    }
+    return NULL;
+}
+
+/* the kid whose label starts with `c`, or NULL. */
+static inline const struct flat_node *node_kid(const struct router *r,
+        const struct flat_node *n, unsigned char c)
+{
+    const unsigned char *first = r->bytes + n->first;
+    unsigned i;
+
+    if (n->nkids > INDEX_KIDS) {
+        i = first[c];
+        return i ? &r->nodes[n->kids + i - 1] : NULL;
+    }
+    for (i = 0; i < n->nkids; i++) {
+        if (first[i] == c)
+            return &r->nodes[n->kids + i];
+    }
+    return NULL;
+}
+
+/* the path starts with the label of `n`, its first byte already seen. */
+static inline bool label_match(const struct router *r,
+        const struct flat_node *n, const char *p)
+{
+    const unsigned char *label = r->bytes + n->label;
+    unsigned i;
+
+    /* labels hold no nul, a path ending early differs. */
+    for (i = 1; i < n->len; i++) {
+        if (label[i] != (unsigned char)p[i])
+            return false;
+    }
+    return true;
+}
+
+/*
+ * a node offering no parameter or wildcard has nothing to fall back on,
+ * its kid is walked into without recursing.
+ */
+static const struct flat_end *node_match(const struct router *r,
+        const struct flat_node *n, const char *p, unsigned method,
+        struct route_param *vals, int depth)
+{
+    const struct flat_end *e;
+
+    for (;;) {
+        if (!*p && (e = ends_pick(r, n->ends, n->nends, method)))
+            return e;
+
+        const struct flat_node *kid = *p ? node_kid(r, n, (unsigned char)*p) : NULL;
+        if (kid && label_match(r, kid, p)) {
+            if (n->param == NO_NODE && !n->nrest) {
+                n = kid;
+                p += kid->len;
+                continue;
+            }
+            if ((e = node_match(r, kid, p + kid->len, method, vals, depth)))
+                return e;
+        }
+        break;
+    }
+
+    if (n->param != NO_NODE && *p && *p != '/' && depth < ROUTER_MAX_PARAMS) {
+        const char *seg = strchrnul(p, '/');
+        vals[depth].value = p;
+        vals[depth].len = seg - p;
+        if ((e = node_match(r, &r->nodes[n->param], seg, method, vals, depth + 1)))
+            return e;
+    }
+
+    if (n->nrest && depth < ROUTER_MAX_PARAMS
+            && (e = ends_pick(r, n->rest, n->nrest, method))) {
+        vals[depth].value = p;
+        vals[depth].len = strlen(p);
+        return e;
+    }
+    return NULL;
+}
+
+/* the route for `path` and `method`, one of http_parser's HTTP_*. */
+bool router_lookup(const struct router *r, const char *path, unsigned method,
+        struct route_match *m)
+{
+    const struct flat_end *e;
+    uint32_t i;
+
+    if (!r->nnodes)
+        return false;
+    e = node_match(r, r->nodes, path, method, m->params, 0);
+    if (!e)
+        return false;
+    for (i = 0; i < e->nnames; i++)
+        m->params[i].name = r->names[e->names + i];
+    m->nparams = (int)e->nnames;
+    m->data = e->data;
+    return true;
+}
+
+const struct route_param *route_param(const struct route_match *m,
+        const char *name)
+{
+    int i;
+
+    for (i = 0; i < m->nparams; i++) {
+        if (!strcmp(m->params[i].name, name))
+            return &m->params[i];
+    }
+    return NULL;
+}
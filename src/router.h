@@ -0,0 +1,52 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * router - maps request paths to handlers through a radix tree.
+ *
+ * Routes are patterns of plain bytes, `:name` parameters that match one
+ * path segment, and an optional `*name` at the end that matches the rest
+ * of the path, empty included. "/blogs/:id" takes /blogs/12 with id "12",
+ * "/files/" then "*path" takes anything below /files/.
+ *
+ * Plain bytes win over a parameter, a parameter over a wildcard, trying
+ * the next when the more specific branch finds nothing. A route may be
+ * limited to some methods, a mask of ROUTE_METHOD(HTTP_*), 0 taking them
+ * all.
+ *
+ * Routes are all added first, then router_build() lays the tree out for
+ * lookups; it never changes after, so lookups need no lock. Parameters
+ * are slices of the path looked up, no copy is made.
+ */
+
+#define ROUTER_MAX_PARAMS 8
+#define ROUTE_METHOD(m) (UINT64_C(1) << (m))
+
+struct route_param {
+    const char *name;
+    const char *value;      /* into the path, not terminated */
+    size_t len;
+};
+
+struct route_match {
+    void *data;
+    struct route_param params[ROUTER_MAX_PARAMS];
+    int nparams;
+};
+
+struct router;
+
+struct router *router_new(void);
+void router_free(struct router *r, void (*free_data)(void *data));
+
+bool router_add(struct router *r, const char *pattern, uint64_t methods,
+        void *data);
+bool router_build(struct router *r);
+bool router_lookup(const struct router *r, const char *path, unsigned method,
+        struct route_match *m);
+
+const struct route_param *route_param(const struct route_match *m,
+        const char *name);
@@ -0,0 +1,914 @@
+#define _GNU_SOURCE
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include "hash.h"
+#include "search.h"
+
+/* the most a position, an id or a length takes as a varint. */
+#define VARINT_MAX 5
+
+struct skip {
+    uint32_t last;      /* the id before the block, 0 for the first */
+    uint32_t off;       /* of the block's first record */
+};
+
+struct term {
+    /* per document: the id delta, the length of its positions, and the
+     * positions, the first as is and the others as deltas. */
+    uint8_t *post;
+    size_t len;
+    struct skip *skips;
+    uint32_t nskips;
+    uint32_t ndocs;
+
+    /* changes not in the list yet, in the order they came: the id, the
+     * length of the positions and the positions; no positions to remove. */
+    uint8_t *pend;
+    size_t pend_len, pend_cap;
+    bool dirty;
+
+    char word[];
+};
+
+/* the terms of a document, to take it out of their lists. */
+struct doc {
+    struct term **terms;
+    uint32_t nterms;
+};
+
+struct occ {
+    struct term *t;
+    uint32_t pos;
+};
+
+struct op {
+    uint32_t id;
+    uint32_t seq;
+    const uint8_t *blob;
+    uint32_t len;
+};
+
+struct search_index {
+    struct hash *terms;     /* word -> struct term */
+    struct hash *docs;      /* id -> struct doc */
+    struct term **dirty;    /* terms with pending changes */
+    size_t ndirty, dirty_cap;
+
+    /* scratch, kept between calls. */
+    struct occ *occ;
+    size_t occ_cap;
+    struct op *ops;
+    size_t ops_cap;
+    uint32_t *pos;
+    size_t pos_cap;
+    uint64_t *bits;
+    size_t bits_cap;
+};
+
+static inline uint8_t *put_varint(uint8_t *p, uint32_t v)
+{
+    while (v >= 0x80) {
+        *p++ = (uint8_t)(v | 0x80);
+        v >>= 7;
+    }
+    *p++ = (uint8_t)v;
+    return p;
+}
+
+static inline const uint8_t *get_varint(const uint8_t *p, uint32_t *v)
+{
+    uint32_t x = *p++, shift = 7, b;
+
+    if (x < 0x80) {
+        *v = x;
+        return p;
+    }
+    x &= 0x7f;
+    do {
+        b = *p++;
+        x |= (b & 0x7f) << shift;
+        shift += 7;
+    } while (b >= 0x80);
+    *v = x;
+    return p;
+}
+
+/* room for `n` elements of `size` in `*buf`, growing it by half at least. */
+static bool reserve(void *buf, size_t *cap, size_t n, size_t size)
+{
+    void **p = buf;
+    void *nb;
+    size_t ncap;
+
+    if (n <= *cap)
+        return true;
+    ncap = *cap + *cap / 2;
+    if (ncap < n)
+        ncap = n;
+    if (ncap < 16)
+        ncap = 16;
+    if (!(nb = realloc(*p, ncap * size)))
+        return false;
+    *p = nb;
+    *cap = ncap;
+    return true;
+}
+
+static inline bool is_word_byte(unsigned char c)
+{
+    return (unsigned)((c | 0x20) - 'a') < 26 || (unsigned)(c - '0') < 10
+        || c >= 0x80;
+}
+
+/* the first `<tag` at or after `s`, case folded, or `end`. */
+static const char *find_tag(const char *s, const char *end, const char *tag,
+        size_t n)
+{
+    for (; (size_t)(end - s) >= n; s++) {
+        if (*s == '<' && !strncasecmp(s, tag, n))
+            return s;
+    }
+    return end;
+}
+
+/* past the markup at `s`, '<' or '&'; one byte on when it is not markup. */
+static const char *skip_markup(const char *s, const char *end)
+{
+    const char *p = s + 1;
+
+    if (*s == '&') {
+        if (p < end && *p == '#')
+            p++;
+        while (p < end && p - s < 12 && is_word_byte((unsigned char)*p))
+            p++;
+        return p < end && *p == ';' ? p + 1 : s + 1;
+    }
+
+    if (p == end || !((unsigned)((*p | 0x20) - 'a') < 26 || *p == '/'
+                || *p == '!' || *p == '?'))
+        return p;
+    if (end - p >= 3 && !memcmp(p, "!--", 3)) {
+        p = memmem(p + 3, (size_t)(end - p - 3), "-->", 3);
+        return p ? p + 3 : end;
+    }
+    if (end - p > 6 && !strncasecmp(p, "script", 6) && !is_word_byte(p[6]))
+        return find_tag(p, end, "</script", 8);
+    if (end - p > 5 && !strncasecmp(p, "style", 5) && !is_word_byte(p[5]))
+        return find_tag(p, end, "</style", 7);
+    p = memchr(p, '>', (size_t)(end - p));
+    return p ? p + 1 : end;
+}
+
+/*
+ * the word at `s`, folded into `word`, SEARCH_WORD_MAX bytes at most and
+ * cut where a character starts; returns where it ends.
+ */
+static const char *read_word(const char *s, const char *end, char *word,
+        size_t *len)
+{
+    size_t n = 0;
+    unsigned char c, cut = 0;
+
+    for (; s < end && is_word_byte(c = (unsigned char)*s); s++) {
+        if (n < SEARCH_WORD_MAX)
+            word[n++] = (char)((unsigned)(c - 'A') < 26 ? c | 0x20 : c);
+        else if (!cut)
+            cut = c;
+    }
+    if ((cut & 0xc0) == 0x80) {
+        while (n && ((unsigned char)word[n - 1] & 0xc0) == 0x80)
+            n--;
+        if (n && (unsigned char)word[n - 1] >= 0xc0)
+            n--;
+    }
+    word[n] = '\0';
+    *len = n;
+    return s;
+}
+
+/* the next word of the HTML at `s`, NULL if there is none. */
+static const char *next_word(const char *s, const char *end, char *word,
+        size_t *len)
+{
+    while (s < end && !is_word_byte((unsigned char)*s)) {
+        if (*s == '<' || *s == '&')
+            s = skip_markup(s, end);
+        else
+            s++;
+    }
+    return s < end ? read_word(s, end, word, len) : NULL;
+}
+
+static void free_term(void *data)
+{
+    struct term *t = data;
+    free(t->post);
+    free(t->skips);
+    free(t->pend);
+    free(t);
+}
+
+static void free_doc(void *data)
+{
+    struct doc *d = data;
+    free(d->terms);
+    free(d);
+}
+
+struct search_index *search_new(void)
+{
+    struct search_index *idx = calloc(1, sizeof(*idx));
+    if (!idx)
+        return NULL;
+    idx->terms = hash_str_new(NULL, free_term);
+    idx->docs = hash_int_new(NULL, free_doc);
+    if (!idx->terms || !idx->docs) {
+        search_free(idx);
+        return NULL;
+    }
+    return idx;
+}
+
+void search_free(struct search_index *idx)
+{
+    if (!idx)
+        return;
+    if (idx->terms)
+        hash_free(idx->terms);
+    if (idx->docs)
+        hash_free(idx->docs);
+    free(idx->dirty);
+    free(idx->occ);
+    free(idx->ops);
+    free(idx->pos);
+    free(idx->bits);
+    free(idx);
+}
+
+static struct term *term_get(struct search_index *idx, const char *word,
+        size_t len)
+{
+    struct term *t = hash_find(idx->terms, word);
+    if (t)
+        return t;
+
+    t = calloc(1, sizeof(*t) + len + 1);
+    if (!t)
+        return NULL;
+    memcpy(t->word, word, len + 1);
+    if (hash_add(idx->terms, t->word, t) < 0) {
+        free(t);
+        return NULL;
+    }
+    return t;
+}
+
+static int compare_occ(const void *a, const void *b)
+{
+    const struct occ *o1 = a, *o2 = b;
+    if (o1->t != o2->t)
+        return (uintptr_t)o1->t < (uintptr_t)o2->t ? -1 : 1;
+    return o1->pos < o2->pos ? -1 : o1->pos > o2->pos;
+}
+
+static inline size_t varint_len(uint32_t v)
+{
+    size_t n = 1;
+    for (; v >= 0x80; v >>= 7)
+        n++;
+    return n;
+}
+
+/*
+ * note `id` with the positions `occ[0..n)` of `t`, none to remove it;
+ * room for it is reserved.
+ */
+static void term_pend(struct search_index *idx, struct term *t, uint32_t id,
+        const struct occ *occ, size_t n)
+{
+    uint8_t *q = t->pend + t->pend_len;
+    uint32_t prev = 0;
+    size_t len = 0, i;
+
+    for (i = 0; i < n; prev = occ[i++].pos)
+        len += varint_len(occ[i].pos - prev);
+    q = put_varint(q, id);
+    q = put_varint(q, (uint32_t)len);
+    for (i = 0, prev = 0; i < n; prev = occ[i++].pos)
+        q = put_varint(q, occ[i].pos - prev);
+    t->pend_len = (size_t)(q - t->pend);
+
+    if (!t->dirty) {
+        t->dirty = true;
+        idx->dirty[idx->ndirty++] = t;
+    }
+}
+
+bool search_add(struct search_index *idx, uint32_t id,
+        const char *const texts[], size_t n)
+{
+    struct doc *d = hash_find(idx->docs, (void *)(uintptr_t)id);
+    struct term **terms = NULL;
+    bool fresh = !d;
+    char word[SEARCH_WORD_MAX + 1];
+    size_t nocc = 0, nterms = 0, i, j, len;
+    uint32_t pos = 0;
+
+    for (i = 0; i < n; i++) {
+        const char *s = texts[i], *end = s + strlen(s);
+        while ((s = next_word(s, end, word, &len))) {
+            struct term *t = term_get(idx, word, len);
+            if (!t || !reserve(&idx->occ, &idx->occ_cap, nocc + 1,
+                        sizeof(*idx->occ)))
+                return false;
+            idx->occ[nocc].t = t;
+            idx->occ[nocc++].pos = pos++;
+        }
+        pos++;  /* no phrase across texts */
+    }
+    qsort(idx->occ, nocc, sizeof(*idx->occ), compare_occ);
+    for (i = 0; i < nocc; i++)
+        nterms += !i || idx->occ[i].t != idx->occ[i - 1].t;
+
+    /* all the room needed first, a failure leaves the index as it was. */
+    if (nterms && !(terms = malloc(nterms * sizeof(*terms))))
+        return false;
+    if (!d && (!(d = calloc(1, sizeof(*d)))
+                || hash_add(idx->docs, (void *)(uintptr_t)id, d) < 0)) {
+        free(d);
+        free(terms);
+        return false;
+    }
+    if (!reserve(&idx->dirty, &idx->dirty_cap,
+                idx->ndirty + d->nterms + nterms, sizeof(*idx->dirty)))
+        goto fail;
+    for (i = 0; i < d->nterms; i++) {
+        struct term *t = d->terms[i];
+        if (!reserve(&t->pend, &t->pend_cap, t->pend_len + 2 * VARINT_MAX, 1))
+            goto fail;
+    }
+    for (i = 0; i < nocc; i = j) {
+        struct term *t = idx->occ[i].t;
+        for (j = i + 1; j < nocc && idx->occ[j].t == t; j++)
+            ;
+        if (!reserve(&t->pend, &t->pend_cap,
+                    t->pend_len + (j - i + 2) * VARINT_MAX, 1))
+            goto fail;
+    }
+
+    for (i = 0; i < d->nterms; i++)
+        term_pend(idx, d->terms[i], id, NULL, 0);
+    for (i = 0, nterms = 0; i < nocc; i = j) {
+        struct term *t = idx->occ[i].t;
+        for (j = i + 1; j < nocc && idx->occ[j].t == t; j++)
+            ;
+        term_pend(idx, t, id, &idx->occ[i], j - i);
+        terms[nterms++] = t;
+    }
+    free(d->terms);
+    d->terms = terms;
+    d->nterms = (uint32_t)nterms;
+    return true;
+
+fail:
+    free(terms);
+    if (fresh)
+        hash_del(idx->docs, (void *)(uintptr_t)id);
+    return false;
+}
+
+void search_remove(struct search_index *idx, uint32_t id)
+{
+    struct doc *d = hash_find(idx->docs, (void *)(uintptr_t)id);
+    uint32_t i;
+
+    if (!d)
+        return;
+    if (!reserve(&idx->dirty, &idx->dirty_cap, idx->ndirty + d->nterms,
+                sizeof(*idx->dirty)))
+        return;
+    for (i = 0; i < d->nterms; i++) {
+        struct term *t = d->terms[i];
+        if (!reserve(&t->pend, &t->pend_cap, t->pend_len + 2 * VARINT_MAX, 1))
+            return;
+    }
+    for (i = 0; i < d->nterms; i++)
+        term_pend(idx, d->terms[i], id, NULL, 0);
+    hash_del(idx->docs, (void *)(uintptr_t)id);
+}
+
+static int compare_op(const void *a, const void *b)
+{
+    const struct op *o1 = a, *o2 = b;
+    if (o1->id != o2->id)
+        return o1->id < o2->id ? -1 : 1;
+    return o1->seq < o2->seq ? -1 : o1->seq > o2->seq;
+}
+
+/* a posting list being written. */
+struct writer {
+    uint8_t *post;
+    size_t len, cap;
+    struct skip *skips;
+    size_t nskips, skips_cap;
+    uint32_t ndocs;
+    uint32_t last;
+};
+
+static bool writer_put(struct writer *w, uint32_t id, const uint8_t *blob,
+        uint32_t len)
+{
+    uint8_t *q;
+
+    if (w->ndocs % SEARCH_SKIP == 0) {
+        if (!reserve(&w->skips, &w->skips_cap, w->nskips + 1, sizeof(*w->skips)))
+            return false;
+        w->skips[w->nskips].last = w->last;
+        w->skips[w->nskips++].off = (uint32_t)w->len;
+    }
+    if (!reserve(&w->post, &w->cap, w->len + 2 * VARINT_MAX + len, 1))
+        return false;
+    q = put_varint(w->post + w->len, id - w->last);
+    q = put_varint(q, len);
+    memcpy(q, blob, len);
+    w->len = (size_t)(q + len - w->post);
+    w->last = id;
+    w->ndocs++;
+    return true;
+}
+
+/*
+ * fold the pending changes of `t` into its list, in one pass over both:
+ * of the changes to one document the last counts.
+ */
+static bool term_merge(struct search_index *idx, struct term *t)
+{
+    const uint8_t *p = t->pend, *end = t->pend + t->pend_len;
+    const uint8_t *q = t->post, *qend = t->post + t->len, *blob = NULL;
+    bool old = q < qend;
+    struct writer w;
+    size_t nops = 0, i = 0;
+    uint32_t id = 0, len = 0, delta;
+
+    while (p < end) {
+        if (!reserve(&idx->ops, &idx->ops_cap, nops + 1, sizeof(*idx->ops)))
+            return false;
+        p = get_varint(p, &idx->ops[nops].id);
+        p = get_varint(p, &idx->ops[nops].len);
+        idx->ops[nops].blob = p;
+        idx->ops[nops].seq = (uint32_t)nops;
+        p += idx->ops[nops++].len;
+    }
+    qsort(idx->ops, nops, sizeof(*idx->ops), compare_op);
+
+    memset(&w, 0, sizeof(w));
+    if (old && nops) {
+        /* the blocks before the first change are copied as they are. */
+        uint32_t lo = 0, hi = t->nskips;
+        while (hi - lo > 1) {
+            uint32_t mid = lo + (hi - lo) / 2;
+            if (t->skips[mid].last < idx->ops[0].id)
+                lo = mid;
+            else
+                hi = mid;
+        }
+        if (lo) {
+            if (!reserve(&w.post, &w.cap, t->len + t->pend_len, 1)
+                    || !reserve(&w.skips, &w.skips_cap, t->nskips,
+                        sizeof(*w.skips))) {
+                free(w.post);
+                return false;
+            }
+            w.len = t->skips[lo].off;
+            w.nskips = lo;
+            w.ndocs = lo * SEARCH_SKIP;
+            w.last = id = t->skips[lo].last;
+            memcpy(w.post, t->post, w.len);
+            memcpy(w.skips, t->skips, lo * sizeof(*w.skips));
+            q += w.len;
+        }
+    }
+    if (old) {
+        q = get_varint(q, &delta);
+        q = get_varint(q, &len);
+        id += delta;
+        blob = q;
+        q += len;
+    }
+    while (old || i < nops) {
+        const struct op *o = NULL;
+        bool ok = true;
+
+        if (i < nops) {
+            while (i + 1 < nops && idx->ops[i + 1].id == idx->ops[i].id)
+                i++;
+            o = &idx->ops[i];
+        }
+        if (old && (!o || id <= o->id)) {
+            if (o && id == o->id) {
+                if (o->len)
+                    ok = writer_put(&w, id, o->blob, o->len);
+                i++;
+            } else {
+                ok = writer_put(&w, id, blob, len);
+            }
+            if ((old = q < qend)) {
+                q = get_varint(q, &delta);
+                q = get_varint(q, &len);
+                id += delta;
+                blob = q;
+                q += len;
+            }
+        } else {
+            if (o->len)
+                ok = writer_put(&w, o->id, o->blob, o->len);
+            i++;
+        }
+        if (!ok) {
+            free(w.post);
+            free(w.skips);
+            return false;
+        }
+    }
+
+    free(t->post);
+    free(t->skips);
+    free(t->pend);
+    t->post = w.post;
+    t->len = w.len;
+    t->skips = w.skips;
+    t->nskips = (uint32_t)w.nskips;
+    t->ndocs = w.ndocs;
+    t->pend = NULL;
+    t->pend_len = t->pend_cap = 0;
+    return true;
+}
+
+bool search_commit(struct search_index *idx)
+{
+    size_t i, kept = 0;
+
+    if (!idx->ndirty)
+        return false;
+    for (i = 0; i < idx->ndirty; i++) {
+        struct term *t = idx->dirty[i];
+        if (!term_merge(idx, t)) {
+            /* out of memory, tried again on the next commit. */
+            idx->dirty[kept++] = t;
+            continue;
+        }
+        t->dirty = false;
+        if (!t->ndocs)
+            hash_del(idx->terms, t->word);
+    }
+    idx->ndirty = kept;
+    return true;
+}
+
+/* a query's walk over the posting list of one of its terms. */
+struct cursor {
+    const struct term *t;
+    const uint8_t *p, *end;
+    uint32_t n;         /* records read */
+    uint32_t id;        /* of the last one */
+    const uint8_t *pos; /* its positions */
+    uint32_t pos_len;
+};
+
+static void cursor_init(struct cursor *c, const struct term *t)
+{
+    c->t = t;
+    c->p = t->post;
+    c->end = t->post + t->len;
+    c->n = 0;
+    c->id = 0;
+}
+
+static inline bool cursor_next(struct cursor *c)
+{
+    uint32_t delta;
+
+    if (c->p == c->end)
+        return false;
+    c->p = get_varint(c->p, &delta);
+    c->p = get_varint(c->p, &c->pos_len);
+    c->pos = c->p;
+    c->p += c->pos_len;
+    c->id += delta;
+    c->n++;
+    return true;
+}
+
+/*
+ * on to the first id at or after `target`: galloping over the skip
+ * entries from the cursor's block to the last block that starts before
+ * it, then record by record.
+ */
+static bool cursor_seek(struct cursor *c, uint32_t target)
+{
+    const struct skip *skips = c->t->skips;
+    uint32_t nskips = c->t->nskips;
+    uint32_t b = c->n ? (c->n - 1) / SEARCH_SKIP : 0, lo = b, hi, step;
+
+    if (c->n && c->id >= target)
+        return true;
+
+    /* the last block with skips[].last < target is in [lo, hi). */
+    for (step = 1; lo + step < nskips && skips[lo + step].last < target;
+            step <<= 1)
+        lo += step;
+    hi = lo + step < nskips ? lo + step : nskips;
+    while (hi - lo > 1) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        if (skips[mid].last < target)
+            lo = mid;
+        else
+            hi = mid;
+    }
+    if (lo > b || !c->n) {
+        c->p = c->t->post + skips[lo].off;
+        c->id = skips[lo].last;
+        c->n = lo * SEARCH_SKIP;
+    }
+
+    while (cursor_next(c)) {
+        if (c->id >= target)
+            return true;
+    }
+    return false;
+}
+
+/* the positions of the cursor's document, ascending; returns how many. */
+static size_t cursor_positions(const struct cursor *c, uint32_t *out)
+{
+    const uint8_t *p = c->pos, *end = c->pos + c->pos_len;
+    uint32_t v = 0, d;
+    size_t n = 0;
+
+    while (p < end) {
+        p = get_varint(p, &d);
+        out[n++] = v += d;
+    }
+    return n;
+}
+
+/* a bit for each of `pos[0..n)` in idx->bits, which is all clear between uses. */
+static void bits_flip(struct search_index *idx, const uint32_t *pos, size_t n)
+{
+    size_t i;
+    for (i = 0; i < n; i++)
+        idx->bits[pos[i] / 64] ^= UINT64_C(1) << (pos[i] % 64);
+}
+
+/*
+ * whether the words `words[0..n)` of a phrase, cursors all on one
+ * document, follow each other in it. the places the phrase could start,
+ * from the word it has the fewest of, go in a bitmap; each other word k
+ * keeps those it is found k after. the last one only has to be found
+ * once.
+ */
+static bool phrase_matches(struct search_index *idx, const struct cursor *cur,
+        const int *words, int n)
+{
+    uint32_t *a, *b, *tmp, v, d;
+    size_t need = 0, na, m, i, left = (size_t)n - 1;
+    bool found = false;
+    int k, r = 0;
+
+    /* a position takes a byte at least. */
+    for (k = 0; k < n; k++) {
+        if (cur[words[k]].pos_len > need)
+            need = cur[words[k]].pos_len;
+        if (cur[words[k]].pos_len < cur[words[r]].pos_len)
+            r = k;
+    }
+    if (!reserve(&idx->pos, &idx->pos_cap, 2 * need, sizeof(*idx->pos)))
+        return false;
+    a = idx->pos;
+    b = idx->pos + need;
+
+    na = cursor_positions(&cur[words[r]], a);
+    for (i = 0, m = 0; i < na; i++) {
+        if (a[i] >= (uint32_t)r)
+            a[m++] = a[i] - (uint32_t)r;
+    }
+    if (!(na = m))
+        return false;
+    if (a[na - 1] / 64 >= idx->bits_cap) {
+        size_t cap = idx->bits_cap;
+        if (!reserve(&idx->bits, &idx->bits_cap, a[na - 1] / 64 + 1,
+                    sizeof(*idx->bits)))
+            return false;
+        memset(idx->bits + cap, 0, (idx->bits_cap - cap) * sizeof(*idx->bits));
+    }
+    bits_flip(idx, a, na);
+
+    for (k = 0; k < n && !found; k++) {
+        const struct cursor *c = &cur[words[k]];
+        const uint8_t *p = c->pos, *end = c->pos + c->pos_len;
+
+        if (k == r)
+            continue;
+        for (v = 0, m = 0; p < end; ) {
+            p = get_varint(p, &d);
+            v += d;
+            if (v < (uint32_t)k)
+                continue;
+            if (v - (uint32_t)k > a[na - 1])
+                break;
+            if (idx->bits[(v - k) / 64] & UINT64_C(1) << ((v - k) % 64)) {
+                if (left == 1) {
+                    found = true;
+                    break;
+                }
+                b[m++] = v - (uint32_t)k;
+            }
+        }
+        if (found)
+            break;
+        bits_flip(idx, a, na);
+        if (!(na = m))
+            return false;
+        bits_flip(idx, b, m);
+        tmp = a;
+        a = b;
+        b = tmp;
+        left--;
+    }
+    bits_flip(idx, a, na);
+    return found;
+}
+
+/*
+ * the clauses of a query: words, and phrases of them in quotes. the
+ * words go to `out`, each terminated; returns how many, -1 when there
+ * are more than SEARCH_MAX_WORDS. `phrase[i]` is the number of words of
+ * the phrase starting at word i, 0 inside one, 1 for a plain word.
+ */
+static int parse_query(const char *q, size_t len,
+        char out[SEARCH_MAX_WORDS][SEARCH_WORD_MAX + 1], int phrase[])
+{
+    const char *end = q + len;
+    int n = 0, start = -1;
+    size_t wlen;
+
+    while (q < end) {
+        if (*q == '"') {
+            if (start >= 0) {
+                if (n > start)
+                    phrase[start] = n - start;
+                start = -1;
+            } else {
+                start = n;
+            }
+            q++;
+        } else if (is_word_byte((unsigned char)*q)) {
+            if (n == SEARCH_MAX_WORDS)
+                return -1;
+            q = read_word(q, end, out[n], &wlen);
+            phrase[n] = start < 0 || start == n;
+            n++;
+        } else {
+            q++;
+        }
+    }
+    if (start >= 0 && start < n)
+        phrase[start] = n - start;
+    return n;
+}
+
+static int compare_clause(const void *a, const void *b)
+{
+    return strcmp(*(const char *const *)a, *(const char *const *)b);
+}
+
+size_t search_normalize(const char *q, size_t len, char *out, size_t sz)
+{
+    char words[SEARCH_MAX_WORDS][SEARCH_WORD_MAX + 1];
+    char buf[SEARCH_MAX_WORDS * (SEARCH_WORD_MAX + 4)];
+    const char *clauses[SEARCH_MAX_WORDS];
+    int phrase[SEARCH_MAX_WORDS];
+    int n = parse_query(q, len, words, phrase), nclauses = 0, i, j;
+    size_t at = 0, olen = 0;
+
+    if (n <= 0)
+        return 0;
+
+    for (i = 0; i < n; i += phrase[i]) {
+        clauses[nclauses++] = buf + at;
+        if (phrase[i] > 1)
+            buf[at++] = '"';
+        for (j = i; j < i + phrase[i]; j++) {
+            size_t wlen = strlen(words[j]);
+            if (j > i)
+                buf[at++] = ' ';
+            memcpy(buf + at, words[j], wlen);
+            at += wlen;
+        }
+        if (phrase[i] > 1)
+            buf[at++] = '"';
+        buf[at++] = '\0';
+    }
+    qsort(clauses, (size_t)nclauses, sizeof(*clauses), compare_clause);
+
+    for (i = 0; i < nclauses; i++) {
+        size_t clen = strlen(clauses[i]);
+        if (i && !strcmp(clauses[i], clauses[i - 1]))
+            continue;
+        if (olen + !!olen + clen >= sz)
+            return 0;
+        if (olen)
+            out[olen++] = ' ';
+        memcpy(out + olen, clauses[i], clen);
+        olen += clen;
+    }
+    out[olen] = '\0';
+    return olen;
+}
+
+static void reverse_ids(uint32_t *ids, size_t n)
+{
+    size_t i;
+    for (i = 0; i < n / 2; i++) {
+        uint32_t tmp = ids[i];
+        ids[i] = ids[n - 1 - i];
+        ids[n - 1 - i] = tmp;
+    }
+}
+
+size_t search_run(struct search_index *idx, const char *nq, uint32_t *ids,
+        size_t max)
+{
+    char words[SEARCH_MAX_WORDS][SEARCH_WORD_MAX + 1];
+    struct cursor cur[SEARCH_MAX_WORDS];
+    int phrase[SEARCH_MAX_WORDS], of[SEARCH_MAX_WORDS];
+    int order[SEARCH_MAX_WORDS];
+    int n = parse_query(nq, strlen(nq), words, phrase), ncur = 0, i, j;
+    size_t total = 0, s;
+    uint32_t target;
+
+    if (n <= 0)
+        return 0;
+
+    /* a cursor for each term, whatever number of times it is asked. */
+    for (i = 0; i < n; i++) {
+        const struct term *t = hash_find(idx->terms, words[i]);
+        if (!t || !t->ndocs)
+            return 0;
+        for (j = 0; j < ncur && cur[j].t != t; j++)
+            ;
+        if (j == ncur)
+            cursor_init(&cur[ncur++], t);
+        of[i] = j;
+    }
+
+    /* the rarest first, it leads. */
+    for (i = 0; i < ncur; i++) {
+        for (j = i; j > 0 && cur[order[j - 1]].t->ndocs > cur[i].t->ndocs; j--)
+            order[j] = order[j - 1];
+        order[j] = i;
+    }
+
+    if (!cursor_next(&cur[order[0]]))
+        return 0;
+    target = cur[order[0]].id;
+    for (;;) {
+        for (i = 1; i < ncur; i++) {
+            if (!cursor_seek(&cur[order[i]], target))
+                goto done;
+            if (cur[order[i]].id != target)
+                break;
+        }
+        if (i < ncur) {
+            if (!cursor_seek(&cur[order[0]], cur[order[i]].id))
+                break;
+            target = cur[order[0]].id;
+            continue;
+        }
+
+        for (i = 0; i < n; i += phrase[i]) {
+            if (phrase[i] > 1 && !phrase_matches(idx, cur, &of[i], phrase[i]))
+                break;
+        }
+        if (i >= n) {
+            if (max)
+                ids[total % max] = target;
+            total++;
+        }
+        if (!cursor_next(&cur[order[0]]))
+            break;
+        target = cur[order[0]].id;
+    }
+
+done:
+    /* ids is a ring of the last max found, ascending from total % max. */
+    if (!max)
+        return total;
+    s = total < max ? 0 : total % max;
+    reverse_ids(ids, s);
+    reverse_ids(ids + s, (total < max ? total : max) - s);
+    return total;
+}
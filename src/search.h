@@ -0,0 +1,62 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * search - an inverted index over the words of a set of documents.
+ *
+ * Each word, its term, has a posting list: the ids of the documents that
+ * have it, ascending, each with the positions of the word in it. Lists
+ * are varint coded, the ids as deltas, with a skip entry every
+ * SEARCH_SKIP documents; a query walks its lists together, galloping
+ * over the skip entries of the longer ones to the next id the rarest
+ * list has.
+ *
+ * Words are runs of letters and digits, ASCII folded to lower case, and
+ * of any bytes above 0x7f, kept as they are. Texts are taken as HTML:
+ * tags, the contents of <script> and <style>, and entities only separate
+ * words. A word longer than SEARCH_WORD_MAX is cut, in index and query
+ * alike.
+ *
+ * search_add() and search_remove() only note the change; it reaches the
+ * posting lists with search_commit(), so a rebuild of many documents
+ * rewrites each list once; until then queries see the index as it was.
+ * Nothing is locked, the index belongs to one thread.
+ */
+
+#define SEARCH_WORD_MAX 32
+#define SEARCH_MAX_WORDS 16     /* in a query, phrases included */
+#define SEARCH_SKIP 32
+
+/* room for any normalized query, terminated. */
+#define SEARCH_QUERY_MAX (SEARCH_MAX_WORDS * (SEARCH_WORD_MAX + 3) + 1)
+
+struct search_index;
+
+struct search_index *search_new(void);
+void search_free(struct search_index *idx);
+
+/* index the `n` texts of document `id`, in place of what it had. */
+bool search_add(struct search_index *idx, uint32_t id,
+        const char *const texts[], size_t n);
+void search_remove(struct search_index *idx, uint32_t id);
+
+/* apply the pending changes; true if there were any. */
+bool search_commit(struct search_index *idx);
+
+/*
+ * the query `q` in a canonical form, as the cache key of its results:
+ * its words, and its "quoted phrases", sorted, once each. 0 when there
+ * is no word in it, or too many, or it does not fit `sz` bytes.
+ */
+size_t search_normalize(const char *q, size_t len, char *out, size_t sz);
+
+/*
+ * the documents that have all the words and phrases of the normalized
+ * query `nq`. the `max` highest ids go to `ids`, highest first; returns
+ * how many there are in all.
+ */
+size_t search_run(struct search_index *idx, const char *nq, uint32_t *ids,
+        size_t max);
@@ -14,78 +14,44 @@
 #include <sys/uio.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
 #include <dirent.h>
+#include <limits.h>
+#include <fcntl.h>
 
 
+#include "config.h"
 #include "server.h"
 #include "anet.h"
 #include "strext.h"
 #include "mime-types.h"
 #include "json.h"
+#include "jsonw.h"
 #include "hash.h"
 #include "tmpl.h"
-
-#define INT2STR_BUF_SZ (3 * sizeof(size_t) + 1)
+#include "reallocarray.h"
+#include "phf.h"
+#include "chash.h"
+#include "reqparse.h"
+#ifdef HAVE_BUNDLE
+#include "bundle.h"
+#endif
+
+#ifdef HAVE_SENDFILE
+#include <sys/sendfile.h>
+#endif
 
 extern struct server g_svr;
 
-char *uint_to_string(size_t value, char dst[INT2STR_BUF_SZ], size_t *len_out)
-{
-    /*
-     * Based on routine by A. Alexandrescu, licensed under CC0
-     * https://creativecommons.org/publicdomain/zero/1.0/legalcode
-     */
-    static const size_t length = INT2STR_BUF_SZ;
-    size_t next = length - 1;
-    static const char digits[201] =
-            "0001020304050607080910111213141516171819"
-            "2021222324252627282930313233343536373839"
-            "4041424344454647484950515253545556575859"
-            "6061626364656667686970717273747576777879"
-            "8081828384858687888990919293949596979899";
-    dst[next--] = '\0';
-    while (value >= 100) {
-        const uint32_t i = (uint32_t) ((value % 100) * 2);
-        value /= 100;
-        dst[next] = digits[i + 1];
-        dst[next - 1] = digits[i];
-        next -= 2;
-    }
-    // Handle last 1-2 digits
-    if (value < 10) {
-        dst[next] = (char) ('0' + (uint32_t) value);
-        *len_out = length - next - 1;
-        return dst + next;
-    }
-    uint32_t i = (uint32_t) value * 2;
-    dst[next] = digits[i + 1];
-    dst[next - 1] = digits[i];
-    *len_out = length - next;
-    return dst + next - 1;
-}
-
-char *int_to_string(ssize_t value, char dst[INT2STR_BUF_SZ], size_t *len_out)
-{
-    if (value < 0) {
-        char *p = uint_to_string((size_t) - value, dst, len_out);
-        *--p = '-';
-        ++*len_out;
-
-        return p;
-    }
-
-    return uint_to_string((size_t)value, dst, len_out);
-}
-
 static void destroy_urlmap(void *data)
 {
     struct url_map *urlmap = data;
-    free((char *)urlmap->prefix);
+    free((char *)urlmap->route);
     free(urlmap);
 }
 
 static struct url_map *
-add_url_map(struct trie *t, const char *prefix, const struct url_map *map)
+add_url_map(struct router *r, const char *route, const struct url_map *map)
 {
     struct url_map *um = malloc(sizeof(*um));
     if (!um)
@@ -93,27 +59,46 @@ add_url_map(struct trie *t, const char *prefix, const struct url_map *map)
     
     memcpy(um, map, sizeof(*um));
     
-    um->prefix = strdup(prefix ? prefix : um->prefix);
-    um->prefix_len = strlen(um->prefix);
-    trie_add(t, um->prefix, um);
+    um->route = strdup(route ? route : um->route);
+    if (!um->route || !router_add(r, um->route, um->methods, um))
+        DIE("could not add route %s\n", route ? route : map->route);
     
     return um;
 }
 
 void http_set_url_map(struct server *svr, const struct url_map *map)
 {
-    trie_destroy(&svr->url_map);
-    if (!trie_init(&svr->url_map, destroy_urlmap)) {
-        DIE("could not init trie url map\n");
+    router_free(svr->router, destroy_urlmap);
+    svr->router = router_new();
+    if (!svr->router) {
+        DIE("could not init url map router\n");
     }
     
-    for (; map->prefix; map++) {
-        struct url_map *um = add_url_map(&svr->url_map, NULL, map);
-        if (!um)
-            continue;
-        
-        um->flags = HANDLER_PARSE_MASK;
+    for (; map->route; map++)
+        add_url_map(svr->router, NULL, map);
+    if (!router_build(svr->router))
+        DIE("could not build url map router\n");
+}
+
+void http_free_url_map(struct server *svr)
+{
+    router_free(svr->router, destroy_urlmap);
+    svr->router = NULL;
+}
+
+/* drop the body, with the references and files it holds. */
+static void resp_release_segs(struct http_response *resp)
+{
+    int i;
+    for (i = 0; i < resp->segs_sz; i++) {
+        struct resp_seg *seg = &resp->segs[i];
+        if (seg->fd >= 0)
+            close(seg->fd);
+        if (seg->owner)
+            content_free(seg->owner);
     }
+    resp->segs_sz = 0;
+    resp->content_length = 0;
 }
 
 #define FREE(ptr_) do {if (ptr_) {free(ptr_);ptr_=NULL;}} while(0)
@@ -129,17 +114,9 @@ void free_client(struct client *c) {
 
     FREE(c->req.parser);
     FREE(c->req.path);
-    FREE(c->req.query);
     int i;
-    for (i = 0; i < c->req.headers_sz; i++) {
-        if (c->req.headers[i].key) 
-            free(c->req.headers[i].key);
-        if (c->req.headers[i].value)
-            free(c->req.headers[i].value);
-    }
 
     FREE(c->resp.header);
-    FREE(c->resp.iovec_buf);
     for (i = 0; i < c->resp.headers_sz; i++) {
         if (c->resp.headers[i].key) 
             free(c->resp.headers[i].key);
@@ -147,9 +124,8 @@ void free_client(struct client *c) {
             free(c->resp.headers[i].value);
     }
 
-    strbuf_free(c->resp.sbuf);
-    strbuf_free(c->resp.head_sbuf);
-    strbuf_free(c->resp.foot_sbuf);
+    resp_release_segs(&c->resp);
+    FREE(c->resp.segs);
 
     FREE(c->req.buf.value);
     
@@ -172,7 +148,8 @@ struct client *create_client(int fd) {
     anetEnableTcpNoDelay(NULL, fd);
 
     int i = fd % g_svr.cfg.thrd_nr;
-    c->loop = g_svr.threads[i].loop;
+    c->thrd = &g_svr.threads[i];
+    c->loop = c->thrd->loop;
 
     c->req.buf.len = 0;
     c->req.buf.sz = 8192; // 8KB limit for method other than POST.
@@ -397,15 +374,7 @@ size_t prepare_resp_header(struct client *c, char *headers, size_t buf_size)
     }
 
     APPEND_CONSTANT("\r\nContent-Length: ");
-    
-    size_t buf_len = 0;
-    if (resp->head_sbuf)
-        buf_len = resp->head_sbuf->len.buffer;
-    if  (resp->foot_sbuf)
-        buf_len += resp->foot_sbuf->len.buffer; 
-    buf_len += resp->sbuf->len.buffer;
-
-    APPEND_UINT(buf_len);
+    APPEND_UINT(resp->content_length);
     APPEND_CONSTANT("\r\nContent-Type: ");
     APPEND_STRING(resp->mime_type);
 
@@ -417,11 +386,9 @@ size_t prepare_resp_header(struct client *c, char *headers, size_t buf_size)
 }
 
 void free_blog_buf(struct blog *b) {
-    if (b->info.heading) free(b->info.heading);
-    if (b->info.sub_heading) free(b->info.sub_heading);
-    if (b->info.author) free(b->info.author);
-    if (b->info.author_link) free(b->info.author_link);
-    if (b->content) free(b->content);
+    if (b->src) free(b->src);
+    if (b->summary) content_free(b->summary);
+    if (b->json) content_free(b->json);
 }
 
 void free_blogs_list(struct list_head *head)
@@ -435,17 +402,145 @@ void free_blogs_list(struct list_head *head)
     free(head);
 }
 
+static struct resp_seg *resp_add_seg(struct http_response *resp)
+{
+    if (resp->segs_sz == resp->segs_alloc) {
+        int n = resp->segs_alloc ? resp->segs_alloc * 2 : 4;
+        struct resp_seg *segs = reallocarray(resp->segs, n, sizeof(*segs));
+        if (!segs)
+            return NULL;
+        resp->segs = segs;
+        resp->segs_alloc = n;
+    }
+
+    struct resp_seg *seg = &resp->segs[resp->segs_sz++];
+    memset(seg, 0, sizeof(*seg));
+    seg->fd = -1;
+    return seg;
+}
+
+/*
+ * append `len` bytes at `buf` to the body, without copying. `owner`, when
+ * given, is the content `buf` belongs to; it is kept until the response
+ * is done.
+ */
+bool resp_add_buf(struct http_response *resp, const char *buf, size_t len,
+        content_t *owner)
+{
+    struct resp_seg *seg = resp_add_seg(resp);
+    if (!seg)
+        return false;
+
+    seg->type = SEG_BUF;
+    seg->buf = buf;
+    seg->len = len;
+    seg->owner = owner ? content_ref(owner) : NULL;
+    resp->content_length += len;
+    return true;
+}
+
+/* append `len` bytes of `fd` from `off`, the response owns `fd` after. */
+bool resp_add_file(struct http_response *resp, int fd, off_t off, size_t len)
+{
+    struct resp_seg *seg = resp_add_seg(resp);
+    if (!seg)
+        return false;
+
+    seg->type = SEG_FILE;
+    seg->fd = fd;
+    seg->off = off;
+    seg->len = len;
+    resp->content_length += len;
+    return true;
+}
+
+/* append cached content, one segment per part of a composite. */
+bool resp_add_content(struct http_response *resp, content_t *cont)
+{
+    if (!cont->parts)
+        return resp_add_buf(resp, cont->value, cont->len, cont);
+
+    size_t i;
+    for (i = 0; i < cont->nparts; i++) {
+        content_t *part = cont->parts[i];
+        if (!resp_add_buf(resp, part->value, part->len, part))
+            return false;
+    }
+    return true;
+}
+
+static inline size_t resp_seg_len(const struct http_response *resp, int i)
+{
+    return i < 0 ? resp->header_len : resp->segs[i].len;
+}
+
+/* move the write position `n` bytes on, past empty segments too. */
+static void resp_advance(struct http_response *resp, size_t n)
+{
+    resp->total_written += (ssize_t)n;
+    while (resp->curr_seg < resp->segs_sz) {
+        size_t left = resp_seg_len(resp, resp->curr_seg) - resp->seg_off;
+        if (n < left) {
+            resp->seg_off += n;
+            return;
+        }
+        n -= left;
+        resp->curr_seg++;
+        resp->seg_off = 0;
+    }
+}
+
+static ssize_t write_file_seg(int fd, const struct resp_seg *seg, size_t done)
+{
+    off_t off = seg->off + (off_t)done;
+    size_t len = seg->len - done;
+#ifdef HAVE_SENDFILE
+    return sendfile(fd, seg->fd, &off, len);
+#else
+    char buf[16384];
+    ssize_t n = pread(seg->fd, buf, len < sizeof(buf) ? len : sizeof(buf), off);
+    if (n <= 0)
+        return n < 0 ? -1 : 0;
+    return write(fd, buf, (size_t)n);
+#endif
+}
+
+/*
+ * the header and the buffers up to the next file segment go out with one
+ * writev, at most IOV_MAX of them; a file segment with sendfile.
+ */
 void write_loop(aeEventLoop *loop, int fd, void *data, int mask) {
     if (!loop || !data)
         return;
 
     struct client *c = data;
-    struct http_request *req = &c->req;
     struct http_response *resp = &c->resp;   
+    struct iovec iov[IOV_MAX];
 
     for (;;) {
-        ssize_t nwrite = writev(fd, resp->iovec_buf + resp->curr_iov, 
-                resp->iovec_sz - resp->curr_iov);
+        ssize_t nwrite;
+
+        resp_advance(resp, 0);
+        if (resp->curr_seg == resp->segs_sz)
+            break;
+
+        if (resp->curr_seg >= 0 && resp->segs[resp->curr_seg].type == SEG_FILE) {
+            nwrite = write_file_seg(fd, &resp->segs[resp->curr_seg], resp->seg_off);
+        } else {
+            int i, cnt = 0;
+            size_t skip = resp->seg_off;
+            for (i = resp->curr_seg; i < resp->segs_sz && cnt < IOV_MAX; i++) {
+                if (i >= 0 && resp->segs[i].type == SEG_FILE)
+                    break;
+                const char *base = i < 0 ? resp->header : resp->segs[i].buf;
+                iov[cnt].iov_base = (char *)base + skip;
+                iov[cnt].iov_len = resp_seg_len(resp, i) - skip;
+                skip = 0;
+                cnt++;
+            }
+            nwrite = writev(fd, iov, cnt);
+        }
+
         if (nwrite < 0) {
             switch (errno) {
                 case EAGAIN:
@@ -460,18 +555,7 @@ void write_loop(aeEventLoop *loop, int fd, void *data, int mask) {
             goto out;
         }
 
-        while (resp->curr_iov < resp->iovec_sz && 
-                nwrite >= (ssize_t)resp->iovec_buf[resp->curr_iov].iov_len) {
-            nwrite -= (ssize_t)resp->iovec_buf[resp->curr_iov].iov_len;
-            resp->curr_iov++;
-        }
-
-        if (resp->curr_iov == resp->iovec_sz)
-            break;
-
-        resp->iovec_buf[resp->curr_iov].iov_base = 
-                (char *)resp->iovec_buf[resp->curr_iov].iov_base + nwrite;
-        resp->iovec_buf[resp->curr_iov].iov_len -= (size_t)nwrite;
+        resp_advance(resp, (size_t)nwrite);
     }
 
 out:    
@@ -485,56 +569,30 @@ void write_proc(aeEventLoop *loop, int fd, void *data, int mask) {
         return;
 
     struct client *c = data;
-    struct http_request *req = &c->req;
     struct http_response *resp = &c->resp;
 
     resp->header = malloc(512); 
-
-    
-    size_t header_len = prepare_resp_header(c, resp->header, 512);
-    if (!header_len) {
-        page_500(fd);
-        goto out;
-    }
-    resp->iovec_sz = 1 + (resp->sbuf != 0) + (resp->head_sbuf != 0) + (resp->head_sbuf != 0);
-    resp->iovec_buf = calloc(resp->iovec_sz, sizeof(struct iovec));
-    if (!resp->iovec_buf) {
+    if (!resp->header) {
         page_500(fd);
         goto out;
     }
-    resp->curr_iov = 0;
-    resp->total_written = 0;
-    int i = 0;
-    resp->iovec_buf[i].iov_base = resp->header;
-    resp->iovec_buf[i].iov_len = header_len;
-    i++;
-    
-    if (resp->status != HTTP_OK) {
-        write_loop(loop, fd, data, mask);
-        return;
-    }
 
-    if (!resp->mime_type) {
+    /* only a 200 has a body. */
+    if (resp->status != HTTP_OK)
+        resp_release_segs(resp);
+    else if (!resp->mime_type) {
         page_404(fd);
         goto out;
     }
 
-
-    if (resp->head_sbuf) {
-        resp->iovec_buf[i].iov_base = strbuf_get_buffer(resp->head_sbuf);
-        resp->iovec_buf[i].iov_len = strbuf_get_length(resp->head_sbuf);
-        i++;
-    } 
-    if (resp->sbuf) {
-        resp->iovec_buf[i].iov_base = strbuf_get_buffer(resp->sbuf);
-        resp->iovec_buf[i].iov_len = strbuf_get_length(resp->sbuf);
-        i++;
+    resp->header_len = prepare_resp_header(c, resp->header, 512);
+    if (!resp->header_len) {
+        page_500(fd);
+        goto out;
     }
-    if (resp->foot_sbuf) {
-        resp->iovec_buf[i].iov_base = strbuf_get_buffer(resp->foot_sbuf);
-        resp->iovec_buf[i].iov_len = strbuf_get_length(resp->foot_sbuf);
-        i++;
-    } 
+    resp->curr_seg = -1;
+    resp->seg_off = 0;
+    resp->total_written = 0;
 
     write_loop(loop, fd, data, mask);
     return;
@@ -542,99 +600,401 @@ out:
     free_client(c);
 }
 
+/*
+ * the route is known as soon as the path is: its flags decide what of
+ * the rest of the request is kept.
+ */
+static void req_set_url(struct client *c, const char *path, size_t path_len,
+        const char *query, size_t query_len)
+{
+    c->req.path = strndup(path, path_len);
+    if (query) {
+        c->req.query = query;
+        c->req.query_len = query_len;
+    }
+
+    if (c->req.path && router_lookup(g_svr.router, c->req.path,
+                c->req.parser->method, &c->req.route))
+        c->req.um = c->req.route.data;
+}
+
 int req_url_cb(http_parser* parser, const char *at, size_t len) {
     struct client *c = parser->data;
 
     struct http_parser_url url;
-    if (http_parser_parse_url(at, len, 0, &url) == 0) {
-        if (url.field_set & (1 << UF_PATH)) {
-            c->req.path = strndup(at+url.field_data[UF_PATH].off,
-                    url.field_data[UF_PATH].len);
-        }
-        
-        if (url.field_set & (1 << UF_QUERY)) {
-            c->req.query = strndup(at+url.field_data[UF_QUERY].off,
-                    url.field_data[UF_QUERY].len);
-        }
+    if (http_parser_parse_url(at, len, 0, &url) == 0
+            && (url.field_set & (1 << UF_PATH))) {
+        bool has_query = url.field_set & (1 << UF_QUERY);
+        req_set_url(c, at + url.field_data[UF_PATH].off,
+                url.field_data[UF_PATH].len,
+                has_query ? at + url.field_data[UF_QUERY].off : NULL,
+                has_query ? url.field_data[UF_QUERY].len : 0);
     }
     
     return 0;
 }
 
-#define CURR_LINE (&headers[c->req.curr_header])
+static inline bool req_wants(const struct client *c, enum http_handler_flag flags)
+{
+    return c->req.um && (c->req.um->flags & flags);
+}
+
+/*
+ * the slot of a known header; the first four bytes, lowercased, pick
+ * the candidates.
+ */
+static enum http_header header_classify(const char *name, size_t len)
+{
+    enum {
+        HDR_ACCE = MULTICHAR_CONSTANT_L('a','c','c','e'),
+        HDR_AUTH = MULTICHAR_CONSTANT_L('a','u','t','h'),
+        HDR_CONN = MULTICHAR_CONSTANT_L('c','o','n','n'),
+        HDR_CONT = MULTICHAR_CONSTANT_L('c','o','n','t'),
+        HDR_COOK = MULTICHAR_CONSTANT_L('c','o','o','k'),
+        HDR_HOST = MULTICHAR_CONSTANT_L('h','o','s','t'),
+        HDR_IF_M = MULTICHAR_CONSTANT_L('i','f','-','m'),
+        HDR_IF_N = MULTICHAR_CONSTANT_L('i','f','-','n'),
+        HDR_RANG = MULTICHAR_CONSTANT_L('r','a','n','g'),
+        HDR_REFE = MULTICHAR_CONSTANT_L('r','e','f','e'),
+        HDR_USER = MULTICHAR_CONSTANT_L('u','s','e','r'),
+    };
 
+#define HEADER_IS(str) \
+    (len == sizeof(str) - 1 && !strncasecmp(name + 4, (str) + 4, len - 4))
+
+    if (len < 4)
+        return HEADER_UNKNOWN;
+
+    STRING_SWITCH_L(name) {
+    case HDR_ACCE:
+        if (HEADER_IS("Accept-Encoding"))
+            return HEADER_ACCEPT_ENCODING;
+        break;
+    case HDR_AUTH:
+        if (HEADER_IS("Authorization"))
+            return HEADER_AUTHORIZATION;
+        break;
+    case HDR_CONN:
+        if (HEADER_IS("Connection"))
+            return HEADER_CONNECTION;
+        break;
+    case HDR_CONT:
+        if (HEADER_IS("Content-Length"))
+            return HEADER_CONTENT_LENGTH;
+        if (HEADER_IS("Content-Type"))
+            return HEADER_CONTENT_TYPE;
+        break;
+    case HDR_COOK:
+        if (HEADER_IS("Cookie"))
+            return HEADER_COOKIE;
+        break;
+    case HDR_HOST:
+        if (len == 4)
+            return HEADER_HOST;
+        break;
+    case HDR_IF_M:
+        if (HEADER_IS("If-Modified-Since"))
+            return HEADER_IF_MODIFIED_SINCE;
+        break;
+    case HDR_IF_N:
+        if (HEADER_IS("If-None-Match"))
+            return HEADER_IF_NONE_MATCH;
+        break;
+    case HDR_RANG:
+        if (HEADER_IS("Range"))
+            return HEADER_RANGE;
+        break;
+    case HDR_REFE:
+        if (HEADER_IS("Referer"))
+            return HEADER_REFERER;
+        break;
+    case HDR_USER:
+        if (HEADER_IS("User-Agent"))
+            return HEADER_USER_AGENT;
+        break;
+    }
+#undef HEADER_IS
+
+    return HEADER_UNKNOWN;
+}
+
+/*
+ * headers are slices of the request buffer, read in one go, so a field
+ * or value split over calls lies in one piece.
+ */
 int req_header_field_cb(http_parser *parser, const char *at, size_t len)
 {
     struct client *c = parser->data;
-    kv_t *headers = c->req.headers;
 
-    if (c->req.last_was_value) {
-        c->req.curr_header++;
-
-        if (c->req.curr_header == MAX_HEADER_LINES)
-            return -1;
-        
-        CURR_LINE->value = NULL;
-        CURR_LINE->value_len = 0;
+    if (!req_wants(c, HANDLER_PARSE_HEADERS))
+        return 0;
 
-        CURR_LINE->key_len = len;
-        CURR_LINE->key = malloc(len+1);
-        strncpy(CURR_LINE->key, at, len);
+    if (c->req.last_was_value || !c->req.field.key) {
+        c->req.field.key = (char *)at;
+        c->req.field.key_len = len;
     } else {
-        if (CURR_LINE->value) {
-            free(CURR_LINE->value);
-            CURR_LINE->value = NULL;
-        }
-        CURR_LINE->value_len = 0;        
-
-        CURR_LINE->key_len += len;
-        CURR_LINE->key = realloc(CURR_LINE->key, CURR_LINE->key_len+1);
-        strncpy(CURR_LINE->key, at, len);
+        c->req.field.key_len += len;
     }
     
-    CURR_LINE->key[CURR_LINE->key_len] = 0;
     c->req.last_was_value = 0;
 
     return 0;
 }
 
+/* a value starting files its header: in its slot, or with the others. */
 int req_header_value_cb(http_parser *parser, const char *at, size_t len)
 {
     struct client *c = parser->data;
-    kv_t *headers = c->req.headers;
+
+    if (!req_wants(c, HANDLER_PARSE_HEADERS))
+        return 0;
 
     if (!c->req.last_was_value) {
-        CURR_LINE->value_len = len;
-        CURR_LINE->value = malloc(len+1);
-        strncpy(CURR_LINE->value, at, len);
-    } else {
-        CURR_LINE->value_len += len;
-        CURR_LINE->value = realloc(CURR_LINE->value, CURR_LINE->value_len+1);
-        strncpy(CURR_LINE->value, at, len);
+        enum http_header h = header_classify(c->req.field.key,
+                c->req.field.key_len);
+        kv_t *kv = NULL;
+
+        if (h != HEADER_UNKNOWN)
+            kv = &c->req.known_headers[h];
+        else if (c->req.headers_sz < MAX_HEADER_LINES)
+            kv = &c->req.headers[c->req.headers_sz++];
+        if (kv) {
+            kv->key = c->req.field.key;
+            kv->key_len = c->req.field.key_len;
+            kv->value = (char *)at;
+            kv->value_len = len;
+        }
+        c->req.curr_header = kv;
+    } else if (c->req.curr_header) {
+        c->req.curr_header->value_len += len;
     }
 
-    CURR_LINE->value[CURR_LINE->value_len] = 0;
     c->req.last_was_value = 1;
 
     return 0;
 }
 
+/* the parser is past the headers, their values can be terminated. */
 int req_headers_complete_cb(http_parser *parser)
 {
     struct client *c = parser->data;
-    c->req.headers_sz = c->req.curr_header + 1;
+    int i;
 
-    int i = 0;
-    for (i = 0; i < c->req.headers_sz; i++) {
-        DBG("%s: %s", c->req.headers[i].key, c->req.headers[i].value);
-        if (strcmp(c->req.headers[i].key, "If-Modified-Since") == 0) {
-            c->req.mtime = c->req.headers[i].value;
-        }
+    if (!req_wants(c, HANDLER_PARSE_HEADERS))
+        return 0;
+
+    for (i = 0; i < HEADER_KNOWN; i++) {
+        kv_t *h = &c->req.known_headers[i];
+        if (h->value)
+            h->value[h->value_len] = 0;
+    }
+
+    return 0;
+}
+
+/* a header without a slot, by name. */
+const kv_t *req_other_header(const struct http_request *req, const char *name)
+{
+    size_t len = strlen(name);
+    int i;
+
+    for (i = 0; i < req->headers_sz; i++) {
+        const kv_t *h = &req->headers[i];
+        if (h->key_len == len && !strncasecmp(h->key, name, len))
+            return h;
     }
+    return NULL;
+}
+
+int req_body_cb(http_parser *parser, const char *at, size_t len)
+{
+    struct client *c = parser->data;
+
+    if (!req_wants(c, HANDLER_PARSE_POST_DATA))
+        return 0;
+    if (!c->req.body)
+        c->req.body = at;
+    c->req.body_len += len;
 
     return 0;
 }
 
+/*
+ * a request reqparse() took whole, fed to what http_parser's callbacks
+ * would have been.
+ */
+static size_t req_fast_parsed(struct client *c, const struct reqparse *r)
+{
+    http_parser *parser = c->req.parser;
+    const char *url = r->url.at, *url_end = url + r->url.len;
+    const char *path_end = memchr(url, '?', r->url.len);
+    const char *frag = memchr(url, '#', r->url.len);
+    int i;
+
+    parser->method = r->method;
+    parser->http_major = r->http_major;
+    parser->http_minor = r->http_minor;
+
+    if (frag && (!path_end || frag < path_end))
+        path_end = NULL;
+    if (!frag)
+        frag = url_end;
+    req_set_url(c, url, (size_t)((path_end ? path_end : frag) - url),
+            path_end ? path_end + 1 : NULL,
+            path_end ? (size_t)(frag - path_end - 1) : 0);
+
+    for (i = 0; i < r->nheaders; i++) {
+        req_header_field_cb(parser, r->headers[i].name.at, r->headers[i].name.len);
+        req_header_value_cb(parser, r->headers[i].value.at, r->headers[i].value.len);
+    }
+    req_headers_complete_cb(parser);
+
+    return c->req.buf.len;
+}
+
+static int hex_digit(char ch)
+{
+    if (ch >= '0' && ch <= '9')
+        return ch - '0';
+    ch |= 0x20;
+    if (ch >= 'a' && ch <= 'f')
+        return ch - 'a' + 10;
+    return -1;
+}
+
+/* %XX and, in a query, '+' decoded in place; returns the new length. */
+static size_t url_decode(char *s, size_t len, bool plus)
+{
+    char *w = s;
+    size_t i;
+
+    for (i = 0; i < len; i++) {
+        int hi, lo;
+
+        if (s[i] == '%' && i + 2 < len
+                && (hi = hex_digit(s[i + 1])) >= 0 && (lo = hex_digit(s[i + 2])) >= 0) {
+            *w++ = (char)(hi << 4 | lo);
+            i += 2;
+        } else if (plus && s[i] == '+') {
+            *w++ = ' ';
+        } else {
+            *w++ = s[i];
+        }
+    }
+    return (size_t)(w - s);
+}
+
+/*
+ * split `s` at `sep` into key=value slices of the request buffer, each
+ * decoded in place and nul terminated where the separator was. a key
+ * without '=' has an empty value.
+ */
+static int split_pairs(char *s, size_t len, char sep, bool query, kv_t *kvs,
+        int max)
+{
+    char *end = s + len;
+    int n = 0;
+
+    while (s < end && n < max) {
+        char *next = memchr(s, sep, end - s);
+        if (!next)
+            next = end;
+
+        char *key = s;
+        while (!query && key < next && *key == ' ')
+            key++;
+        if (key < next) {
+            char *eq = memchr(key, '=', next - key);
+            kv_t *kv = &kvs[n++];
+
+            kv->key = key;
+            kv->key_len = (eq ? eq : next) - key;
+            kv->value = eq ? eq + 1 : next;
+            kv->value_len = eq ? (size_t)(next - eq - 1) : 0;
+            if (query) {
+                kv->key_len = url_decode(kv->key, kv->key_len, true);
+                kv->value_len = url_decode(kv->value, kv->value_len, true);
+            }
+            kv->key[kv->key_len] = 0;
+            kv->value[kv->value_len] = 0;
+        }
+        s = next + 1;
+    }
+    return n;
+}
+
+static const kv_t *find_pair(const kv_t *kvs, int n, const char *key)
+{
+    int i;
+
+    for (i = 0; i < n; i++) {
+        if (!strcmp(kvs[i].key, key))
+            return &kvs[i];
+    }
+    return NULL;
+}
+
+/*
+ * the query string parameter `key`, for routes with
+ * HANDLER_PARSE_QUERY_STRING. parsed on the first call; req->query is
+ * decoded in place with it.
+ */
+const kv_t *req_query_param(struct http_request *req, const char *key)
+{
+    if (!req->um || !(req->um->flags & HANDLER_PARSE_QUERY_STRING))
+        return NULL;
+    if (!(req->flags & REQUEST_PARSED_QUERY)) {
+        req->flags |= REQUEST_PARSED_QUERY;
+        if (req->query)
+            req->query_params_sz = split_pairs((char *)req->query,
+                    req->query_len, '&', true, req->query_params,
+                    MAX_QUERY_PARAMS);
+    }
+    return find_pair(req->query_params, req->query_params_sz, key);
+}
+
+/* the cookie `key`, for routes with HANDLER_PARSE_COOKIES. */
+const kv_t *req_cookie(struct http_request *req, const char *key)
+{
+    if (!req->um || !(req->um->flags & HANDLER_PARSE_COOKIES))
+        return NULL;
+    if (!(req->flags & REQUEST_PARSED_COOKIES)) {
+        kv_t *cookie = &req->known_headers[HEADER_COOKIE];
+
+        req->flags |= REQUEST_PARSED_COOKIES;
+        if (cookie->value)
+            req->cookies_sz = split_pairs(cookie->value, cookie->value_len,
+                    ';', false, req->cookies, MAX_COOKIES);
+    }
+    return find_pair(req->cookies, req->cookies_sz, key);
+}
+
+
+/*
+ * a handler that parks the client with client_wait() has its result
+ * ignored; it runs again, on the client's loop, once the key is cached.
+ */
+static void run_handler(struct client *c)
+{
+    c->resp.status = c->req.um->handler(c);
+
+    if (c->flags & CONN_SHOULD_RESUME_CORO) {
+        /* the request is read, nothing to do until resumed. */
+        aeDeleteFileEvent(c->loop, c->fd, AE_READABLE);
+        return;
+    }
+
+    aeCreateFileEvent(c->loop, c->fd, AE_WRITABLE, write_proc, c);  
+}
+
+static void resume_client(void *data)
+{
+    struct client *c = data;
+
+    c->flags &= ~CONN_SHOULD_RESUME_CORO;
+    c->flags |= CONN_WAITED;
+    run_handler(c);
+}
 
 void read_proc(aeEventLoop *loop, int fd, void *data, int mask) {
     struct client *c = data;
@@ -671,10 +1031,15 @@ void read_proc(aeEventLoop *loop, int fd, void *data, int mask) {
         
     http_parser_init(parser, HTTP_REQUEST);
     parser->data = c;
+    c->req.parser = parser;
     size_t nparsed;
     
-    nparsed = http_parser_execute(parser, &g_svr.parser_settings, 
-            c->req.buf.value, c->req.buf.len);
+    struct reqparse fast;
+    if (reqparse(c->req.buf.value, c->req.buf.len, &fast) == c->req.buf.len)
+        nparsed = req_fast_parsed(c, &fast);
+    else
+        nparsed = http_parser_execute(parser, &g_svr.parser_settings, 
+                c->req.buf.value, c->req.buf.len);
 
     if (parser->upgrade) {
         /* handle new protocol */
@@ -687,18 +1052,15 @@ void read_proc(aeEventLoop *loop, int fd, void *data, int mask) {
         free_client(c);
         return;
     }
-    c->req.parser = parser;
 
-    c->req.um = trie_lookup_prefix(&g_svr.url_map, c->req.path);
+    /* routed by req_set_url(). */
     if (!c->req.um) {
         WARN("unreachable path."); // TODO: return 404 page?
         free_client(c);
         return;
     }
 
-    c->resp.status = c->req.um->handler(c);
-
-    aeCreateFileEvent(c->loop, c->fd, AE_WRITABLE, write_proc, c);  
+    run_handler(c);
 }
 
 
@@ -725,78 +1087,543 @@ void accept_proc(aeEventLoop *loop, int fd, void *data, int mask) {
     }
 }
 
-content_t *get_file_content(char *path)
-{
-    content_t *str = hash_find(g_svr.cache, path);
-    if (!str) {
-        WARN("open %s", path);
+/*
+ * cached content is immutable once published, it is replaced, never
+ * modified. readers pin what they use with a reference, so an entry can
+ * be replaced or dropped while responses still point into it.
+ */
 
-        struct stat st;
-        if (stat(path, &st) == -1) {
-            st.st_mtime = 0;
-        }
+static bool snapshot_verify(const char *key, content_t *cont);
+static bool snapshot_current(const char *key, const struct stat *st);
+static void cache_del_prefix(const char *prefix);
 
-        FILE *f = fopen(path, "rb");
-        if (!f) {
-            DBG("fopen failed: %s", path);
-            content_t *null_cont = content_new(NULL, 0, 0);
-            if (!null_cont) {
-                WARN("malloc content failed");
-                return NULL;
-            }
-            hash_add(g_svr.cache, strdup(path), null_cont);
-            return NULL;
-        }
-        fseek(f, 0, SEEK_END);
-        long fsize = ftell(f);
-        fseek(f, 0, SEEK_SET);
-        char *buf = malloc(fsize+1);
-        if (!buf)
-            return NULL;
-        fread(buf, fsize, 1, f);
-        fclose(f);
-        buf[fsize] = 0;
+static void content_pin(void *value)
+{
+    content_ref(value);
+}
 
+/* returns a reference to the entry, drop it with content_free(). */
+content_t *cache_get(const char *key)
+{
+    content_t *cont = chash_find(g_svr.cache, key, content_pin);
 
-        content_t *new_cont = content_new(buf, fsize, fsize+1);
-        if (!new_cont) {
-            DBG("content malloc failed");
-            free(buf);
-            return NULL;
-        }
-        new_cont->mtime = st.st_mtime;
-        hash_add(g_svr.cache, strdup(path), new_cont);
-        return new_cont;
-    } else {
-        if (str->value == NULL)
-            return NULL;
+    if (cont && __atomic_load_n(&cont->unverified, __ATOMIC_ACQUIRE)
+            && !snapshot_verify(key, cont)) {
+        content_free(cont);
+        return NULL;
     }
+    return cont;
+}
 
-    return str;
+bool cache_contains(const char *key)
+{
+    content_t *cont = cache_get(key);
+    content_free(cont);
+    return cont != NULL;
 }
 
+/*
+ * single flight: the first miss of a key loads it, later misses park on
+ * the key's flight until it is published, then run again on their loop.
+ */
+struct flight {
+    char *key;
+    bool loading;   /* claimed by a loader */
+    struct list_head waiters;
+};
+
+/* the flight of `key`, created if there is none; flights_mtx held. */
+static struct flight *flight_get(const char *key)
+{
+    struct flight *f = hash_find(g_svr.flights, key);
+    if (f)
+        return f;
 
-int server_cron(struct aeEventLoop *loop, long long id, void *data) {
-    (void)(loop);
-    (void)(id);
-    (void)(data);
-    if (!g_svr.running) {
-        aeStop(loop);
+    f = malloc(sizeof(*f));
+    if (!f || !(f->key = strdup(key))) {
+        free(f);
+        return NULL;
     }
+    f->loading = false;
+    list_head_init(&f->waiters);
+    hash_add(g_svr.flights, f->key, f);
+    return f;
+}
 
-    refresh_index_page();
-        
-    return 1000;
+/*
+ * true if the caller is the first to miss `key`, and so should load it.
+ * the loader ends the flight with cache_wake() once done, whether or not
+ * it published the key itself.
+ */
+bool cache_claim(const char *key)
+{
+    pthread_mutex_lock(&g_svr.flights_mtx);
+    struct flight *f = flight_get(key);
+    bool first = f && !f->loading;
+    if (first)
+        f->loading = true;
+    pthread_mutex_unlock(&g_svr.flights_mtx);
+
+    /* without a flight there is no one to wait for. */
+    return first || !f;
 }
 
-int task_cron(struct aeEventLoop *loop, long long id, void *data) {
-    (void)(loop);
-    (void)(id);
+/*
+ * park `c` until `key` is published. false, and `c` is not parked, if
+ * `key` is cached and current by now, no loader or render holds it, or
+ * `c` has been parked once already. a flight nobody holds would never end.
+ */
+bool client_wait(struct client *c, const char *key)
+{
+    if (c->flags & CONN_WAITED)
+        return false;
+
+    /* lock order is the cache shard of the key, then flights_mtx. */
+    unsigned shard;
+    struct hash *cache = chash_lock(g_svr.cache, key, false, &shard);
+    pthread_mutex_lock(&g_svr.flights_mtx);
+    content_t *cont = hash_find(cache, key);
+    bool current = cont && !__atomic_load_n(&cont->stale, __ATOMIC_RELAXED);
+    struct flight *f = current ? NULL : hash_find(g_svr.flights, key);
+    if (f) {
+        list_add_tail(&f->waiters, &c->waiting);
+        c->flags |= CONN_SHOULD_RESUME_CORO;
+    }
+    pthread_mutex_unlock(&g_svr.flights_mtx);
+    chash_unlock_shard(g_svr.cache, shard);
+
+    return f != NULL;
+}
+
+/* move the waiters of `key` to `waiters` and end its flight. */
+static void flight_end(const char *key, struct list_head *waiters)
+{
+    list_head_init(waiters);
+
+    pthread_mutex_lock(&g_svr.flights_mtx);
+    struct flight *f = hash_find(g_svr.flights, key);
+    if (f) {
+        list_append_list(waiters, &f->waiters);
+        hash_del(g_svr.flights, key);
+        free(f->key);
+        free(f);
+    }
+    pthread_mutex_unlock(&g_svr.flights_mtx);
+}
+
+static void resume_waiters(struct list_head *waiters)
+{
+    struct client *c, *next;
+
+    list_for_each_safe(waiters, c, next, waiting) {
+        list_del(&c->waiting);
+        if (!jobq_push(&c->thrd->jobs, resume_client, c))
+            WARN("resume client %d failed.", c->fd);
+    }
+}
+
+/* end the flight of `key` without publishing, the waiters try again. */
+void cache_wake(const char *key)
+{
+    struct list_head waiters;
+
+    flight_end(key, &waiters);
+    resume_waiters(&waiters);
+}
+
+/* publish `cont` under `key`, both owned by the cache afterwards. */
+void cache_insert(char *key, content_t *cont)
+{
+    struct list_head waiters;
+    unsigned shard;
+
+    hash_add(chash_lock(g_svr.cache, key, true, &shard), key, cont);
+    flight_end(key, &waiters);
+    chash_unlock_shard(g_svr.cache, shard);
+
+    resume_waiters(&waiters);
+}
+
+/*
+ * cache_insert() under a copy of `key`. without the copy `cont` is dropped
+ * and the flight ended, the waiters try again.
+ */
+static bool cache_insert_copy(const char *key, content_t *cont)
+{
+    char *k = strdup(key);
+
+    if (!k) {
+        content_free(cont);
+        cache_wake(key);
+        return false;
+    }
+    cache_insert(k, cont);
+    return true;
+}
+
+/*
+ * like cache_insert(), but an entry already cached under `key` wins and
+ * the new one is dropped. returns a reference to the cached entry.
+ */
+content_t *cache_insert_unique(char *key, content_t *cont)
+{
+    struct list_head waiters;
+    unsigned shard;
+
+    struct hash *cache = chash_lock(g_svr.cache, key, true, &shard);
+    if (hash_add_unique(cache, key, cont) == -EEXIST) {
+        content_t *old = content_ref(hash_find(cache, key));
+        chash_unlock_shard(g_svr.cache, shard);
+        free(key);
+        content_free(cont);
+        return old;
+    }
+    content_ref(cont);
+    flight_end(key, &waiters);
+    chash_unlock_shard(g_svr.cache, shard);
+
+    resume_waiters(&waiters);
+    return cont;
+}
+
+void cache_del(const char *key)
+{
+    struct list_head waiters;
+    unsigned shard;
+
+    hash_del(chash_lock(g_svr.cache, key, true, &shard), key);
+    flight_end(key, &waiters);
+    chash_unlock_shard(g_svr.cache, shard);
+
+    resume_waiters(&waiters);
+}
+
+/*
+ * flag the entry of `key` as out of date. it is still served, for up to
+ * cfg.max_stale seconds, until the caller has it replaced or deleted.
+ */
+void cache_mark_stale(const char *key)
+{
+    time_t zero = 0, now = time(NULL);
+    unsigned shard;
+
+    content_t *cont = hash_find(chash_lock(g_svr.cache, key, false, &shard), key);
+    if (cont)
+        __atomic_compare_exchange_n(&cont->stale, &zero, now, false,
+                __ATOMIC_RELAXED, __ATOMIC_RELAXED);
+    chash_unlock_shard(g_svr.cache, shard);
+}
+
+/*
+ * whether to answer with `cont`, found under `key`. an outdated entry is
+ * served while it is rebuilt; once past max_stale, `c` is parked for the
+ * rebuild instead and false returned. parking needs a loader or render
+ * holding the key: with none, say after a rebuild that failed, the stale
+ * copy is all there is and is served.
+ */
+static bool serve_cached(struct client *c, const char *key, content_t *cont)
+{
+    __atomic_add_fetch(&cont->hits, 1, __ATOMIC_RELAXED);
+
+    time_t stale = __atomic_load_n(&cont->stale, __ATOMIC_RELAXED);
+    if (!stale)
+        return true;
+
+    if (time(NULL) - stale > g_svr.cfg.max_stale && client_wait(c, key))
+        return false;
+
+    __atomic_add_fetch(&g_svr.status.served_stale, 1, __ATOMIC_RELAXED);
+    return true;
+}
+
+#define CACHE_FILE_MAX (1 << 20) // larger static files are not cached
+
+/* read a whole file into a nul terminated buffer of its own. */
+static char *read_file(const char *path, long *len)
+{
+    FILE *f = fopen(path, "rb");
+    if (!f) {
+        DBG("fopen failed: %s", path);
+        return NULL;
+    }
+    fseek(f, 0, SEEK_END);
+    long fsize = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    char *buf = malloc(fsize+1);
+    if (!buf) {
+        fclose(f);
+        return NULL;
+    }
+    fread(buf, fsize, 1, f);
+    fclose(f);
+    buf[fsize] = 0;
+    *len = fsize;
+    return buf;
+}
+
+/* read a whole file, bypassing the cache. */
+static content_t *load_file(const char *path)
+{
+    struct stat st;
+    if (stat(path, &st) == -1) {
+        memset(&st, 0, sizeof(st));
+    }
+
+    long fsize;
+    char *buf = read_file(path, &fsize);
+    if (!buf)
+        return NULL;
+
+    content_t *new_cont = content_new(buf, fsize, fsize+1);
+    if (!new_cont) {
+        DBG("content malloc failed");
+        free(buf);
+        return NULL;
+    }
+    new_cont->mtime = st.st_mtime;
+    new_cont->src_mtime = st.st_mtim;
+    return new_cont;
+}
+
+/* returns a reference to the cached file, NULL if there is none. */
+content_t *get_file_content(char *path)
+{
+    content_t *str = cache_get(path);
+    if (!str) {
+        WARN("open %s", path);
+
+        content_t *new_cont = load_file(path);
+        if (!new_cont) {
+            new_cont = content_new(NULL, 0, 0);
+            if (!new_cont) {
+                WARN("malloc content failed");
+                return NULL;
+            }
+        }
+        char *key = strdup(path);
+        if (!key) {
+            /* the waiters try again, and likely fail too. */
+            content_free(new_cont);
+            cache_wake(path);
+            return NULL;
+        }
+        str = cache_insert_unique(key, new_cont);
+    }
+
+    if (content_is_null(str)) {
+        content_free(str);
+        return NULL;
+    }
+
+    return str;
+}
+
+#ifdef HAVE_BUNDLE
+/* the bundled file as it was, inflated once and cached as "bundle:<path>". */
+static content_t *bundle_content(const struct bundle_asset *a)
+{
+    char key[1040];
+    snprintf(key, sizeof(key), "bundle:%s", a->path);
+    content_t *cont = cache_get(key);
+    if (cont)
+        return cont;
+
+    size_t len;
+    char *buf = bundle_read(a, &len);
+    if (!buf)
+        return NULL;
+    if (!(cont = content_new(buf, len, len + 1))) {
+        free(buf);
+        return NULL;
+    }
+    cont->mtime = a->mtime;
+
+    char *k = strdup(key);
+    if (!k)
+        return cont;    /* served uncached */
+    return cache_insert_unique(k, cont);
+}
+#endif
+
+/* a template fragment, "./tmpl/..": from disk, else the bundled copy. */
+static content_t *get_fragment(char *path)
+{
+    content_t *str = get_file_content(path);
+#ifdef HAVE_BUNDLE
+    const struct bundle_asset *a;
+    if (!str && (a = bundle_find(path + 2)))
+        str = bundle_content(a);
+#endif
+    return str;
+}
+
+/* a file read on the io threads, published from the reader's loop. */
+struct file_read {
+    char *path;
+    content_t *cont;
+};
+
+static void file_read_work(void *data)
+{
+    struct file_read *r = data;
+
+    WARN("open %s", r->path);
+    r->cont = load_file(r->path);
+}
+
+static void file_read_done(void *data)
+{
+    struct file_read *r = data;
+
+    /* a missing file is cached as such, like get_file_content() does. */
+    if (!r->cont)
+        r->cont = content_new(NULL, 0, 0);
+    if (r->cont) {
+        char *key = strdup(r->path);
+        if (key)
+            content_free(cache_insert_unique(key, r->cont));
+        else
+            content_free(r->cont);
+    }
+    cache_wake(r->path);
+
+    free(r->path);
+    free(r);
+}
+
+/*
+ * load `path` into the cache on the io threads, with `c` parked until it
+ * is there. false if `c` has to read it itself: it was parked before, or
+ * the io queue is full.
+ */
+static bool read_file_async(struct client *c, const char *path)
+{
+    if (c->flags & CONN_WAITED)
+        return false;
+
+    struct file_read *r = calloc(1, sizeof(*r));
+    if (!r || !(r->path = strdup(path))) {
+        free(r);
+        return false;
+    }
+
+    /* done runs on this loop, so not before c is parked below. */
+    if (!iopool_submit(&g_svr.iopool, file_read_work, file_read_done, r,
+                &c->thrd->jobs)) {
+        free(r->path);
+        free(r);
+        return false;
+    }
+
+    /* only fails if the file got cached meanwhile. */
+    return client_wait(c, path);
+}
+
+struct render_job {
+    char *key;
+    int id;
+    int (*render)(int id);
+    int (*render_key)(const char *key); // instead, a render told by its key
+};
+
+static void render_proc(void *data)
+{
+    struct render_job *job = data;
+
+    if (job->render)
+        job->render(job->id);
+    else
+        job->render_key(job->key);
+
+    /*
+     * a render that published nothing still lets its waiters go. the
+     * flight ends with the job, so a new job for the key claims a new one.
+     */
+    pthread_mutex_lock(&g_svr.render_mtx);
+    hash_del(g_svr.rendering, job->key);
+    cache_wake(job->key);
+    pthread_mutex_unlock(&g_svr.render_mtx);
+
+    free(job->key);
+    free(job);
+}
+
+static bool render_queue(const char *key, int (*render)(int id),
+        int (*render_key)(const char *key), int id)
+{
+    pthread_mutex_lock(&g_svr.render_mtx);
+    if (hash_find(g_svr.rendering, key)) {
+        pthread_mutex_unlock(&g_svr.render_mtx);
+        return true;
+    }
+
+    struct render_job *job = malloc(sizeof(*job));
+    if (!job || !(job->key = strdup(key))) {
+        pthread_mutex_unlock(&g_svr.render_mtx);
+        free(job);
+        return false;
+    }
+    job->id = id;
+    job->render = render;
+    job->render_key = render_key;
+    hash_add(g_svr.rendering, job->key, job);
+    /* held from here, the render may be done before anyone waits. */
+    cache_claim(key);
+    pthread_mutex_unlock(&g_svr.render_mtx);
+
+    if (!jobq_push(&g_svr.render_q, render_proc, job)) {
+        pthread_mutex_lock(&g_svr.render_mtx);
+        hash_del(g_svr.rendering, job->key);
+        cache_wake(job->key);
+        pthread_mutex_unlock(&g_svr.render_mtx);
+        free(job->key);
+        free(job);
+        return false;
+    }
+
+    return true;
+}
+
+/*
+ * queue `render(id)` on the task loop. `key` is the cache key the render
+ * publishes; a key that is already queued or being rendered is not queued
+ * again.
+ */
+bool render_submit(const char *key, int (*render)(int id), int id)
+{
+    return render_queue(key, render, NULL, id);
+}
+
+/* the same for `render(key)`, when the key tells all the render needs. */
+bool render_submit_key(const char *key, int (*render)(const char *key))
+{
+    return render_queue(key, NULL, render, 0);
+}
+
+
+int server_cron(struct aeEventLoop *loop, long long id, void *data) {
+    (void)(loop);
+    (void)(id);
+    (void)(data);
+    if (!g_svr.running) {
+        aeStop(loop);
+    }
+
+    return 1000;
+}
+
+int task_cron(struct aeEventLoop *loop, long long id, void *data) {
+    (void)(loop);
+    (void)(id);
     (void)(data);
 
     refresh_index_page();
-        
-    return 10000;
+
+    /* with change notifications one scan, after they start, is enough. */
+    if (g_svr.watching)
+        return AE_NOMORE;
+    paths_rebuild();
+    return 1000;
 }
 
 void before_sleep(struct aeEventLoop *loop) {
@@ -809,35 +1636,179 @@ void before_sleep(struct aeEventLoop *loop) {
  * url handlers.
  */
 
+static void resp_add_header(struct http_response *resp, const char *key,
+        const char *value)
+{
+    if (resp->headers_sz >= MAX_HEADER_LINES)
+        return;
+
+    kv_t *kv = &resp->headers[resp->headers_sz++];
+    kv->key = strdup(key);
+    kv->key_len = strlen(key);
+    kv->value = strdup(value);
+    kv->value_len = strlen(value);
+}
+
+/*
+ * page templates. blog.html and blog_summary.html take the blog_vars,
+ * pager.html the pager_vars.
+ */
+enum blog_var {
+    BLOG_ID,
+    BLOG_HEADING,
+    BLOG_SUB_HEADING,
+    BLOG_AUTHOR,
+    BLOG_AUTHOR_LINK,
+    BLOG_DATE,
+    BLOG_CONTENT,
+    BLOG_VARS
+};
+
+static const char *const blog_vars[] = {
+    [BLOG_ID] = "id",
+    [BLOG_HEADING] = "heading",
+    [BLOG_SUB_HEADING] = "sub_heading",
+    [BLOG_AUTHOR] = "author",
+    [BLOG_AUTHOR_LINK] = "author_link",
+    [BLOG_DATE] = "date",
+    [BLOG_CONTENT] = "content",
+    [BLOG_VARS] = NULL
+};
+
+enum pager_var { PAGER_NEWER, PAGER_OLDER, PAGER_VARS };
+
+static const char *const pager_vars[] = {
+    [PAGER_NEWER] = "newer",
+    [PAGER_OLDER] = "older",
+    [PAGER_VARS] = NULL
+};
+
+#define TMPL_BLOG "./tmpl/blog.html"
+#define TMPL_SUMMARY "./tmpl/blog_summary.html"
+#define TMPL_PAGER "./tmpl/pager.html"
+
+/* compile `path` into `*t`; on failure the template in use is kept. */
+static bool load_template(struct tmpl **t, const char *path,
+        const char *const names[])
+{
+    struct tmpl *new_t = tmpl_compile_file(path, names);
+#ifdef HAVE_BUNDLE
+    /* missing on disk, the bundled one; paths are "./tmpl/..". */
+    const struct bundle_asset *a;
+    char *text;
+    size_t len;
+    if (!new_t && access(path, F_OK) == -1 && (a = bundle_find(path + 2))
+            && (text = bundle_read(a, &len))) {
+        new_t = tmpl_compile(text, len, names);
+        free(text);
+    }
+#endif
+    if (!new_t) {
+        WARN("compile template %s failed.", path);
+        return false;
+    }
+
+    tmpl_free(*t);
+    *t = new_t;
+    return true;
+}
+
+bool templates_init(void)
+{
+    return load_template(&g_svr.tmpl_blog, TMPL_BLOG, blog_vars)
+        && load_template(&g_svr.tmpl_summary, TMPL_SUMMARY, blog_vars)
+        && load_template(&g_svr.tmpl_pager, TMPL_PAGER, pager_vars);
+}
+
+void templates_fini(void)
+{
+    tmpl_free(g_svr.tmpl_blog);
+    tmpl_free(g_svr.tmpl_summary);
+    tmpl_free(g_svr.tmpl_pager);
+}
+
+/* `id` and `date` are buffers for the values that need formatting. */
+static void blog_values(const struct blog *b, struct tmpl_value vals[BLOG_VARS],
+        char id[INT2STR_BUF_SZ], char date[32])
+{
+    memset(vals, 0, BLOG_VARS * sizeof(*vals));
+
+    vals[BLOG_ID].str = uint_to_string((size_t)b->info.id, id, &vals[BLOG_ID].len);
+    vals[BLOG_HEADING].str = b->info.heading;
+    vals[BLOG_SUB_HEADING].str = b->info.sub_heading;
+    vals[BLOG_AUTHOR].str = b->info.author;
+    vals[BLOG_AUTHOR_LINK].str = b->info.author_link;
+    vals[BLOG_CONTENT].str = b->content;
+
+    if (ctime_r(&b->info.timestamp, date)) {
+        date[strcspn(date, "\n")] = 0;
+        vals[BLOG_DATE].str = date;
+    }
+}
+
+/* the members of a blog's json. */
+enum blog_field {
+    BLOG_FIELD_HEADING,
+    BLOG_FIELD_SUB_HEADING,
+    BLOG_FIELD_AUTHOR,
+    BLOG_FIELD_AUTHOR_LINK,
+    BLOG_FIELD_TIMESTAMP,
+    BLOG_FIELD_CONTENT,
+    BLOG_FIELDS
+};
+
+static const char *const blog_fields[BLOG_FIELDS] = {
+    [BLOG_FIELD_HEADING] = "heading",
+    [BLOG_FIELD_SUB_HEADING] = "sub_heading",
+    [BLOG_FIELD_AUTHOR] = "author",
+    [BLOG_FIELD_AUTHOR_LINK] = "author_link",
+    [BLOG_FIELD_TIMESTAMP] = "timestamp",
+    [BLOG_FIELD_CONTENT] = "content",
+};
+
 int build_blog(int id, struct blog *b)
 {
     char path[1024];
     snprintf(path, sizeof(path), "./data/blogs/%d", id);
-    content_t *str = get_file_content(path);
-    if (!str) {
+    /* taken before reading, a change meanwhile makes it older, not newer. */
+    struct stat st;
+    if (stat(path, &st) == 0)
+        b->mtime = st.st_mtim;
+    /*
+     * the raw json is parsed once per change, keep it out of the cache.
+     * it is decoded in place and kept, the fields point into it.
+     */
+    long len;
+    char *src = read_file(path, &len);
+    if (!src) {
         DBG("get json %s failed.", path);
         return HTTP_NOT_FOUND;
     }
 
-    JsonNode *json = json_decode(str->value);
-    if (!json) {
+    JsonNode *vals[BLOG_FIELDS];
+    char nodes[BLOG_FIELDS * sizeof(JsonNode) + 16];
+    JsonArena arena;
+    json_arena_init(&arena, nodes, sizeof(nodes));
+    if (json_decode_members(src, blog_fields, vals, BLOG_FIELDS, &arena) < 0) {
         DBG("decode json %s failed.", path);
+        json_arena_free(&arena);
+        free(src);
         return HTTP_INTERNAL_ERROR;
     }
-    JsonNode *tmp;
-#define JSON_MEM_STR(key, def) \
-        (tmp = json_find_member(json, key)) ? tmp->string_ : def
-#define JSON_MEM_NUM(key, def) \
-        (tmp = json_find_member(json, key)) ? tmp->number_ : def
+#define JSON_MEM_STR(f, def) \
+        (vals[f] && vals[f]->tag == JSON_STRING ? vals[f]->string_ : def)
+#define JSON_MEM_NUM(f, def) \
+        (vals[f] && vals[f]->tag == JSON_NUMBER ? vals[f]->number_ : def)
     b->info.id = id;
-    b->info.heading = strdup(JSON_MEM_STR("heading", "No Heading"));
-    b->info.sub_heading = strdup(JSON_MEM_STR("sub_heading", "No Subheading"));
-    b->info.author = strdup(JSON_MEM_STR("author", "guest")); 
-    b->info.author_link = strdup(JSON_MEM_STR("author_link", "#"));
-    b->info.timestamp = (time_t)JSON_MEM_NUM("timestamp", 1469227894);
-    b->content = strdup(JSON_MEM_STR("content", "~_~"));
-
-    json_delete(json);
+    b->info.heading = JSON_MEM_STR(BLOG_FIELD_HEADING, "No Heading");
+    b->info.sub_heading = JSON_MEM_STR(BLOG_FIELD_SUB_HEADING, "No Subheading");
+    b->info.author = JSON_MEM_STR(BLOG_FIELD_AUTHOR, "guest");
+    b->info.author_link = JSON_MEM_STR(BLOG_FIELD_AUTHOR_LINK, "#");
+    b->info.timestamp = (time_t)JSON_MEM_NUM(BLOG_FIELD_TIMESTAMP, 1469227894);
+    b->content = JSON_MEM_STR(BLOG_FIELD_CONTENT, "~_~");
+    b->src = src;
+
+    json_arena_free(&arena);
     return 0;
 }
 
@@ -847,36 +1818,73 @@ int build_blog_cache(int id)
     snprintf(html_path, sizeof(html_path), "./data/blogs/%d.html", id);
 
     struct blog b;
-    if (build_blog(id, &b) != 0)
-        return HTTP_INTERNAL_ERROR;
-
-    size_t sz = strlen(b.content) + 8196;
-    char *buf = malloc(sz);
-    if (!buf) {
-        free_blog_buf(&b);
-        return HTTP_INTERNAL_ERROR;
+    memset(&b, 0, sizeof(b));
+    if (build_blog(id, &b) != 0) {
+        /* remember the miss, so readers get a 404 instead of waiting. */
+        content_t *null_cont = content_new(NULL, 0, 0);
+        if (null_cont)
+            cache_insert_copy(html_path, null_cont);
+        return HTTP_NOT_FOUND;
     }
-    int len = snprintf(buf, sz, tmpl_blog, 
-            b.info.heading, b.info.sub_heading, b.info.author_link, 
-            b.info.author, ctime(&b.info.timestamp), b.content );
+
+    struct tmpl_value vals[BLOG_VARS];
+    char id_str[INT2STR_BUF_SZ], date[32];
+    size_t len;
+    blog_values(&b, vals, id_str, date);
+    char *buf = tmpl_render(g_svr.tmpl_blog, vals, &len);
     free_blog_buf(&b);
-    if (len >= sz) {
-        len = sz-1;
-        buf[len] = 0;
-    }
+    if (!buf)
+        return HTTP_INTERNAL_ERROR;
 
     /* insert formatted html to cache. */
-    content_t *new_str = content_new(buf, len, sz);
+    content_t *new_str = content_new(buf, len, len + 1);
     if (!new_str) {
         DBG("content malloc failed");
         free(buf); 
         return HTTP_INTERNAL_ERROR;
     }
+    new_str->src_mtime = b.mtime;
     // No need to free buf because it is inserted to cache.
-    hash_add(g_svr.cache, strdup(html_path), new_str);
+    cache_insert_copy(html_path, new_str);
     return 0;
 }
 
+/* changes mark the page stale first, a current one needs no render. */
+static int render_blog(int id)
+{
+    char html_path[64];
+    snprintf(html_path, sizeof(html_path), "./data/blogs/%d.html", id);
+
+    content_t *cont = cache_get(html_path);
+    bool current = cont && !__atomic_load_n(&cont->stale, __ATOMIC_RELAXED);
+    content_free(cont);
+
+    return current ? 0 : build_blog_cache(id);
+}
+
+/* a cached page is served, stale, until the new one is published. */
+static bool render_blog_async(int id)
+{
+    char html_path[64];
+    snprintf(html_path, sizeof(html_path), "./data/blogs/%d.html", id);
+    cache_mark_stale(html_path);
+    return render_submit(html_path, render_blog, id);
+}
+
+/* `len` bytes of digits only, as an int; 0 when they are not that. */
+static int slice_int(const char *s, size_t len)
+{
+    int n = 0;
+    size_t i;
+
+    for (i = 0; i < len; i++) {
+        if (s[i] < '0' || s[i] > '9' || n > (INT_MAX - 9) / 10)
+            return 0;
+        n = n * 10 + (s[i] - '0');
+    }
+    return n;
+}
+
 /* /blogs */
 enum http_status blogs(void *data) {
     if (!data)
@@ -893,256 +1901,2142 @@ enum http_status blogs(void *data) {
     /* support both /blogs/1 and /blogs?1 */
     int id = 0;
     char html_path[1024];
-    if (req->query) {
-        id = atoi(req->query);
-    } else {
-        char *query = req->path+strlen("/blogs/");
-        if (*query)
-            id = atoi(query);
+    const struct route_param *param = route_param(&req->route, "id");
+    if (param) {
+        id = slice_int(param->value, param->len);
+    } else if (req->query) {
+        id = slice_int(req->query, req->query_len);
     }
 
     if (id <=0) {
         return HTTP_NOT_FOUND;
     }
 
+    pthread_mutex_lock(&g_svr.mtx);
+    bool known = hash_find(g_svr.blog_ids, (void *)(intptr_t)id) != NULL;
+    pthread_mutex_unlock(&g_svr.mtx);
+    if (!known)
+        return HTTP_NOT_FOUND;
+
 
     snprintf(html_path, sizeof(html_path), "./data/blogs/%d.html", id);
-    str = get_file_content(html_path);
+    str = cache_get(html_path);
     if (!str) {
-        /* build blog cache */
-        build_blog_cache(id);
-        str = get_file_content(html_path);
-        if (!str)
+        /* pages are rendered on the task loop, never inline. */
+        if (!render_blog_async(id))
             return HTTP_INTERNAL_ERROR;
+        if (client_wait(c, html_path))
+            return HTTP_OK; /* parked until rendered */
+        str = cache_get(html_path);
+    }
+    if (!str) {
+        resp_add_header(resp, "\r\nRetry-After: ", "1");
+        return HTTP_UNAVAILABLE;
+    }
+    if (!serve_cached(c, html_path, str)) {
+        content_free(str);
+        return HTTP_OK; /* parked until rendered */
     }
-    str_head= get_file_content("./tmpl/blogs_header.html");
+
+    /* the response takes its own references, ours go at the end. */
+    enum http_status status = HTTP_INTERNAL_ERROR;
+    if (content_is_null(str)) {
+        status = HTTP_NOT_FOUND;
+        goto out;
+    }
+
+    str_head= get_fragment("./tmpl/blogs_header.html");
     if (!str_head)
-        return HTTP_INTERNAL_ERROR;
+        goto out;
 
-    str_foot = get_file_content("./tmpl/blogs_footer.html");
+    str_foot = get_fragment("./tmpl/blogs_footer.html");
     if (!str_foot)
-        return HTTP_INTERNAL_ERROR;
+        goto out;
     
     resp->mime_type = "text/html";
-    resp->head_sbuf = strbuf_new_static(str_head->value, str_head->len);
-    resp->sbuf = strbuf_new_static(str->value, str->len);
-    resp->foot_sbuf = strbuf_new_static(str_foot->value, str_foot->len);
-    //strbuf_set_static(resp->head_sbuf, str_head->value, str_head->len);
-    //strbuf_set_static(resp->sbuf, str->value, str->len);
-    //strbuf_set_static(resp->foot_sbuf, str_foot->value, str_foot->len);
-    return HTTP_OK;
+    if (resp_add_content(resp, str_head)
+            && resp_add_content(resp, str)
+            && resp_add_content(resp, str_foot))
+        status = HTTP_OK;
+
+out:
+    content_free(str_head);
+    content_free(str);
+    content_free(str_foot);
+    return status;
+}
+
+/* If-None-Match lists `etag`, or is "*". */
+static bool etag_matches(const char *if_none_match, const char *etag)
+{
+    return !strcmp(if_none_match, "*") || strstr(if_none_match, etag);
 }
 
 /* root handler */
-enum http_status static_files(void *data) {
-    if (!data)
+#ifdef HAVE_BUNDLE
+/*
+ * the bundled copy of a file missing on disk. clients taking gzip get the
+ * bundled bytes as they are, others a copy inflated once and cached.
+ */
+static enum http_status bundle_files(struct client *c, const char *filepath)
+{
+    struct http_request *req = &c->req;
+    struct http_response *resp = &c->resp;
+    char name[1024];
+
+    snprintf(name, sizeof(name), "www/%s", filepath);
+    const struct bundle_asset *a = bundle_find(name);
+    if (!a)
+        return HTTP_NOT_FOUND;
+    const char *base = strrchr(filepath, '/');
+    resp->mime_type = file_mime_type(base ? base + 1 : filepath);
+
+    const char *if_none_match = req_header(req, HEADER_IF_NONE_MATCH);
+    if (if_none_match && etag_matches(if_none_match, a->etag))
+        return HTTP_NOT_MODIFIED;
+
+    const char *since = req_header(req, HEADER_IF_MODIFIED_SINCE);
+    if (since) {
+        struct tm tmp;
+        memset(&tmp, 0, sizeof(tmp));
+        strptime(since, "%a, %d %b %Y %T %z", &tmp);
+        if (mktime(&tmp) >= a->mtime)
+            return HTTP_NOT_MODIFIED;
+    }
+
+    const char *encoding = req_header(req, HEADER_ACCEPT_ENCODING);
+    bool gzip = a->gzipped && encoding && strstr(encoding, "gzip");
+    if (!a->gzipped || gzip) {
+        if (!resp_add_buf(resp, (const char *)a->data, a->len, NULL))
+            return HTTP_INTERNAL_ERROR;
+    } else {
+        content_t *cont = bundle_content(a);
+        if (!cont)
+            return HTTP_INTERNAL_ERROR;
+        bool added = resp_add_content(resp, cont);
+        content_free(cont);
+        if (!added)
+            return HTTP_INTERNAL_ERROR;
+    }
+
+    if (gzip)
+        resp_add_header(resp, "\r\nContent-Encoding: ", "gzip");
+    if (a->gzipped)
+        resp_add_header(resp, "\r\nVary: ", "Accept-Encoding");
+    resp_add_header(resp, "\r\nLast-Modified: ", a->last_modified);
+    resp_add_header(resp, "\r\nETag: ", a->etag);
+    resp_add_header(resp, "\r\nCache-Control: ", "max-age=3600");
+    return HTTP_OK;
+}
+#else
+static enum http_status bundle_files(struct client *c, const char *filepath)
+{
+    (void)(c);
+    (void)(filepath);
+    return HTTP_NOT_FOUND;
+}
+#endif
+
+/*
+ * document root index. every servable file under cfg.dir, by its path
+ * relative to it, through a minimal perfect hash: a request for anything
+ * else is answered without touching the disk or the cache. the index is
+ * immutable, changes build a new one that replaces it.
+ */
+struct path_entry {
+    char *path;
+    off_t size;
+    time_t mtime;
+    const char *mime;
+    char etag[40];
+};
+
+struct path_index {
+    struct path_entry *entries; // in slot order
+    size_t n;
+    uint32_t *disp;
+    size_t ndisp;
+};
+
+static void path_index_free(struct path_index *idx)
+{
+    if (!idx)
+        return;
+    size_t i;
+    for (i = 0; i < idx->n; i++)
+        free(idx->entries[i].path);
+    free(idx->entries);
+    free(idx->disp);
+    free(idx);
+}
+
+static bool paths_add_dir(struct path_index *idx, size_t *alloc,
+        const char *dir, size_t root_len)
+{
+    DIR *d = opendir(dir);
+    if (!d)
+        return false;
+
+    struct dirent *ptr;
+    bool ok = true;
+    while (ok && (ptr = readdir(d)) != NULL) {
+        if (ptr->d_name[0] == '.')
+            continue;
+
+        char path[1024];
+        struct stat st;
+        snprintf(path, sizeof(path), "%s/%s", dir, ptr->d_name);
+        if (stat(path, &st) == -1)
+            continue;
+        if (S_ISDIR(st.st_mode)) {
+            ok = paths_add_dir(idx, alloc, path, root_len);
+            continue;
+        }
+        if (!S_ISREG(st.st_mode))
+            continue;
+
+        if (idx->n == *alloc) {
+            size_t n = *alloc ? *alloc * 2 : 64;
+            struct path_entry *entries = reallocarray(idx->entries, n, sizeof(*entries));
+            if (!entries) {
+                ok = false;
+                break;
+            }
+            idx->entries = entries;
+            *alloc = n;
+        }
+        struct path_entry *e = &idx->entries[idx->n];
+        if (!(e->path = strdup(path + root_len))) {
+            ok = false;
+            break;
+        }
+        e->size = st.st_size;
+        e->mtime = st.st_mtime;
+        e->mime = file_mime_type(ptr->d_name);
+        snprintf(e->etag, sizeof(e->etag), "\"%lx-%lx\"",
+                (unsigned long)st.st_mtime, (unsigned long)st.st_size);
+        idx->n++;
+    }
+
+    closedir(d);
+    return ok;
+}
+
+/* on failure, the index in use is kept. */
+void paths_rebuild(void)
+{
+    struct path_index *idx = calloc(1, sizeof(*idx));
+    const char **keys = NULL;
+    size_t *slots = NULL;
+    struct path_entry *entries = NULL;
+    size_t alloc = 0, i;
+
+    __atomic_store_n(&g_svr.paths_dirty, false, __ATOMIC_RELAXED);
+
+    bool ok = idx && paths_add_dir(idx, &alloc, g_svr.cfg.dir,
+            strlen(g_svr.cfg.dir) + 1);
+#ifdef HAVE_BUNDLE
+    /* no document root at all, the bundle serves the site. */
+    if (!ok && idx && !idx->n && bundle_nassets
+            && access(g_svr.cfg.dir, F_OK) == -1)
+        ok = true;
+#endif
+    if (!ok)
+        goto fail;
+
+    keys = malloc((idx->n + 1) * sizeof(*keys));
+    slots = malloc((idx->n + 1) * sizeof(*slots));
+    entries = malloc((idx->n + 1) * sizeof(*entries));
+    if (!keys || !slots || !entries)
+        goto fail;
+    for (i = 0; i < idx->n; i++)
+        keys[i] = idx->entries[i].path;
+    if (!phf_build(keys, idx->n, &idx->disp, &idx->ndisp, slots))
+        goto fail;
+    for (i = 0; i < idx->n; i++)
+        entries[slots[i]] = idx->entries[i];
+    free(idx->entries);
+    idx->entries = entries;
+    free(keys);
+    free(slots);
+
+    DBG("document root index: %zu files", idx->n);
+    pthread_rwlock_wrlock(&g_svr.paths_lock);
+    struct path_index *old = g_svr.paths;
+    g_svr.paths = idx;
+    pthread_rwlock_unlock(&g_svr.paths_lock);
+    path_index_free(old);
+    return;
+
+fail:
+    WARN("failed to index %s", g_svr.cfg.dir);
+    free(keys);
+    free(slots);
+    free(entries);
+    path_index_free(idx);
+}
+
+void paths_fini(void)
+{
+    path_index_free(g_svr.paths);
+    g_svr.paths = NULL;
+}
+
+/*
+ * false if `path` is not servable. `e` gets a copy of its metadata, with
+ * a size of -1 while there is no index; then everything is looked up.
+ */
+static bool paths_find(const char *path, struct path_entry *e)
+{
+    bool found = true;
+
+    e->size = -1;
+    e->mime = NULL;
+    pthread_rwlock_rdlock(&g_svr.paths_lock);
+    const struct path_index *idx = g_svr.paths;
+    if (idx) {
+        found = false;
+        if (idx->n) {
+            const struct path_entry *p = &idx->entries[phf_slot(idx->disp,
+                    idx->ndisp, idx->n, path, strlen(path))];
+            if (!strcmp(p->path, path)) {
+                *e = *p;
+                found = true;
+            }
+        }
+        e->path = NULL;
+    }
+    pthread_rwlock_unlock(&g_svr.paths_lock);
+
+    return found;
+}
+
+/*
+ * `path` of a request without the leading slash, empty and "." segments
+ * and repeated slashes; false if ".." would leave the root.
+ */
+static bool normalize_path(const char *path, char *out, size_t sz)
+{
+    size_t len = 0;
+
+    while (*path) {
+        while (*path == '/')
+            path++;
+        const char *end = strchrnul(path, '/');
+        size_t n = (size_t)(end - path);
+
+        if (n == 0 || (n == 1 && path[0] == '.')) {
+            /* nothing */
+        } else if (n == 2 && path[0] == '.' && path[1] == '.') {
+            if (!len)
+                return false;
+            while (len && out[len - 1] != '/')
+                len--;
+            if (len)
+                len--;
+        } else {
+            if (len + n + 2 > sz)
+                return false;
+            if (len)
+                out[len++] = '/';
+            memcpy(out + len, path, n);
+            len += n;
+        }
+        path = end;
+    }
+
+    out[len] = 0;
+    return true;
+}
+
+enum http_status static_files(void *data) {
+    if (!data)
         return HTTP_INTERNAL_ERROR;
     struct client *c = data;
     struct http_request *req = &c->req;
     struct http_response *resp = &c->resp;
 
     char *filepath = NULL;
+    char rel[1024];
 
     if (req->path[0] != '/')
         return HTTP_NOT_FOUND;
     
-    if (req->path[1] == 0)
-        filepath = "index.html";
-    else
-        filepath = req->path + 1;
+    if (req->path[1] == 0 && req_query_param(req, "page"))
+        return index_pages(data);
+
+    if (!normalize_path(req->path, rel, sizeof(rel)))
+        return HTTP_NOT_FOUND;
+    filepath = rel[0] ? rel : "index.html";
+
+    /* the index page is generated, it is not among the files. */
+    struct path_entry meta = { .size = -1 };
+    if (strcmp(filepath, "index.html") && !paths_find(filepath, &meta))
+        return bundle_files(c, filepath);
     
     char path[1024];
     snprintf(path, sizeof(path), "%s/%s", g_svr.cfg.dir, filepath);
-    resp->mime_type = file_mime_type(basename(filepath));
+    resp->mime_type = meta.mime ? meta.mime : file_mime_type(basename(filepath));
 
-    content_t *str = get_file_content(path);
-    if (!str)
-        return HTTP_NOT_FOUND;
-    
+    /*
+     * files too large for the cache are sent from disk. the body is set
+     * first, it is dropped again for anything but a 200.
+     */
+    struct stat st;
+    if (!cache_contains(path) && (meta.size >= 0 ? meta.size > CACHE_FILE_MAX
+                : stat(path, &st) == 0 && S_ISREG(st.st_mode)
+                    && st.st_size > CACHE_FILE_MAX)) {
+        int fd = open(path, O_RDONLY | O_CLOEXEC);
+        if (fd < 0)
+            return HTTP_NOT_FOUND;
+        if (fstat(fd, &st) == -1 || !resp_add_file(resp, fd, 0, (size_t)st.st_size)) {
+            close(fd);
+            return HTTP_INTERNAL_ERROR;
+        }
+    } else {
+        /* one miss reads the file, the others wait for it. */
+        bool loader = false;
+        if (!cache_contains(path)) {
+            loader = cache_claim(path);
+            if (!loader && client_wait(c, path))
+                return HTTP_OK;
+            if (loader && read_file_async(c, path))
+                return HTTP_OK; /* parked until read */
+        }
+        content_t *str = get_file_content(path);
+        /* also when the file was published by someone else meanwhile. */
+        if (loader)
+            cache_wake(path);
+        if (!str)
+            return bundle_files(c, filepath);
+        if (!serve_cached(c, path, str)) {
+            content_free(str);
+            return HTTP_OK; /* parked until reloaded */
+        }
+        st.st_mtime = str->mtime;
+        bool added = resp_add_content(resp, str);
+        content_free(str);
+        if (!added)
+            return HTTP_INTERNAL_ERROR;
+    }
+
+    /* the tag is only good for the file it was taken from. */
+    bool tagged = meta.size >= 0 && meta.mtime == st.st_mtime;
+    const char *if_none_match = req_header(req, HEADER_IF_NONE_MATCH);
+    if (tagged && if_none_match && etag_matches(if_none_match, meta.etag)) {
+        DBG("not modified: %s", path);
+        return HTTP_NOT_MODIFIED;
+    }
 
     char time_str[128];
     time_t t;
     struct tm tmp;
-    if (req->mtime) {
-        strptime(req->mtime, "%a, %d %b %Y %T %z", &tmp);
+    const char *since = req_header(req, HEADER_IF_MODIFIED_SINCE);
+    if (since) {
+        memset(&tmp, 0, sizeof(tmp));
+        strptime(since, "%a, %d %b %Y %T %z", &tmp);
         t = mktime(&tmp);
-        if (t >= str->mtime) {
+        if (t >= st.st_mtime) {
             DBG("not modified: %s", path);
             return HTTP_NOT_MODIFIED;
         }
     }
 
 
-    gmtime_r(&str->mtime, &tmp);
+    gmtime_r(&st.st_mtime, &tmp);
     if (strftime(time_str, sizeof(time_str), "%a, %d %b %Y %T %Z", &tmp) != 0) {
-        resp->curr_header = 0;
-        resp->headers[resp->curr_header].key = strdup("\r\nLast-Modified: ");
-        resp->headers[resp->curr_header].value = strdup(time_str);
-        resp->headers_sz++;
-        
-        resp->curr_header++;
-        resp->headers[resp->curr_header].key = strdup("\r\nCache-Control: ");
-        resp->headers[resp->curr_header].value = strdup("max-age=3600");
-        resp->headers_sz++;
+        resp_add_header(resp, "\r\nLast-Modified: ", time_str);
+        resp_add_header(resp, "\r\nCache-Control: ", "max-age=3600");
     }
+    if (tagged)
+        resp_add_header(resp, "\r\nETag: ", meta.etag);
     t = time(NULL);
     gmtime_r(&t, &tmp);
     if (strftime(time_str, sizeof(time_str), "%a, %d %b %Y %T %Z", &tmp) != 0) {
-        resp->curr_header++;
-        resp->headers[resp->curr_header].key = strdup("\r\nDate: ");
-        resp->headers[resp->curr_header].value = strdup(time_str);
-        resp->headers_sz++;
+        resp_add_header(resp, "\r\nDate: ", time_str);
     }
     
-
-    resp->sbuf = strbuf_new_static(str->value, str->len);
-    //strbuf_set_static(resp->sbuf, str->value, str->len);
-
-    
     return HTTP_OK;
 }
 
-/* scan resource dirs, generate etag and last modify info. */
-int refresh_resources(void) {
-    static time_t last_mtime = 0;
+/* render the index fragment of a blog. */
+static int build_blog_summary(struct blog *b)
+{
+    struct tmpl_value vals[BLOG_VARS];
+    char id[INT2STR_BUF_SZ], date[32];
+    size_t len;
 
-    struct stat st;
-    stat(g_svr.cfg.dir, &st);
-    if (st.st_mtime <= last_mtime) {
-        return 0;
+    blog_values(b, vals, id, date);
+    char *buf = tmpl_render(g_svr.tmpl_summary, vals, &len);
+    if (!buf)
+        return -1;
+
+    content_t *summary = content_new(buf, len, len + 1);
+    if (!summary) {
+        free(buf);
+        return -1;
     }
 
-    return 1;
+    if (b->summary)
+        content_free(b->summary);
+    b->summary = summary;
+    return 0;
 }
 
-/* scan the data dir and generate index page. */
-int refresh_index_page(void) {
-    int cmp_int(const void *a, const void *b) {
-        const int *pa = a, *pb = b;
-        return (*pa - *pb);
-    }
+/*
+ * the JSON api. /api/blogs?page=N lists the blogs of an index page,
+ * /api/blogs/N is one blog in full. responses are encoded once, with a
+ * gzipped copy, and cached until the blogs change; the listings are put
+ * together from an encoded summary kept with each blog.
+ */
+static void api_page_key(int page, char *key, size_t sz)
+{
+    snprintf(key, sz, "./data/api/blogs/page/%d.json", page);
+}
 
-    static time_t last_mtime = 0;
-    int sz = 0, cnt = 0;
-    int *ids = NULL, *tmp_ids = NULL;
+static void api_blog_key(int id, char *key, size_t sz)
+{
+    snprintf(key, sz, "./data/api/blogs/%d.json", id);
+}
 
+/* drop `key` and its gzipped copy, they are built again on request. */
+static void api_del(const char *key)
+{
+    char gz_key[1040];
+    snprintf(gz_key, sizeof(gz_key), "%s.gz", key);
+    cache_del(gz_key);
+    cache_del(key);
+}
 
-    struct stat st;
-    stat("./data/blogs/", &st);
-    if (st.st_mtime <= last_mtime) {
-        return 0;
-    }
+/* the members every view of a blog has. */
+static void blog_json_fields(struct jsonw *w, const struct blog *b)
+{
+    jsonw_key(w, "id", 2);
+    jsonw_uint(w, (size_t)b->info.id);
+    jsonw_key(w, "heading", 7);
+    jsonw_string(w, b->info.heading, 0);
+    jsonw_key(w, "sub_heading", 11);
+    jsonw_string(w, b->info.sub_heading, 0);
+    jsonw_key(w, "author", 6);
+    jsonw_string(w, b->info.author, 0);
+    jsonw_key(w, "author_link", 11);
+    jsonw_string(w, b->info.author_link, 0);
+    jsonw_key(w, "timestamp", 9);
+    jsonw_int(w, (ssize_t)b->info.timestamp);
+}
 
-    hash_free(g_svr.cache);
-    g_svr.cache = hash_str_new(free, content_free);
+/* the encoded api summary of a blog, spliced into the listings as is. */
+static int build_blog_json(struct blog *b)
+{
+    strbuf buf;
+    struct jsonw w;
 
-    DIR *dir = opendir("./data/blogs/");
-    if (!dir)
+    if (!strbuf_init(&buf))
         return -1;
+    jsonw_init(&w, &buf);
+    jsonw_object(&w);
+    blog_json_fields(&w, b);
+    jsonw_object_end(&w);
 
-    struct dirent *ptr;
-    while ((ptr = readdir(dir)) != NULL) {
-        if (ptr->d_name[0] == '.')
-            continue;
-        
-        int id = atoi(ptr->d_name);
-        if (id <= 0)
-            continue;
-        if (ids == NULL) {
-            sz = 32;
-            ids = calloc(32, sizeof(int));
-            if (!ids) {
-                WARN("malloc failed for refresh index page.");
-                closedir(dir);
-                return -1;
-            }
-        } 
-       
-        if (cnt >= sz) {
-            tmp_ids = realloc(ids, sz * 2 * sizeof(int));
-            if (!tmp_ids)
-                break;
-            sz *= 2;
-            ids = tmp_ids;
-        } 
-        ids[cnt++] = id;
+    content_t *json = jsonw_finish(&w) ? content_new(strbuf_get_buffer(&buf),
+            strbuf_get_length(&buf), buf.len.allocated) : NULL;
+    if (!json) {
+        free(strbuf_get_buffer(&buf));
+        return -1;
     }
 
-    closedir(dir);
+    if (b->json)
+        content_free(b->json);
+    b->json = json;
+    return 0;
+}
 
-    /* only refresh when the max id changed. */
-    if (cnt != 0) {
-        qsort(ids, cnt, sizeof(int), cmp_int);
+/* keep g_svr.blogs ordered newest (highest id) first. */
+static void blogs_insert_sorted(struct blog *b)
+{
+    struct blog *node;
+    list_for_each(g_svr.blogs, node, blogs) {
+        if (node->info.id < b->info.id) {
+            b->blogs.next = &node->blogs;
+            b->blogs.prev = node->blogs.prev;
+            node->blogs.prev->next = &b->blogs;
+            node->blogs.prev = &b->blogs;
+            return;
+        }
     }
+    list_add_tail(g_svr.blogs, &b->blogs);
+}
 
-    struct list_head *head = malloc(sizeof(*head));
-    list_head_init(head);
+/*
+ * list positions whose index page is out of date. edits only touch their
+ * own page, added or removed blogs shift every page after them.
+ */
+static int index_dirty_from = INT_MAX;
+static int index_dirty_to = -1;
 
-    struct blog *b;
-    int i;
-    for (i = 0; i < cnt; i++) {
-        b = calloc(1, sizeof(struct blog));
-        if (!b)
-            break;
-        if (build_blog(ids[i], b) != 0) {
-            free_blog_buf(b);
-            free(b);
-            continue;
+static void mark_index_dirty(int pos, bool shift)
+{
+    if (pos < index_dirty_from)
+        index_dirty_from = pos;
+    if (shift)
+        index_dirty_to = INT_MAX;
+    else if (pos > index_dirty_to)
+        index_dirty_to = pos;
+}
+
+static int blog_position(const struct blog *b)
+{
+    struct blog *node;
+    int pos = 0;
+    list_for_each(g_svr.blogs, node, blogs) {
+        if (node == b)
+            return pos;
+        pos++;
+    }
+    return pos;
+}
+
+/* (re)parse one blog; `b` is the known entry for `id`, if any. */
+static int update_blog(int id, struct blog *b, const struct stat *st)
+{
+    struct blog tmp;
+    memset(&tmp, 0, sizeof(tmp));
+    if (build_blog(id, &tmp) != 0 || build_blog_summary(&tmp) != 0
+            || build_blog_json(&tmp) != 0) {
+        free_blog_buf(&tmp);
+        return -1;
+    }
+    tmp.mtime = st->st_mtim;
+    tmp.size = st->st_size;
+
+    if (b) {
+        pthread_mutex_lock(&g_svr.mtx);
+        free_blog_buf(b);
+        b->info = tmp.info;
+        b->content = tmp.content;
+        b->src = tmp.src;
+        b->summary = tmp.summary;
+        b->json = tmp.json;
+        b->mtime = tmp.mtime;
+        b->size = tmp.size;
+        pthread_mutex_unlock(&g_svr.mtx);
+        mark_index_dirty(blog_position(b), false);
+    } else {
+        b = malloc(sizeof(*b));
+        if (!b) {
+            free_blog_buf(&tmp);
+            return -1;
         }
-        list_add(head, &b->blogs);
+        *b = tmp;
+        pthread_mutex_lock(&g_svr.mtx);
+        blogs_insert_sorted(b);
+        hash_add(g_svr.blog_ids, (void *)(intptr_t)id, b);
+        pthread_mutex_unlock(&g_svr.mtx);
+        mark_index_dirty(blog_position(b), true);
     }
-    free(ids);
 
-    last_mtime = st.st_mtime;
-    
+    /*
+     * republish the page; readers keep the old one until it is done. one
+     * restored from the snapshot of this very source is kept as it is.
+     */
+    char key[64];
+    snprintf(key, sizeof(key), "./data/blogs/%d.html", id);
+    if (!snapshot_current(key, st))
+        render_blog_async(id);
+
+    /* also when new, a request may have cached it as missing. */
+    api_blog_key(id, key, sizeof(key));
+    api_del(key);
+
+    const char *texts[] = { b->info.heading, b->info.sub_heading, b->content };
+    if (!search_add(g_svr.search, (uint32_t)id, texts, 3))
+        WARN("index blog %d failed.", id);
+    return 0;
+}
+
+static void remove_blog(struct blog *b)
+{
+    char html_path[64];
+    snprintf(html_path, sizeof(html_path), "./data/blogs/%d.html", b->info.id);
+
+    mark_index_dirty(blog_position(b), true);
+
     pthread_mutex_lock(&g_svr.mtx);
-    struct list_head *tmp = g_svr.blogs;
-    g_svr.blogs = head;
+    hash_del(g_svr.blog_ids, (void *)(intptr_t)b->info.id);
+    list_del(&b->blogs);
     pthread_mutex_unlock(&g_svr.mtx);
-    free_blogs_list(tmp);
 
+    cache_del(html_path);
+    api_blog_key(b->info.id, html_path, sizeof(html_path));
+    api_del(html_path);
+    search_remove(g_svr.search, (uint32_t)b->info.id);
+    free_blog_buf(b);
+    free(b);
+}
+
+static int index_page_count(void)
+{
+    int cnt = (int)hash_get_count(g_svr.blog_ids);
+    return cnt ? (cnt + g_svr.cfg.page_size - 1) / g_svr.cfg.page_size : 1;
+}
 
-    /* regenerate index.html */
-    struct blog *node, *next;
-    int buf_sz = 1024*cnt + 8196, len = 0;
-    
-    char *buf = malloc(buf_sz);
+static void index_page_key(int page, char *key, size_t sz)
+{
+    if (page == 1)
+        snprintf(key, sz, "%s/index.html", g_svr.cfg.dir);
+    else
+        snprintf(key, sz, "./data/blogs/page/%d.html", page);
+}
+
+/* the "Newer/Older Posts" links of one page. */
+static content_t *build_pager(int page, int pages)
+{
+    struct tmpl_value vals[PAGER_VARS];
+    char newer[32], older[32];
+    size_t len;
+
+    memset(vals, 0, sizeof(vals));
+    if (page == 2) {
+        vals[PAGER_NEWER].str = "/";
+    } else if (page > 2) {
+        snprintf(newer, sizeof(newer), "/page/%d", page - 1);
+        vals[PAGER_NEWER].str = newer;
+    }
+    if (page < pages) {
+        snprintf(older, sizeof(older), "/page/%d", page + 1);
+        vals[PAGER_OLDER].str = older;
+    }
+
+    char *buf = tmpl_render(g_svr.tmpl_pager, vals, &len);
     if (!buf)
+        return NULL;
+
+    content_t *pager = content_new(buf, len, len + 1);
+    if (!pager)
+        free(buf);
+    return pager;
+}
+
+/*
+ * an index page is not copied together: it refers to the cached header,
+ * the summaries of its blogs, its pager and the footer, and is written
+ * out as one iovec per part. page 1 is index.html.
+ */
+static int build_index_page(int page)
+{
+    char key[1024];
+    index_page_key(page, key, sizeof(key));
+
+    int pages = index_page_count();
+    if (page < 1 || page > pages) {
+        content_t *null_cont = content_new(NULL, 0, 0);
+        if (null_cont)
+            cache_insert_copy(key, null_cont);
+        return HTTP_NOT_FOUND;
+    }
+
+    content_t *head = NULL, *foot = NULL, *pager = NULL;
+    content_t *index_str = content_new(NULL, 0, 0);
+    if (!index_str)
+        return -1;
+    index_str->parts = malloc((g_svr.cfg.page_size + 3) * sizeof(content_t *));
+    if (!index_str->parts
+            || !(head = get_fragment("./tmpl/index_header.html"))
+            || !(foot = get_fragment("./tmpl/index_footer.html"))
+            || !(pager = build_pager(page, pages))) {
+        content_free(head);
+        content_free(foot);
+        content_free(index_str);
         return -1;
+    }
 
-    content_t *str;
-    str = get_file_content("./tmpl/index_header.html");
-    if (!str)
-        return HTTP_INTERNAL_ERROR;
+    /* the references to head, foot and pager move to the page. */
+    index_str->parts[index_str->nparts++] = head;
 
-    int nwrite;
-    nwrite = snprintf(buf, buf_sz, "%s", str->value);
-    len += nwrite;
-    
-    list_for_each_safe(g_svr.blogs, node, next, blogs) {
-        build_blog_cache(node->info.id);
-        int nwrite = snprintf(buf + len, buf_sz - len, tmpl_blog_info,
-                node->info.id, node->info.heading, node->info.sub_heading,
-                node->info.author_link, node->info.author,
-                ctime(&node->info.timestamp) );
-        len += nwrite;
-        if (buf_sz - len < 1024) {
-            buf_sz += 4096;
-            buf = realloc(buf, buf_sz);
-        }
+    struct blog *node;
+    int pos = 0, cnt = 0;
+    list_for_each(g_svr.blogs, node, blogs) {
+        if (pos++ < (page - 1) * g_svr.cfg.page_size)
+            continue;
+        index_str->parts[index_str->nparts++] = content_ref(node->summary);
+        if (++cnt == g_svr.cfg.page_size)
+            break;
     }
 
-    str = get_file_content("./tmpl/index_footer.html");
-    if (!str)
-        return HTTP_INTERNAL_ERROR;
-    nwrite = snprintf(buf+len, buf_sz-len, "%s", str->value);
-    len += nwrite;
+    index_str->parts[index_str->nparts++] = pager;
+    index_str->parts[index_str->nparts++] = foot;
 
-    char path[1024];
-    snprintf(path, sizeof(path), "%s/index.html", g_svr.cfg.dir);
-    
-    content_t *index_str = content_new(buf, len, buf_sz);
-    hash_add(g_svr.cache, strdup(path), index_str);
-    return last_mtime;
+    size_t i;
+    for (i = 0; i < index_str->nparts; i++)
+        index_str->len += index_str->parts[i]->len;
+    index_str->mtime = time(NULL);
+
+    cache_insert_copy(key, index_str);
+    return 0;
+}
+
+/* `len` bytes of `buf`, gzipped into a content of their own. */
+static content_t *gzip_content(const char *buf, size_t len)
+{
+    z_stream zs;
+    int bits = 9;
+
+    /* a window past the input buys nothing, and costs its setting up. */
+    while (bits < 15 && ((size_t)1 << bits) < len)
+        bits++;
+    memset(&zs, 0, sizeof(zs));
+    if (deflateInit2(&zs, Z_DEFAULT_COMPRESSION, Z_DEFLATED, bits + 16,
+                bits > 9 ? bits - 7 : 2, Z_DEFAULT_STRATEGY) != Z_OK)
+        return NULL;
+
+    size_t sz = deflateBound(&zs, (uLong)len);
+    char *out = malloc(sz);
+    if (!out) {
+        deflateEnd(&zs);
+        return NULL;
+    }
+    zs.next_in = (Bytef *)buf;
+    zs.avail_in = (uInt)len;
+    zs.next_out = (Bytef *)out;
+    zs.avail_out = (uInt)sz;
+    int ret = deflate(&zs, Z_FINISH);
+    deflateEnd(&zs);
+
+    content_t *cont = ret == Z_STREAM_END
+        ? content_new(out, zs.total_out, sz) : NULL;
+    if (!cont)
+        free(out);
+    return cont;
+}
+
+/*
+ * publish the encoded `buf` under `key`, after its gzipped copy under
+ * `key`.gz: readers find both once the plain one is there. the ETag is
+ * the crc of the plain body, the same for both but for a suffix.
+ */
+static int api_publish(const char *key, strbuf *buf)
+{
+    char gz_key[1040];
+    size_t len = strbuf_get_length(buf);
+    unsigned long crc = crc32(0, (const Bytef *)strbuf_get_buffer(buf), (uInt)len);
+
+    content_t *cont = content_new(strbuf_get_buffer(buf), len, buf->len.allocated);
+    if (!cont) {
+        free(strbuf_get_buffer(buf));
+        return -1;
+    }
+    cont->mtime = time(NULL);
+    snprintf(cont->etag, sizeof(cont->etag), "\"%08lx\"", crc);
+
+    content_t *gz = gzip_content(cont->value, len);
+    if (gz) {
+        gz->mtime = cont->mtime;
+        snprintf(gz->etag, sizeof(gz->etag), "\"%08lx-gz\"", crc);
+        snprintf(gz_key, sizeof(gz_key), "%s.gz", key);
+        cache_insert_copy(gz_key, gz);
+    }
+    return cache_insert_copy(key, cont) ? 0 : -1;
+}
+
+/* a page of the blog list, the encoded summaries of the index page. */
+static int build_api_page(int page)
+{
+    char key[1024];
+    api_page_key(page, key, sizeof(key));
+
+    int pages = index_page_count();
+    if (page < 1 || page > pages) {
+        content_t *null_cont = content_new(NULL, 0, 0);
+        if (null_cont)
+            cache_insert_copy(key, null_cont);
+        return HTTP_NOT_FOUND;
+    }
+
+    strbuf buf;
+    struct jsonw w;
+    if (!strbuf_init_with_size(&buf, 256 * (size_t)g_svr.cfg.page_size))
+        return -1;
+    jsonw_init(&w, &buf);
+    jsonw_object(&w);
+    jsonw_key(&w, "page", 4);
+    jsonw_uint(&w, (size_t)page);
+    jsonw_key(&w, "pages", 5);
+    jsonw_uint(&w, (size_t)pages);
+    jsonw_key(&w, "blogs", 5);
+    jsonw_array(&w);
+
+    struct blog *node;
+    int pos = 0, cnt = 0;
+    list_for_each(g_svr.blogs, node, blogs) {
+        if (pos++ < (page - 1) * g_svr.cfg.page_size)
+            continue;
+        jsonw_raw(&w, node->json->value, node->json->len);
+        if (++cnt == g_svr.cfg.page_size)
+            break;
+    }
+
+    jsonw_array_end(&w);
+    jsonw_object_end(&w);
+    if (!jsonw_finish(&w)) {
+        free(strbuf_get_buffer(&buf));
+        return -1;
+    }
+    return api_publish(key, &buf);
+}
+
+/* one blog in full. */
+static int build_api_blog(int id)
+{
+    char key[64];
+    api_blog_key(id, key, sizeof(key));
+
+    struct blog *b = hash_find(g_svr.blog_ids, (void *)(intptr_t)id);
+    if (!b) {
+        content_t *null_cont = content_new(NULL, 0, 0);
+        if (null_cont)
+            cache_insert_copy(key, null_cont);
+        return HTTP_NOT_FOUND;
+    }
+
+    strbuf buf;
+    struct jsonw w;
+    if (!strbuf_init_with_size(&buf, strlen(b->content) + 512))
+        return -1;
+    jsonw_init(&w, &buf);
+    jsonw_object(&w);
+    blog_json_fields(&w, b);
+    jsonw_key(&w, "content", 7);
+    jsonw_string(&w, b->content, 0);
+    jsonw_object_end(&w);
+    if (!jsonw_finish(&w)) {
+        free(strbuf_get_buffer(&buf));
+        return -1;
+    }
+    return api_publish(key, &buf);
 }
 
+/*
+ * search results, by normalized query. they are all dropped when the
+ * index changes, or when there are SEARCH_CACHED of them, so odd queries
+ * cannot fill the cache.
+ */
+#define SEARCH_KEY_PREFIX "./data/api/search/"
+#define SEARCH_CACHED 1024
+#define SEARCH_RESULTS 20
+
+static unsigned int search_cached = 0;
+
+static void search_key(const char *query, char *key, size_t sz)
+{
+    snprintf(key, sz, SEARCH_KEY_PREFIX "%s.json", query);
+}
+
+static void search_flush(void)
+{
+    cache_del_prefix(SEARCH_KEY_PREFIX);
+    search_cached = 0;
+}
+
+/* the newest blogs that match, and how many do. */
+static int build_search(const char *key)
+{
+    char query[SEARCH_QUERY_MAX];
+    uint32_t ids[SEARCH_RESULTS];
+    size_t len = strlen(key) - strlen(SEARCH_KEY_PREFIX) - strlen(".json");
+
+    if (len >= sizeof(query))
+        return -1;
+    memcpy(query, key + strlen(SEARCH_KEY_PREFIX), len);
+    query[len] = '\0';
+
+    /* blogs removed but not yet committed would still be counted. */
+    if (search_commit(g_svr.search))
+        search_flush();
+    size_t total = search_run(g_svr.search, query, ids, SEARCH_RESULTS);
+    size_t n = total < SEARCH_RESULTS ? total : SEARCH_RESULTS, i;
+
+    strbuf buf;
+    struct jsonw w;
+    if (!strbuf_init_with_size(&buf, 256 * (n + 1)))
+        return -1;
+    jsonw_init(&w, &buf);
+    jsonw_object(&w);
+    jsonw_key(&w, "total", 5);
+    jsonw_uint(&w, total);
+    jsonw_key(&w, "blogs", 5);
+    jsonw_array(&w);
+    for (i = 0; i < n; i++) {
+        struct blog *b = hash_find(g_svr.blog_ids, (void *)(intptr_t)ids[i]);
+        if (b)
+            jsonw_raw(&w, b->json->value, b->json->len);
+    }
+    jsonw_array_end(&w);
+    jsonw_object_end(&w);
+    if (!jsonw_finish(&w)) {
+        free(strbuf_get_buffer(&buf));
+        return -1;
+    }
+
+    if (++search_cached > SEARCH_CACHED) {
+        search_flush();
+        search_cached = 1;
+    }
+    return api_publish(key, &buf);
+}
+
+/*
+ * bring the index pages, and search, in line with the blog list. the
+ * front page is always rebuilt, other out of date pages only when cached;
+ * the rest is built on first request. building a page only collects
+ * references, so it is done right here.
+ */
+static void refresh_index_pages(void)
+{
+    static int last_pages = 0;
+    int pages = index_page_count();
+    int page, from, to;
+    char key[1024];
+
+    /* the search results go with the index they came from. */
+    if (search_commit(g_svr.search))
+        search_flush();
+
+    if (index_dirty_from > index_dirty_to && pages == last_pages)
+        return;
+
+    from = index_dirty_from == INT_MAX ? pages + 1
+            : index_dirty_from / g_svr.cfg.page_size + 1;
+    to = index_dirty_to == INT_MAX ? pages
+            : index_dirty_to / g_svr.cfg.page_size + 1;
+    if (to > pages)
+        to = pages;
+
+    for (page = from; page <= to; page++) {
+        index_page_key(page, key, sizeof(key));
+        if (page == 1 || cache_contains(key))
+            build_index_page(page);
+        api_page_key(page, key, sizeof(key));
+        api_del(key);
+    }
+
+    /* pages past the end are gone. */
+    for (page = pages + 1; page <= last_pages; page++) {
+        index_page_key(page, key, sizeof(key));
+        cache_del(key);
+        api_page_key(page, key, sizeof(key));
+        api_del(key);
+    }
+
+    last_pages = pages;
+    index_dirty_from = INT_MAX;
+    index_dirty_to = -1;
+}
+
+/* /page/N and /?page=N */
+enum http_status index_pages(void *data) {
+    if (!data)
+        return HTTP_INTERNAL_ERROR;
+    struct client *c = data;
+    struct http_request *req = &c->req;
+    struct http_response *resp = &c->resp;
+
+    int page = 0;
+    const struct route_param *param = route_param(&req->route, "n");
+    const kv_t *query;
+    if (param)
+        page = slice_int(param->value, param->len);
+    else if ((query = req_query_param(req, "page")))
+        page = slice_int(query->value, query->value_len);
+
+    pthread_mutex_lock(&g_svr.mtx);
+    int pages = index_page_count();
+    pthread_mutex_unlock(&g_svr.mtx);
+    if (page < 1 || page > pages)
+        return HTTP_NOT_FOUND;
+
+    char key[1024];
+    index_page_key(page, key, sizeof(key));
+    content_t *str = cache_get(key);
+    if (!str) {
+        if (!render_submit(key, build_index_page, page))
+            return HTTP_INTERNAL_ERROR;
+        if (client_wait(c, key))
+            return HTTP_OK; /* parked until built */
+        str = cache_get(key);
+    }
+    if (!str) {
+        resp_add_header(resp, "\r\nRetry-After: ", "1");
+        return HTTP_UNAVAILABLE;
+    }
+    if (!serve_cached(c, key, str)) {
+        content_free(str);
+        return HTTP_OK; /* parked until built */
+    }
+
+    enum http_status status = HTTP_NOT_FOUND;
+    if (!content_is_null(str)) {
+        resp->mime_type = "text/html";
+        status = resp_add_content(resp, str) ? HTTP_OK : HTTP_INTERNAL_ERROR;
+    }
+    content_free(str);
+    return status;
+}
+
+/* the api response cached under `key`, gzipped for clients that take it. */
+static content_t *api_lookup(struct client *c, const char *key, bool *gzip)
+{
+    const char *encoding = req_header(&c->req, HEADER_ACCEPT_ENCODING);
+    content_t *str = NULL;
+
+    *gzip = encoding && strstr(encoding, "gzip");
+    if (*gzip) {
+        char gz_key[1040];
+        snprintf(gz_key, sizeof(gz_key), "%s.gz", key);
+        str = cache_get(gz_key);
+        *gzip = str != NULL;
+    }
+    return str ? str : cache_get(key);
+}
+
+/* answer with `str`, the api response found under `key`, or NULL. */
+static enum http_status api_reply(struct client *c, const char *key,
+        content_t *str, bool gzip)
+{
+    struct http_response *resp = &c->resp;
+    const char *if_none_match = req_header(&c->req, HEADER_IF_NONE_MATCH);
+
+    if (!str) {
+        resp_add_header(resp, "\r\nRetry-After: ", "1");
+        return HTTP_UNAVAILABLE;
+    }
+    if (!serve_cached(c, key, str)) {
+        content_free(str);
+        return HTTP_OK; /* parked until built */
+    }
+
+    enum http_status status = HTTP_NOT_FOUND;
+    if (content_is_null(str))
+        goto out;
+
+    resp_add_header(resp, "\r\nETag: ", str->etag);
+    resp_add_header(resp, "\r\nVary: ", "Accept-Encoding");
+    resp_add_header(resp, "\r\nCache-Control: ", "no-cache");
+    if (if_none_match && etag_matches(if_none_match, str->etag)) {
+        status = HTTP_NOT_MODIFIED;
+        goto out;
+    }
+    if (gzip)
+        resp_add_header(resp, "\r\nContent-Encoding: ", "gzip");
+    resp->mime_type = "application/json";
+    status = resp_add_content(resp, str) ? HTTP_OK : HTTP_INTERNAL_ERROR;
+
+out:
+    content_free(str);
+    return status;
+}
+
+/* the api response under `key`, rendered by `build` on a miss. */
+static enum http_status api_serve(struct client *c, const char *key,
+        int (*build)(int id), int id)
+{
+    bool gzip;
+    content_t *str = api_lookup(c, key, &gzip);
+
+    if (!str) {
+        if (!render_submit(key, build, id))
+            return HTTP_INTERNAL_ERROR;
+        if (client_wait(c, key))
+            return HTTP_OK; /* parked until built */
+        /* published meanwhile, the gzipped copy with it. */
+        str = api_lookup(c, key, &gzip);
+    }
+    return api_reply(c, key, str, gzip);
+}
+
+/* /api/blogs and /api/blogs?page=N */
+enum http_status api_blogs(void *data) {
+    if (!data)
+        return HTTP_INTERNAL_ERROR;
+    struct client *c = data;
+    struct http_request *req = &c->req;
+
+    int page = 1;
+    const kv_t *query = req_query_param(req, "page");
+    if (query)
+        page = slice_int(query->value, query->value_len);
+
+    pthread_mutex_lock(&g_svr.mtx);
+    int pages = index_page_count();
+    pthread_mutex_unlock(&g_svr.mtx);
+    if (page < 1 || page > pages)
+        return HTTP_NOT_FOUND;
+
+    char key[1024];
+    api_page_key(page, key, sizeof(key));
+    return api_serve(c, key, build_api_page, page);
+}
+
+/* /api/blogs/N */
+enum http_status api_blog(void *data) {
+    if (!data)
+        return HTTP_INTERNAL_ERROR;
+    struct client *c = data;
+    struct http_request *req = &c->req;
+
+    const struct route_param *param = route_param(&req->route, "id");
+    int id = param ? slice_int(param->value, param->len) : 0;
+    if (id <= 0)
+        return HTTP_NOT_FOUND;
+
+    pthread_mutex_lock(&g_svr.mtx);
+    bool known = hash_find(g_svr.blog_ids, (void *)(intptr_t)id) != NULL;
+    pthread_mutex_unlock(&g_svr.mtx);
+    if (!known)
+        return HTTP_NOT_FOUND;
+
+    char key[64];
+    api_blog_key(id, key, sizeof(key));
+    return api_serve(c, key, build_api_blog, id);
+}
+
+/* /search?q=words "or a phrase", the blogs that have them all. */
+enum http_status search_blogs(void *data) {
+    if (!data)
+        return HTTP_INTERNAL_ERROR;
+    struct client *c = data;
+    struct http_request *req = &c->req;
+
+    char query[SEARCH_QUERY_MAX], key[sizeof(query) + 32];
+    const kv_t *q = req_query_param(req, "q");
+    if (!q || !search_normalize(q->value, q->value_len, query, sizeof(query)))
+        return HTTP_BAD_REQUEST;
+    search_key(query, key, sizeof(key));
+
+    bool gzip;
+    content_t *str = api_lookup(c, key, &gzip);
+    if (!str) {
+        if (!render_submit_key(key, build_search))
+            return HTTP_INTERNAL_ERROR;
+        if (client_wait(c, key))
+            return HTTP_OK; /* parked until built */
+        str = api_lookup(c, key, &gzip);
+    }
+    return api_reply(c, key, str, gzip);
+}
+
+/* /status, counters as text. */
+enum http_status status_page(void *data) {
+    if (!data)
+        return HTTP_INTERNAL_ERROR;
+    struct client *c = data;
+    struct http_response *resp = &c->resp;
+
+    unsigned int cached = chash_get_count(g_svr.cache);
+
+    char *buf = NULL;
+    int len = asprintf(&buf,
+            "cached: %u\n"
+            "served_stale: %llu\n",
+            cached,
+            (unsigned long long)__atomic_load_n(&g_svr.status.served_stale,
+                __ATOMIC_RELAXED));
+    if (len < 0)
+        return HTTP_INTERNAL_ERROR;
+
+    content_t *body = content_new(buf, (size_t)len, (size_t)len + 1);
+    if (!body) {
+        free(buf);
+        return HTTP_INTERNAL_ERROR;
+    }
+
+    resp->mime_type = "text/plain";
+    bool added = resp_add_content(resp, body);
+    content_free(body);
+    return added ? HTTP_OK : HTTP_INTERNAL_ERROR;
+}
+
+/* /status.json, the same counters for scripts. */
+enum http_status status_json(void *data) {
+    if (!data)
+        return HTTP_INTERNAL_ERROR;
+    struct client *c = data;
+    struct http_response *resp = &c->resp;
+
+    strbuf buf;
+    if (!strbuf_init(&buf))
+        return HTTP_INTERNAL_ERROR;
+
+    struct jsonw w;
+    jsonw_init(&w, &buf);
+    jsonw_object(&w);
+    jsonw_key(&w, "cached", 0);
+    jsonw_uint(&w, chash_get_count(g_svr.cache));
+    jsonw_key(&w, "served_stale", 0);
+    jsonw_uint(&w, (size_t)__atomic_load_n(&g_svr.status.served_stale,
+                __ATOMIC_RELAXED));
+    jsonw_object_end(&w);
+    if (!jsonw_finish(&w)) {
+        free(strbuf_get_buffer(&buf));
+        return HTTP_INTERNAL_ERROR;
+    }
+
+    content_t *body = content_new(strbuf_get_buffer(&buf),
+            strbuf_get_length(&buf), buf.len.allocated);
+    if (!body) {
+        free(strbuf_get_buffer(&buf));
+        return HTTP_INTERNAL_ERROR;
+    }
+
+    resp->mime_type = "application/json";
+    bool added = resp_add_content(resp, body);
+    content_free(body);
+    return added ? HTTP_OK : HTTP_INTERNAL_ERROR;
+}
+
+static unsigned int blog_scan = 0;
+
+/* pick up a change of ./data/blogs/<id>, returns 1 if the blogs changed. */
+static int refresh_blog(long id)
+{
+    char path[1024];
+    struct stat st;
+    snprintf(path, sizeof(path), "./data/blogs/%ld", id);
+
+    struct blog *b = hash_find(g_svr.blog_ids, (void *)(intptr_t)id);
+    if (stat(path, &st) == -1) {
+        if (!b)
+            return 0;
+        remove_blog(b);
+        return 1;
+    }
+
+    if (b) {
+        b->scan = blog_scan;
+        if (b->size == st.st_size
+                && b->mtime.tv_sec == st.st_mtim.tv_sec
+                && b->mtime.tv_nsec == st.st_mtim.tv_nsec)
+            return 0;
+    }
+
+    if (update_blog((int)id, b, &st) != 0) {
+        /* maybe half written, keep what we had and retry on next change. */
+        WARN("parse blog %ld failed.", id);
+        return 0;
+    }
+    if (!b) {
+        b = hash_find(g_svr.blog_ids, (void *)(intptr_t)id);
+        b->scan = blog_scan;
+    }
+    return 1;
+}
+
+static long blog_id_from_name(const char *name)
+{
+    char *end;
+    long id = strtol(name, &end, 10);
+    if (*end || id <= 0 || id > INT_MAX)
+        return 0;
+    return id;
+}
+
+/*
+ * scan the data dir and regenerate the index page. only new or changed
+ * blogs (by mtime and size) are parsed again; runs on the task loop.
+ */
+int refresh_index_page(void) {
+    static bool built = false;
+    int changed = 0;
+
+    DIR *dir = opendir("./data/blogs/");
+    if (!dir)
+        return -1;
+
+    blog_scan++;
+
+    struct dirent *ptr;
+    while ((ptr = readdir(dir)) != NULL) {
+        if (ptr->d_name[0] == '.')
+            continue;
+        
+        long id = blog_id_from_name(ptr->d_name);
+        if (id)
+            changed += refresh_blog(id);
+    }
+
+    closedir(dir);
+
+    struct blog *node, *next;
+    list_for_each_safe(g_svr.blogs, node, next, blogs) {
+        if (node->scan != blog_scan) {
+            remove_blog(node);
+            changed++;
+        }
+    }
+
+    if (!built) {
+        mark_index_dirty(0, true);
+        built = true;
+    }
+    refresh_index_pages();
+
+    return changed;
+}
+
+/*
+ * reload `path` if it is cached, a gone file is dropped. the old content
+ * is served until the new one replaces it.
+ */
+static void cache_refresh(const char *path)
+{
+    if (!cache_contains(path))
+        return;
+
+    cache_mark_stale(path);
+    /* held until replaced, for readers past max_stale to wait on. */
+    cache_claim(path);
+    content_t *cont = load_file(path);
+    if (cont)
+        cache_insert_copy(path, cont);
+    else
+        cache_del(path);
+}
+
+/* copies of the cached keys under `prefix`, except `skip`; NULL if none. */
+static char **cache_keys(const char *prefix, const char *skip, size_t *cnt)
+{
+    size_t len = strlen(prefix), alloc = 0;
+    struct hash_iter iter;
+    const void *key;
+    char **keys = NULL;
+    unsigned i;
+
+    *cnt = 0;
+    for (i = 0; i < chash_nshards(g_svr.cache); i++) {
+        hash_iter_init(chash_lock_shard(g_svr.cache, i, false), &iter);
+        while (hash_iter_next(&iter, &key, NULL)) {
+            if (strncmp(key, prefix, len) || !strcmp(key, skip))
+                continue;
+            if (*cnt == alloc) {
+                size_t n = alloc ? alloc * 2 : 64;
+                char **k = reallocarray(keys, n, sizeof(*k));
+                if (!k)
+                    break;
+                keys = k;
+                alloc = n;
+            }
+            if ((keys[*cnt] = strdup(key)))
+                (*cnt)++;
+        }
+        chash_unlock_shard(g_svr.cache, i);
+    }
+    return keys;
+}
+
+/* cache_refresh() every cached file under `prefix`, except `skip`. */
+static void cache_refresh_prefix(const char *prefix, const char *skip)
+{
+    size_t cnt;
+    char **keys = cache_keys(prefix, skip, &cnt);
+
+    /* all are out of date at once, then replaced one by one. */
+    size_t i;
+    for (i = 0; i < cnt; i++)
+        cache_mark_stale(keys[i]);
+    for (i = 0; i < cnt; i++) {
+        cache_refresh(keys[i]);
+        free(keys[i]);
+    }
+    free(keys);
+}
+
+static void cache_del_prefix(const char *prefix)
+{
+    size_t cnt;
+    char **keys = cache_keys(prefix, "", &cnt);
+
+    while (cnt--) {
+        cache_del(keys[cnt]);
+        free(keys[cnt]);
+    }
+    free(keys);
+}
+
+/* a blog page is cached, or has been asked for. */
+static bool blog_page_cached(int id)
+{
+    char html_path[64];
+    snprintf(html_path, sizeof(html_path), "./data/blogs/%d.html", id);
+    return cache_contains(html_path);
+}
+
+static void on_template_change(const char *path, const char *name)
+{
+    struct blog *node;
+
+    if (!strcmp(path, TMPL_BLOG)) {
+        if (!load_template(&g_svr.tmpl_blog, TMPL_BLOG, blog_vars))
+            return;
+        list_for_each(g_svr.blogs, node, blogs) {
+            if (blog_page_cached(node->info.id))
+                render_blog_async(node->info.id);
+        }
+        return;
+    }
+
+    if (!strcmp(path, TMPL_SUMMARY)) {
+        if (!load_template(&g_svr.tmpl_summary, TMPL_SUMMARY, blog_vars))
+            return;
+        list_for_each(g_svr.blogs, node, blogs)
+            build_blog_summary(node);
+    } else if (!strcmp(path, TMPL_PAGER)) {
+        if (!load_template(&g_svr.tmpl_pager, TMPL_PAGER, pager_vars))
+            return;
+    } else {
+        cache_refresh(path);
+        if (strncmp(name, "index_", 6))
+            return;
+    }
+
+    mark_index_dirty(0, true);
+    refresh_index_pages();
+}
+
+static void on_file_change(const char *path, int flags)
+{
+    static const char blogs_dir[] = "./data/blogs/";
+    static const char tmpl_dir[] = "./tmpl/";
+
+    /* the index page is generated, never read from disk. */
+    char index_path[1024];
+    snprintf(index_path, sizeof(index_path), "%s/index.html", g_svr.cfg.dir);
+
+    if (!path) {
+        /* events were lost, reload everything, serving the old meanwhile. */
+        WARN("file change events lost, rescanning.");
+        paths_rebuild();
+        cache_refresh_prefix(g_svr.cfg.dir, index_path);
+        cache_refresh_prefix(tmpl_dir, "");
+        on_template_change(TMPL_BLOG, "blog.html");
+        on_template_change(TMPL_SUMMARY, "blog_summary.html");
+        on_template_change(TMPL_PAGER, "pager.html");
+        refresh_index_page();
+        mark_index_dirty(0, true);
+        refresh_index_pages();
+        return;
+    }
+
+    DBG("changed: %s", path);
+
+    if (!strncmp(path, blogs_dir, sizeof(blogs_dir) - 1)) {
+        long id = blog_id_from_name(path + sizeof(blogs_dir) - 1);
+        if (id && refresh_blog(id))
+            refresh_index_pages();
+        return;
+    }
+
+    if (!strncmp(path, tmpl_dir, sizeof(tmpl_dir) - 1)) {
+        on_template_change(path, path + sizeof(tmpl_dir) - 1);
+        return;
+    }
+
+    /* events come in bursts, the index is rebuilt once after. */
+    __atomic_store_n(&g_svr.paths_dirty, true, __ATOMIC_RELAXED);
+
+    if (flags & WATCH_IS_DIR) {
+        char prefix[1024];
+        snprintf(prefix, sizeof(prefix), "%s/", path);
+        cache_del_prefix(prefix);
+        return;
+    }
+
+    if (!strcmp(path, index_path))
+        return;
+
+    cache_refresh(path);
+}
+
+static int paths_cron(struct aeEventLoop *loop, long long id, void *data)
+{
+    (void)(loop);
+    (void)(id);
+    (void)(data);
+
+    if (__atomic_load_n(&g_svr.paths_dirty, __ATOMIC_RELAXED))
+        paths_rebuild();
+    return 100;
+}
+
+/* watch the document root, blogs and templates from the task loop. */
+bool watch_resources(aeEventLoop *loop)
+{
+    if (!watcher_init(&g_svr.watcher, on_file_change))
+        return false;
+
+    if (!watcher_add(&g_svr.watcher, g_svr.cfg.dir)
+            || !watcher_add(&g_svr.watcher, "./data/blogs")
+            || !watcher_add(&g_svr.watcher, "./tmpl")
+            || !watcher_attach(&g_svr.watcher, loop)) {
+        watcher_destroy(&g_svr.watcher);
+        return false;
+    }
+    if (aeCreateTimeEvent(loop, 100, paths_cron, NULL, NULL) == AE_ERR)
+        WARN("document root index will not follow changes.");
+
+    g_svr.watching = true;
+    return true;
+}
+
+/*
+ * warm up. before accepting, io_thrd_nr threads load what the previous
+ * run served most, then the rest of the document root and templates, and
+ * render every blog page, until cfg.warm_budget bytes are cached.
+ */
+#define HOTNESS_PATH "./data/hotness"
+
+struct warm_item {
+    char *key;
+    int blog_id;    /* a blog page to render, 0 for a file */
+};
+
+static struct warm {
+    struct warm_item *items;
+    size_t nitems;
+    size_t alloc;
+    struct hash *listed;
+
+    size_t next;    /* atomic, the item to take next */
+    size_t bytes;   /* atomic */
+    size_t entries; /* atomic */
+    bool stop;      /* atomic, set on timeout */
+
+    pthread_mutex_t mtx;
+    pthread_cond_t cond;
+    int running;
+} warm;
+
+static void warm_add(const char *key, int blog_id)
+{
+    if (hash_find(warm.listed, key))
+        return;
+
+    if (warm.nitems == warm.alloc) {
+        size_t n = warm.alloc ? warm.alloc * 2 : 256;
+        struct warm_item *items = reallocarray(warm.items, n, sizeof(*items));
+        if (!items)
+            return;
+        warm.items = items;
+        warm.alloc = n;
+    }
+
+    char *k = strdup(key);
+    if (!k)
+        return;
+    warm.items[warm.nitems].key = k;
+    warm.items[warm.nitems].blog_id = blog_id;
+    warm.nitems++;
+    hash_add(warm.listed, k, k);
+}
+
+static void warm_add_dir(const char *dir)
+{
+    DIR *d = opendir(dir);
+    if (!d)
+        return;
+
+    char index_path[1024];
+    snprintf(index_path, sizeof(index_path), "%s/index.html", g_svr.cfg.dir);
+
+    struct dirent *ptr;
+    while ((ptr = readdir(d)) != NULL) {
+        if (ptr->d_name[0] == '.')
+            continue;
+
+        char path[1024];
+        struct stat st;
+        snprintf(path, sizeof(path), "%s/%s", dir, ptr->d_name);
+        if (stat(path, &st) == -1)
+            continue;
+        if (S_ISDIR(st.st_mode))
+            warm_add_dir(path);
+        else if (S_ISREG(st.st_mode) && strcmp(path, index_path))
+            warm_add(path, 0);
+    }
+
+    closedir(d);
+}
+
+/* the keys served most by the previous run, hottest first. */
+static void warm_add_hotness(void)
+{
+    FILE *f = fopen(HOTNESS_PATH, "r");
+    if (!f)
+        return;
+
+    char line[1024];
+    while (fgets(line, sizeof(line), f)) {
+        line[strcspn(line, "\n")] = 0;
+
+        int id, n = 0;
+        if (sscanf(line, "./data/blogs/%d.html%n", &id, &n) == 1
+                && !line[n]) {
+            warm_add(line, id);
+        } else if (!strncmp(line, g_svr.cfg.dir, strlen(g_svr.cfg.dir))
+                || !strncmp(line, "./tmpl/", 7)) {
+            warm_add(line, 0);
+        }
+    }
+
+    fclose(f);
+}
+
+/* count `len` more bytes, false if that is over the budget. */
+static bool warm_reserve(size_t len)
+{
+    size_t bytes = __atomic_add_fetch(&warm.bytes, len, __ATOMIC_RELAXED);
+    if (bytes <= g_svr.cfg.warm_budget)
+        return true;
+
+    __atomic_sub_fetch(&warm.bytes, len, __ATOMIC_RELAXED);
+    return false;
+}
+
+static void warm_one(const struct warm_item *item)
+{
+    if (cache_contains(item->key))
+        return;
+
+    if (item->blog_id) {
+        /* the size is known after rendering only. */
+        if (__atomic_load_n(&warm.bytes, __ATOMIC_RELAXED) >= g_svr.cfg.warm_budget
+                || build_blog_cache(item->blog_id) != 0)
+            return;
+        content_t *cont = cache_get(item->key);
+        if (cont) {
+            __atomic_add_fetch(&warm.bytes, cont->len, __ATOMIC_RELAXED);
+            __atomic_add_fetch(&warm.entries, 1, __ATOMIC_RELAXED);
+            content_free(cont);
+        }
+        return;
+    }
+
+    struct stat st;
+    if (stat(item->key, &st) == -1 || !S_ISREG(st.st_mode)
+            || st.st_size > CACHE_FILE_MAX || !warm_reserve((size_t)st.st_size))
+        return;
+
+    content_t *cont = load_file(item->key);
+    if (!cont) {
+        __atomic_sub_fetch(&warm.bytes, (size_t)st.st_size, __ATOMIC_RELAXED);
+        return;
+    }
+    char *key = strdup(item->key);
+    if (!key) {
+        __atomic_sub_fetch(&warm.bytes, (size_t)st.st_size, __ATOMIC_RELAXED);
+        content_free(cont);
+        return;
+    }
+    content_free(cache_insert_unique(key, cont));
+    __atomic_add_fetch(&warm.entries, 1, __ATOMIC_RELAXED);
+}
+
+static void *warm_thread(void *arg)
+{
+    (void)(arg);
+
+    while (!__atomic_load_n(&warm.stop, __ATOMIC_RELAXED)) {
+        size_t i = __atomic_fetch_add(&warm.next, 1, __ATOMIC_RELAXED);
+        if (i >= warm.nitems)
+            break;
+        warm_one(&warm.items[i]);
+    }
+
+    pthread_mutex_lock(&warm.mtx);
+    if (!--warm.running)
+        pthread_cond_signal(&warm.cond);
+    pthread_mutex_unlock(&warm.mtx);
+    return NULL;
+}
+
+/*
+ * returns false if the warm up timed out; the threads then stop after
+ * the item at hand, so nothing is left running as the server starts.
+ */
+bool warm_up(void)
+{
+    struct timespec start, end, deadline;
+    struct blog *node;
+    int i, page;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    warm.listed = hash_str_new(NULL, NULL);
+    if (!warm.listed)
+        return true;
+    warm_add_hotness();
+    warm_add_dir(g_svr.cfg.dir);
+    warm_add_dir("./tmpl");
+    list_for_each(g_svr.blogs, node, blogs) {
+        char key[64];
+        snprintf(key, sizeof(key), "./data/blogs/%d.html", node->info.id);
+        warm_add(key, node->info.id);
+    }
+    hash_free(warm.listed);
+    warm.listed = NULL;
+
+    pthread_mutex_init(&warm.mtx, NULL);
+    pthread_cond_init(&warm.cond, NULL);
+    for (i = 0; i < g_svr.cfg.io_thrd_nr; i++) {
+        pthread_t thrd;
+        pthread_mutex_lock(&warm.mtx);
+        if (pthread_create(&thrd, NULL, warm_thread, NULL) == 0) {
+            pthread_detach(thrd);
+            warm.running++;
+        }
+        pthread_mutex_unlock(&warm.mtx);
+    }
+
+    /* index pages only refer to cached parts, building them is cheap. */
+    for (page = 2; page <= index_page_count(); page++)
+        build_index_page(page);
+
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += g_svr.cfg.warm_timeout;
+
+    bool done = true;
+    pthread_mutex_lock(&warm.mtx);
+    while (warm.running && done)
+        done = pthread_cond_timedwait(&warm.cond, &warm.mtx, &deadline) != ETIMEDOUT;
+    if (!done) {
+        __atomic_store_n(&warm.stop, true, __ATOMIC_RELAXED);
+        while (warm.running)
+            pthread_cond_wait(&warm.cond, &warm.mtx);
+    }
+    pthread_mutex_unlock(&warm.mtx);
+    pthread_mutex_destroy(&warm.mtx);
+    pthread_cond_destroy(&warm.cond);
+
+    size_t n;
+    for (n = 0; n < warm.nitems; n++)
+        free(warm.items[n].key);
+    free(warm.items);
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    printf("warm up: %zu entries, %zu bytes in %.3fs%s\n",
+            __atomic_load_n(&warm.entries, __ATOMIC_RELAXED),
+            __atomic_load_n(&warm.bytes, __ATOMIC_RELAXED),
+            (double)(end.tv_sec - start.tv_sec)
+                + (double)(end.tv_nsec - start.tv_nsec) / 1e9,
+            done ? "" : ", timed out");
+
+    return done;
+}
+
+struct hot_key {
+    char *key;
+    unsigned long hits;
+};
+
+static int compare_hot_key(const void *a, const void *b)
+{
+    const struct hot_key *h1 = a, *h2 = b;
+    return h1->hits < h2->hits ? 1 : h1->hits > h2->hits ? -1 : 0;
+}
+
+/* write the served keys, most hits first, for the next warm up. */
+void save_hotness(void)
+{
+    struct hash_iter iter;
+    const void *key;
+    const void *value;
+    struct hot_key *hot = NULL;
+    size_t cnt = 0, alloc = 0, i;
+    unsigned shard;
+
+    for (shard = 0; shard < chash_nshards(g_svr.cache); shard++) {
+        hash_iter_init(chash_lock_shard(g_svr.cache, shard, false), &iter);
+        while (hash_iter_next(&iter, &key, &value)) {
+            const content_t *cont = value;
+            unsigned long hits = __atomic_load_n(&cont->hits, __ATOMIC_RELAXED);
+            if (!hits || content_is_null(cont))
+                continue;
+            if (cnt == alloc) {
+                size_t n = alloc ? alloc * 2 : 64;
+                struct hot_key *h = reallocarray(hot, n, sizeof(*h));
+                if (!h)
+                    break;
+                hot = h;
+                alloc = n;
+            }
+            if ((hot[cnt].key = strdup(key))) {
+                hot[cnt].hits = hits;
+                cnt++;
+            }
+        }
+        chash_unlock_shard(g_svr.cache, shard);
+    }
+
+    qsort(hot, cnt, sizeof(*hot), compare_hot_key);
+
+    FILE *f = fopen(HOTNESS_PATH ".tmp", "w");
+    if (f) {
+        for (i = 0; i < cnt; i++)
+            fprintf(f, "%s\n", hot[i].key);
+        if (fclose(f) == 0)
+            rename(HOTNESS_PATH ".tmp", HOTNESS_PATH);
+    }
+
+    for (i = 0; i < cnt; i++)
+        free(hot[i].key);
+    free(hot);
+}
+
+/*
+ * snapshot. on exit the plain cached entries are dumped into one file,
+ * which the next start maps read only: the restored entries point into
+ * the map instead of being read and rendered again. each records the
+ * mtime its source had when dumped, and is dropped on first lookup if
+ * the source changed since.
+ *
+ * the layout is that of this build, the header tells it apart.
+ */
+#define SNAP_MAGIC "aesnap\0"
+#define SNAP_VERSION 1
+
+struct snap_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t entry_size;
+    uint64_t count;
+    struct timespec tmpl_mtime; // of TMPL_BLOG, the blog pages depend on it
+};
+
+struct snap_entry {
+    uint64_t key_off;   /* nul terminated */
+    uint64_t body_off;  /* nul terminated too */
+    uint64_t body_len;
+    int64_t mtime;
+    struct timespec src_mtime;
+    char etag[16];
+};
+
+/* the file `key` is made from; false if it is not worth a snapshot. */
+static bool snap_source(const char *key, char *src, size_t sz)
+{
+    int id, n = 0;
+    if (sscanf(key, "./data/blogs/%d.html%n", &id, &n) == 1 && !key[n]) {
+        snprintf(src, sz, "./data/blogs/%d", id);
+        return true;
+    }
+    /* index pages are composites, rebuilt on start anyway. */
+    if (!strncmp(key, "./data/", 7))
+        return false;
+    snprintf(src, sz, "%s", key);
+    return true;
+}
+
+static bool same_mtime(const struct timespec *a, const struct timespec *b)
+{
+    return a->tv_sec == b->tv_sec && a->tv_nsec == b->tv_nsec;
+}
+
+/* false if `cont`, restored under `key`, is outdated; it is dropped then. */
+static bool snapshot_verify(const char *key, content_t *cont)
+{
+    char src[1024];
+    struct stat st;
+
+    if (snap_source(key, src, sizeof(src)) && stat(src, &st) == 0
+            && same_mtime(&st.st_mtim, &cont->snap->src_mtime)) {
+        __atomic_store_n(&cont->unverified, false, __ATOMIC_RELEASE);
+        return true;
+    }
+
+    /* racing lookups may drop a fresh entry too, it is just loaded again. */
+    DBG("outdated in snapshot: %s", key);
+    cache_del(key);
+    return false;
+}
+
+/* whether the entry of `key` is restored, and made from the source `st`. */
+static bool snapshot_current(const char *key, const struct stat *st)
+{
+    content_t *cont = cache_get(key);
+    bool current = cont && cont->snap
+        && !__atomic_load_n(&cont->stale, __ATOMIC_RELAXED)
+        && same_mtime(&st->st_mtim, &cont->snap->src_mtime);
+    content_free(cont);
+    return current;
+}
+
+bool snapshot_load(const char *path)
+{
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return false;
+
+    struct stat st;
+    if (fstat(fd, &st) == -1 || (size_t)st.st_size < sizeof(struct snap_header)) {
+        close(fd);
+        return false;
+    }
+    size_t len = (size_t)st.st_size;
+    char *map = mmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+        return false;
+
+    const struct snap_header *hdr = (const struct snap_header *)map;
+    if (memcmp(hdr->magic, SNAP_MAGIC, sizeof(hdr->magic))
+            || hdr->version != SNAP_VERSION
+            || hdr->entry_size != sizeof(struct snap_entry)
+            || hdr->count > (len - sizeof(*hdr)) / sizeof(struct snap_entry)) {
+        WARN("%s: not a snapshot of this build", path);
+        munmap(map, len);
+        return false;
+    }
+
+    /* blog pages rendered with another template are not restored. */
+    bool blogs_ok = stat(TMPL_BLOG, &st) == 0
+        && same_mtime(&st.st_mtim, &hdr->tmpl_mtime);
+
+    const struct snap_entry *entries = (const struct snap_entry *)(hdr + 1);
+    size_t i, restored = 0;
+    for (i = 0; i < hdr->count; i++) {
+        const struct snap_entry *e = &entries[i];
+        if (e->key_off >= len || !memchr(map + e->key_off, 0, len - e->key_off)
+                || e->body_off >= len || e->body_len >= len - e->body_off
+                || map[e->body_off + e->body_len])
+            break;
+
+        const char *key = map + e->key_off;
+        if (!blogs_ok && !strncmp(key, "./data/blogs/", 13))
+            continue;
+
+        content_t *cont = content_new(map + e->body_off, e->body_len, e->body_len + 1);
+        char *k = strdup(key);
+        if (!cont || !k) {
+            free(cont);
+            free(k);
+            break;
+        }
+        cont->mtime = e->mtime;
+        cont->src_mtime = e->src_mtime;
+        memcpy(cont->etag, e->etag, sizeof(cont->etag));
+        cont->snap = e;
+        cont->unverified = true;
+        content_free(cache_insert_unique(k, cont));
+        restored++;
+    }
+
+    g_svr.snap_map = map;
+    g_svr.snap_len = len;
+    printf("snapshot: %zu entries restored from %s\n", restored, path);
+    return true;
+}
+
+/* after the cache is freed, nothing points into the map any more. */
+void snapshot_unmap(void)
+{
+    if (g_svr.snap_map)
+        munmap(g_svr.snap_map, g_svr.snap_len);
+    g_svr.snap_map = NULL;
+}
+
+struct snap_item {
+    char *key;
+    content_t *cont;    /* a reference */
+    struct timespec src_mtime;
+};
+
+bool snapshot_save(const char *path)
+{
+    struct snap_header hdr;
+    struct snap_item *items = NULL;
+    struct hash_iter iter;
+    const void *key;
+    const void *value;
+    struct stat st;
+    char src[1024], tmp_path[1024];
+    size_t cnt = 0, alloc = 0, i;
+    unsigned shard;
+
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, SNAP_MAGIC, sizeof(hdr.magic));
+    hdr.version = SNAP_VERSION;
+    hdr.entry_size = sizeof(struct snap_entry);
+    if (stat(TMPL_BLOG, &st) == 0)
+        hdr.tmpl_mtime = st.st_mtim;
+
+    for (shard = 0; shard < chash_nshards(g_svr.cache); shard++) {
+        hash_iter_init(chash_lock_shard(g_svr.cache, shard, false), &iter);
+        while (hash_iter_next(&iter, &key, &value)) {
+            content_t *cont = (content_t *)value;
+            /*
+             * saved with the source it was made from, not the one there
+             * now: a change not yet seen is caught on the next start.
+             */
+            if (!cont->value || cont->parts || cont->stale
+                    || (!cont->src_mtime.tv_sec && !cont->src_mtime.tv_nsec)
+                    || !snap_source(key, src, sizeof(src)))
+                continue;
+            if (cnt == alloc) {
+                size_t n = alloc ? alloc * 2 : 64;
+                struct snap_item *it = reallocarray(items, n, sizeof(*it));
+                if (!it)
+                    break;
+                items = it;
+                alloc = n;
+            }
+            if (!(items[cnt].key = strdup(key)))
+                continue;
+            items[cnt].cont = content_ref(cont);
+            items[cnt].src_mtime = cont->src_mtime;
+            cnt++;
+        }
+        chash_unlock_shard(g_svr.cache, shard);
+    }
+    hdr.count = cnt;
+
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+    FILE *f = fopen(tmp_path, "wb");
+    bool ok = f != NULL;
+
+    /* the entries, then their keys and bodies in the same order. */
+    uint64_t off = sizeof(hdr) + cnt * sizeof(struct snap_entry);
+    if (ok)
+        ok = fwrite(&hdr, sizeof(hdr), 1, f) == 1;
+    for (i = 0; ok && i < cnt; i++) {
+        struct snap_entry e;
+        memset(&e, 0, sizeof(e));
+        e.key_off = off;
+        off += strlen(items[i].key) + 1;
+        e.body_off = off;
+        e.body_len = items[i].cont->len;
+        off += items[i].cont->len + 1;
+        e.mtime = items[i].cont->mtime;
+        e.src_mtime = items[i].src_mtime;
+        memcpy(e.etag, items[i].cont->etag, sizeof(e.etag));
+        ok = fwrite(&e, sizeof(e), 1, f) == 1;
+    }
+    for (i = 0; ok && i < cnt; i++) {
+        ok = fwrite(items[i].key, strlen(items[i].key) + 1, 1, f) == 1
+            && (!items[i].cont->len
+                || fwrite(items[i].cont->value, items[i].cont->len, 1, f) == 1)
+            && fputc(0, f) != EOF;
+    }
+    for (i = 0; i < cnt; i++) {
+        free(items[i].key);
+        content_free(items[i].cont);
+    }
+    free(items);
+
+    if (f && fclose(f) != 0)
+        ok = false;
+    if (ok)
+        ok = rename(tmp_path, path) == 0;
+    if (!ok) {
+        WARN("failed to write snapshot %s", path);
+        unlink(tmp_path);
+    }
+    return ok;
+}
@@ -4,16 +4,22 @@
 
 #include <stdint.h>
 #include <pthread.h>
+#include <sys/types.h>
 #include <sys/uio.h>
 
 
 #include "strext.h"
-#include "trie.h"
+#include "router.h"
 #include "ae.h"
 #include "server.h"
 #include "http_parser.h"
 #include "hash.h"
 #include "list.h"
+#include "jobq.h"
+#include "iopool.h"
+#include "watch.h"
+#include "tmpl.h"
+#include "search.h"
 
 #if defined(DEBUG)
 #define DBG(fmt,...) do {printf("[DEBUG] " fmt "\n", ##__VA_ARGS__);} while(0)
@@ -55,8 +61,11 @@ enum http_handler_flag {
     HANDLER_CAN_REWRITE_URL = 1<<7,
     HANDLER_PARSE_COOKIES = 1<<8,
     HANDLER_DATA_IS_HASH_TABLE = 1<<9,
+    HANDLER_PARSE_IF_NONE_MATCH = 1<<10,
 
-    HANDLER_PARSE_MASK = 1<<0 | 1<<1 | 1<<2 | 1<<3 | 1<<4 | 1<<8    
+    HANDLER_PARSE_MASK = 1<<0 | 1<<1 | 1<<2 | 1<<3 | 1<<4 | 1<<8 | 1<<10,
+    /* those that need the request headers kept. */
+    HANDLER_PARSE_HEADERS = 1<<1 | 1<<2 | 1<<3 | 1<<8 | 1<<10
 };
 
 
@@ -74,7 +83,10 @@ enum http_request_flag {
     RESPONSE_SENT_HEADERS      = 1<<8,
     RESPONSE_CHUNKED_ENCODING  = 1<<9,
     RESPONSE_NO_CONTENT_LENGTH = 1<<10,
-    RESPONSE_URL_REWRITTEN     = 1<<11
+    RESPONSE_URL_REWRITTEN     = 1<<11,
+
+    REQUEST_PARSED_QUERY       = 1<<12,
+    REQUEST_PARSED_COOKIES     = 1<<13
 };
 
 enum http_connection_flag {
@@ -85,6 +97,7 @@ enum http_connection_flag {
     CONN_WRITE_EVENTS       = 1<<3,
     CONN_MUST_READ          = 1<<4,
     CONN_FLIP_FLAGS         = 1<<5,
+    CONN_WAITED             = 1<<6,
 };
 
 static inline int32_t string_as_int32(const char *s)
@@ -141,13 +154,33 @@ static kv_t *kv_new(char *key, size_t key_len, char *value, size_t value_len)
     return kv;
 }
 
+struct snap_entry;
+
 typedef struct content {
     char *value;
-    size_t len;     /* strlen of value */
+    size_t len;     /* strlen of value, or the total length of parts */
     size_t sz;      /* sizeof *value */
 
+    /* content served as the concatenation of other contents. */
+    struct content **parts;
+    size_t nparts;
+    int refcnt;
+    unsigned long hits; // times served, for the hotness list
+
+    /* when found out of date, 0 while current. the only field that
+     * changes after publishing, set once with an atomic store. */
+    time_t stale;
+
     time_t mtime;
     char etag[16];
+
+    /* the mtime of the source it was made from, as read; 0 if none. */
+    struct timespec src_mtime;
+
+    /* restored from the snapshot: value lies in its map, and the source
+     * is checked once, on first lookup. */
+    const struct snap_entry *snap;
+    bool unverified;
 } content_t;
 
 static content_t *content_new(char *value, size_t len, size_t sz) {
@@ -157,41 +190,104 @@ static content_t *content_new(char *value, size_t len, size_t sz) {
     cont->value = value;
     cont->len = len;
     cont->sz = sz;
+    cont->parts = NULL;
+    cont->nparts = 0;
+    cont->refcnt = 1;
+    cont->hits = 0;
+    cont->stale = 0;
     cont->mtime = 0;
     cont->etag[0] = 0;
+    cont->src_mtime.tv_sec = 0;
+    cont->src_mtime.tv_nsec = 0;
+    cont->snap = NULL;
+    cont->unverified = false;
     return cont;
 }
 
+static inline content_t *content_ref(content_t *cont) {
+    __atomic_add_fetch(&cont->refcnt, 1, __ATOMIC_RELAXED);
+    return cont;
+}
+
+/* drop a reference, the parts go with the last one. */
 static void content_free(void *s) {
     content_t *cont= s;
     if (!cont)
         return;
 
-    if (!cont->value)
+    if (__atomic_sub_fetch(&cont->refcnt, 1, __ATOMIC_ACQ_REL))
+        return;
+
+    size_t i;
+    for (i = 0; i < cont->nparts; i++)
+        content_free(cont->parts[i]);
+    free(cont->parts);
+
+    if (!cont->snap)
         free(cont->value);
 
     free(cont);
 }
 
+/* a cached miss. */
+static inline bool content_is_null(const content_t *cont) {
+    return !cont->value && !cont->parts;
+}
+
+
+/* request headers with a slot of their own, see header_classify(). */
+enum http_header {
+    HEADER_ACCEPT_ENCODING,
+    HEADER_AUTHORIZATION,
+    HEADER_CONNECTION,
+    HEADER_CONTENT_LENGTH,
+    HEADER_CONTENT_TYPE,
+    HEADER_COOKIE,
+    HEADER_HOST,
+    HEADER_IF_MODIFIED_SINCE,
+    HEADER_IF_NONE_MATCH,
+    HEADER_RANGE,
+    HEADER_REFERER,
+    HEADER_USER_AGENT,
+    HEADER_KNOWN,
+    HEADER_UNKNOWN = HEADER_KNOWN
+};
 
 struct http_request;
 #define MAX_HEADER_LINES 128
+#define MAX_QUERY_PARAMS 16
+#define MAX_COOKIES 16
+
+/* a piece of the response body. */
+struct resp_seg {
+    enum { SEG_BUF, SEG_FILE } type;
+    const char *buf;    /* SEG_BUF */
+    int fd;             /* SEG_FILE, closed with the response */
+    off_t off;
+    size_t len;
+    content_t *owner;   /* reference dropped with the response */
+};
+
 struct http_response {
     enum http_status status;
-    strbuf *sbuf; //static and main 
-    strbuf *head_sbuf;
-    strbuf *foot_sbuf;
     const char *mime_type;
-    size_t content_length;
+    size_t content_length; // sum of the segments
 
     kv_t headers[MAX_HEADER_LINES];
     int headers_sz;
     int curr_header;
 
     char *header;
-    int iovec_sz;
-    int curr_iov;
-    struct iovec *iovec_buf;
+    size_t header_len;
+
+    /* body, written after the header in order. */
+    struct resp_seg *segs;
+    int segs_sz;
+    int segs_alloc;
+
+    /* write position: segment -1 is the header. */
+    int curr_seg;
+    size_t seg_off;
     ssize_t total_written;
     
     struct client *parent_client;
@@ -203,15 +299,32 @@ struct http_request {
     http_parser *parser;
 
     char *path;
-    char *query;
-    char *mtime;        // If Modified Since
+    const char *query;  // into buf, not terminated
+    size_t query_len;
+    const char *body;   // into buf, with HANDLER_PARSE_POST_DATA
+    size_t body_len;
     struct url_map *um;
-
+    struct route_match route; // parameters point into path
+    enum http_request_flag flags;
+
+    /*
+     * slices of buf, kept only for routes whose flags need headers:
+     * known ones by enum http_header, their values terminated in place,
+     * the others in the order they came.
+     */
+    kv_t known_headers[HEADER_KNOWN];
     kv_t headers[MAX_HEADER_LINES];
     int headers_sz;
-    int curr_header;
+    kv_t field;         // a name waiting for its value
+    kv_t *curr_header;  // the value being parsed, NULL if dropped
     int last_was_value;
 
+    /* decoded in place on first use, see req_query_param(). */
+    kv_t query_params[MAX_QUERY_PARAMS];
+    int query_params_sz;
+    kv_t cookies[MAX_COOKIES];
+    int cookies_sz;
+
     struct client *parent_client;
 };
 
@@ -222,6 +335,9 @@ struct client {
     time_t ttl;
     
     aeEventLoop *loop;
+    struct thrd *thrd;
+    enum http_connection_flag flags;
+    struct list_node waiting; // on a flight, while parked
     
     struct http_request req;
     struct http_response resp;
@@ -233,6 +349,12 @@ struct cfg {
     uint8_t thrd_nr;
     char *dir;
     char *ip;
+    int page_size; // blogs per index page
+    int max_stale; // seconds an outdated entry may still be served
+    int io_thrd_nr; // threads reading files for the workers
+    size_t warm_budget; // bytes to preload before accepting, 0 for none
+    int warm_timeout; // seconds the preload may take
+    char *snapshot; // cache dump to restore on start, NULL for none
 };
 
 struct status {
@@ -240,15 +362,21 @@ struct status {
     
     uint64_t get_cnt;
     uint64_t post_cnt;
+
+    uint64_t served_stale; // hits on entries being rebuilt
     
 };
 
 struct thrd {
     aeEventLoop *loop;
     pthread_t self;
+    struct jobq jobs; // clients to resume on this loop
 };
 
 
+#define IOPOOL_MAX_QUEUED 1024 // reads waiting for an io thread
+#define CACHE_SHARDS 64 // locks the cache is split over
+
 struct server {
     int fd;
     int running;
@@ -259,13 +387,38 @@ struct server {
     /* runtime */
     http_parser_settings parser_settings;
 
-    struct trie url_map;
+    struct router *router; // built once from the url map, never changed
     pthread_mutex_t mtx;
     struct thrd *threads;
     
-    struct hash *cache; // key value cache.
+    struct chash *cache; // key value cache, sharded for the workers.
+    void *snap_map; // the snapshot restored, cache entries point into it
+    size_t snap_len;
+
+    struct jobq render_q; // render jobs, run on the task loop.
+    struct hash *rendering; // keys queued or being rendered.
+    pthread_mutex_t render_mtx;
+
+    struct hash *flights; // key -> clients waiting for it to be cached.
+    pthread_mutex_t flights_mtx;
+
+    struct iopool iopool; // blocking reads, off the worker loops.
+
+    struct path_index *paths; // the files under cfg.dir, rebuilt on change.
+    pthread_rwlock_t paths_lock;
+    bool paths_dirty;
+
+    struct watcher watcher; // change notifications, on the task loop.
+    bool watching;
 
-    struct list_head *blogs; // mainly for blog info.
+    /* compiled page templates, used on the task loop. */
+    struct tmpl *tmpl_blog;
+    struct tmpl *tmpl_summary;
+    struct tmpl *tmpl_pager;
+
+    struct list_head *blogs; // mainly for blog info, newest first.
+    struct hash *blog_ids; // id -> struct blog, guarded by mtx.
+    struct search_index *search; // the words of the blogs, on the task loop.
 };
 
 
@@ -273,28 +426,39 @@ struct url_map {
     enum http_status (*handler)(void *data);
     void *data;
     
-    const char *prefix;
-    size_t prefix_len;
+    const char *route;  // a router pattern: /blogs/:id, /*
+    uint64_t methods;   // ROUTE_METHOD(HTTP_*) mask, 0 for all
     enum http_handler_flag flags;
 };
 
 struct blog_info {
     int id;
     time_t timestamp;
-    char *heading;
-    char *sub_heading;
-    char *author;
-    char *author_link;
+    const char *heading;
+    const char *sub_heading;
+    const char *author;
+    const char *author_link;
 };
 
 struct blog {
     struct list_node blogs;
     struct blog_info info;
-    char *content;
+    const char *content;
+    char *src;  // the post's json, decoded in place; the strings point into it.
+
+    /* source file state, to tell edited posts apart. */
+    struct timespec mtime;
+    off_t size;
+    unsigned int scan;
+
+    /* rendered index fragment, and its api counterpart. */
+    content_t *summary;
+    content_t *json;
 };
 
 
 void http_set_url_map(struct server *svr, const struct url_map *map);
+void http_free_url_map(struct server *svr);
 void mime_tables_init(void);
 void mime_tables_shutdown(void);
 void free_blogs_list(struct list_head *head);
@@ -303,14 +467,59 @@ int req_url_cb(http_parser *parser, const char *at, size_t length);
 int req_header_field_cb(http_parser *parser, const char *at, size_t length);
 int req_header_value_cb(http_parser *parser, const char *at, size_t length);
 int req_headers_complete_cb(http_parser *parser);
+int req_body_cb(http_parser *parser, const char *at, size_t length);
+
+const kv_t *req_query_param(struct http_request *req, const char *key);
+const kv_t *req_cookie(struct http_request *req, const char *key);
+const kv_t *req_other_header(const struct http_request *req, const char *name);
+
+/* the value of a known header, or NULL. */
+static inline const char *req_header(const struct http_request *req,
+        enum http_header h)
+{
+    return req->known_headers[h].value;
+}
 
 void accept_proc(aeEventLoop *loop, int fd, void *data, int mask);
 int server_cron(struct aeEventLoop *loop, long long id, void *data);
 int task_cron(struct aeEventLoop *loop, long long id, void *data);
 void before_sleep(struct aeEventLoop *loop);
 
+bool resp_add_buf(struct http_response *resp, const char *buf, size_t len,
+        content_t *owner);
+bool resp_add_file(struct http_response *resp, int fd, off_t off, size_t len);
+bool resp_add_content(struct http_response *resp, content_t *cont);
+
+content_t *cache_get(const char *key);
+bool cache_contains(const char *key);
+void cache_insert(char *key, content_t *cont);
+content_t *cache_insert_unique(char *key, content_t *cont);
+void cache_del(const char *key);
+void cache_mark_stale(const char *key);
+bool cache_claim(const char *key);
+bool client_wait(struct client *c, const char *key);
+void cache_wake(const char *key);
+bool render_submit(const char *key, int (*render)(int id), int id);
+bool render_submit_key(const char *key, int (*render)(const char *key));
+
 enum http_status blogs(void *data);
 enum http_status static_files(void *data);
-
+enum http_status index_pages(void *data);
+enum http_status status_page(void *data);
+enum http_status status_json(void *data);
+enum http_status api_blogs(void *data);
+enum http_status api_blog(void *data);
+enum http_status search_blogs(void *data);
+
+void paths_rebuild(void);
+void paths_fini(void);
+bool snapshot_load(const char *path);
+bool snapshot_save(const char *path);
+void snapshot_unmap(void);
+bool warm_up(void);
+void save_hotness(void);
+bool templates_init(void);
+void templates_fini(void);
 int refresh_index_page(void);
+bool watch_resources(aeEventLoop *loop);
 
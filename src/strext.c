@@ -20,6 +20,7 @@
 #define _GNU_SOURCE
 #include <limits.h>
 #include <stdarg.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 
@@ -336,3 +337,50 @@ strbuf_reset_length(strbuf *s)
     return true;
 }
 
+char *uint_to_string(size_t value, char dst[INT2STR_BUF_SZ], size_t *len_out)
+{
+    /*
+     * Based on routine by A. Alexandrescu, licensed under CC0
+     * https://creativecommons.org/publicdomain/zero/1.0/legalcode
+     */
+    static const size_t length = INT2STR_BUF_SZ;
+    size_t next = length - 1;
+    static const char digits[201] =
+            "0001020304050607080910111213141516171819"
+            "2021222324252627282930313233343536373839"
+            "4041424344454647484950515253545556575859"
+            "6061626364656667686970717273747576777879"
+            "8081828384858687888990919293949596979899";
+    dst[next--] = '\0';
+    while (value >= 100) {
+        const uint32_t i = (uint32_t) ((value % 100) * 2);
+        value /= 100;
+        dst[next] = digits[i + 1];
+        dst[next - 1] = digits[i];
+        next -= 2;
+    }
+    // Handle last 1-2 digits
+    if (value < 10) {
+        dst[next] = (char) ('0' + (uint32_t) value);
+        *len_out = length - next - 1;
+        return dst + next;
+    }
+    uint32_t i = (uint32_t) value * 2;
+    dst[next] = digits[i + 1];
+    dst[next - 1] = digits[i];
+    *len_out = length - next;
+    return dst + next - 1;
+}
+
+char *int_to_string(ssize_t value, char dst[INT2STR_BUF_SZ], size_t *len_out)
+{
+    if (value < 0) {
+        char *p = uint_to_string((size_t) - value, dst, len_out);
+        *--p = '-';
+        ++*len_out;
+
+        return p;
+    }
+
+    return uint_to_string((size_t)value, dst, len_out);
+}
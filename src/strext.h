@@ -21,6 +21,7 @@
 
 #include <stdbool.h>
 #include <stdio.h>
+#include <sys/types.h>
 
 typedef struct {
     union {
@@ -56,3 +57,8 @@ bool strbuf_reset_length(strbuf *s);
 #define strbuf_get_length(s)	(((strbuf *)(s))->len.buffer)
 #define strbuf_get_buffer(s)	(((strbuf *)(s))->value.buffer)
 
+/* decimal digits of a size_t, and a sign. */
+#define INT2STR_BUF_SZ (3 * sizeof(size_t) + 1)
+
+char *uint_to_string(size_t value, char dst[INT2STR_BUF_SZ], size_t *len_out);
+char *int_to_string(ssize_t value, char dst[INT2STR_BUF_SZ], size_t *len_out);
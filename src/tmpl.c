@@ -0,0 +1,280 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "tmpl.h"
+
+enum seg_type {
+    SEG_LITERAL,
+    SEG_ESCAPED,
+    SEG_RAW,
+    SEG_SECTION,    /* skip to `end` when the value is empty */
+    SEG_END,
+};
+
+struct tmpl_seg {
+    enum seg_type type;
+    const char *str;
+    size_t len;
+    int var;
+    int end;
+};
+
+struct tmpl {
+    char *text;
+    struct tmpl_seg *segs;
+    int nsegs;
+};
+
+#define MAX_SECTION_DEPTH 16
+
+static int lookup_var(const char *const names[], const char *name, size_t len)
+{
+    int i;
+    for (i = 0; names[i]; i++) {
+        if (strlen(names[i]) == len && !memcmp(names[i], name, len))
+            return i;
+    }
+    return -1;
+}
+
+static struct tmpl_seg *add_seg(struct tmpl *t, int *alloc, enum seg_type type)
+{
+    if (t->nsegs == *alloc) {
+        int n = *alloc ? *alloc * 2 : 16;
+        struct tmpl_seg *segs = realloc(t->segs, n * sizeof(*segs));
+        if (!segs)
+            return NULL;
+        t->segs = segs;
+        *alloc = n;
+    }
+
+    struct tmpl_seg *seg = &t->segs[t->nsegs++];
+    memset(seg, 0, sizeof(*seg));
+    seg->type = type;
+    return seg;
+}
+
+struct tmpl *tmpl_compile(const char *text, size_t len, const char *const names[])
+{
+    struct tmpl *t = calloc(1, sizeof(*t));
+    if (!t)
+        return NULL;
+
+    t->text = strndup(text, len);
+    if (!t->text)
+        goto fail;
+
+    int alloc = 0, depth = 0;
+    int sections[MAX_SECTION_DEPTH];
+    const char *p = t->text, *end = t->text + len;
+    struct tmpl_seg *seg;
+
+    while (p < end) {
+        const char *open = memmem(p, (size_t)(end - p), "{{", 2);
+        if (!open)
+            open = end;
+
+        if (open > p) {
+            if (!(seg = add_seg(t, &alloc, SEG_LITERAL)))
+                goto fail;
+            seg->str = p;
+            seg->len = (size_t)(open - p);
+        }
+        if (open == end)
+            break;
+
+        bool raw = open + 2 < end && open[2] == '{';
+        const char *name = open + (raw ? 3 : 2);
+        const char *close = memmem(name, (size_t)(end - name),
+                raw ? "}}}" : "}}", raw ? 3 : 2);
+        if (!close)
+            goto fail;
+        p = close + (raw ? 3 : 2);
+
+        enum seg_type type = raw ? SEG_RAW : SEG_ESCAPED;
+        if (!raw && (*name == '#' || *name == '/')) {
+            type = *name == '#' ? SEG_SECTION : SEG_END;
+            name++;
+        }
+        while (name < close && *name == ' ')
+            name++;
+        const char *name_end = close;
+        while (name_end > name && name_end[-1] == ' ')
+            name_end--;
+
+        int var = lookup_var(names, name, (size_t)(name_end - name));
+        if (var < 0)
+            goto fail;
+
+        if (type == SEG_END) {
+            if (!depth || t->segs[sections[depth - 1]].var != var)
+                goto fail;
+            t->segs[sections[--depth]].end = t->nsegs;
+        } else if (type == SEG_SECTION) {
+            if (depth == MAX_SECTION_DEPTH)
+                goto fail;
+            sections[depth++] = t->nsegs;
+        }
+
+        if (!(seg = add_seg(t, &alloc, type)))
+            goto fail;
+        seg->var = var;
+    }
+
+    if (depth)
+        goto fail;
+
+    return t;
+
+fail:
+    tmpl_free(t);
+    return NULL;
+}
+
+struct tmpl *tmpl_compile_file(const char *path, const char *const names[])
+{
+    FILE *f = fopen(path, "rb");
+    if (!f)
+        return NULL;
+
+    fseek(f, 0, SEEK_END);
+    long fsize = ftell(f);
+    fseek(f, 0, SEEK_SET);
+
+    char *buf = malloc(fsize + 1);
+    if (!buf || fread(buf, 1, fsize, f) != (size_t)fsize) {
+        free(buf);
+        fclose(f);
+        return NULL;
+    }
+    fclose(f);
+
+    struct tmpl *t = tmpl_compile(buf, (size_t)fsize, names);
+    free(buf);
+    return t;
+}
+
+void tmpl_free(struct tmpl *t)
+{
+    if (!t)
+        return;
+    free(t->segs);
+    free(t->text);
+    free(t);
+}
+
+static const char *const escapes[256] = {
+    ['&'] = "&amp;",
+    ['<'] = "&lt;",
+    ['>'] = "&gt;",
+    ['"'] = "&quot;",
+    ['\''] = "&#39;",
+};
+
+static inline size_t value_len(const struct tmpl_value *v)
+{
+    if (!v->str)
+        return 0;
+    return v->len ? v->len : strlen(v->str);
+}
+
+static size_t escaped_len(const char *s, size_t len)
+{
+    size_t i, n = len;
+    for (i = 0; i < len; i++) {
+        const char *e = escapes[(unsigned char)s[i]];
+        if (e)
+            n += strlen(e) - 1;
+    }
+    return n;
+}
+
+static char *escape_to(char *dst, const char *s, size_t len)
+{
+    size_t i;
+    for (i = 0; i < len; i++) {
+        const char *e = escapes[(unsigned char)s[i]];
+        if (e)
+            dst = stpcpy(dst, e);
+        else
+            *dst++ = s[i];
+    }
+    return dst;
+}
+
+size_t tmpl_render_length(const struct tmpl *t, const struct tmpl_value values[])
+{
+    size_t len = 0;
+    int i;
+
+    for (i = 0; i < t->nsegs; i++) {
+        const struct tmpl_seg *seg = &t->segs[i];
+        switch (seg->type) {
+        case SEG_LITERAL:
+            len += seg->len;
+            break;
+        case SEG_ESCAPED:
+            len += escaped_len(values[seg->var].str, value_len(&values[seg->var]));
+            break;
+        case SEG_RAW:
+            len += value_len(&values[seg->var]);
+            break;
+        case SEG_SECTION:
+            if (!value_len(&values[seg->var]))
+                i = seg->end;
+            break;
+        case SEG_END:
+            break;
+        }
+    }
+
+    return len;
+}
+
+/* `buf` must hold tmpl_render_length() bytes, no terminator is written. */
+size_t tmpl_render_to(const struct tmpl *t, const struct tmpl_value values[], char *buf)
+{
+    char *p = buf;
+    int i;
+
+    for (i = 0; i < t->nsegs; i++) {
+        const struct tmpl_seg *seg = &t->segs[i];
+        switch (seg->type) {
+        case SEG_LITERAL:
+            p = mempcpy(p, seg->str, seg->len);
+            break;
+        case SEG_ESCAPED:
+            p = escape_to(p, values[seg->var].str, value_len(&values[seg->var]));
+            break;
+        case SEG_RAW:
+            if (values[seg->var].str)
+                p = mempcpy(p, values[seg->var].str, value_len(&values[seg->var]));
+            break;
+        case SEG_SECTION:
+            if (!value_len(&values[seg->var]))
+                i = seg->end;
+            break;
+        case SEG_END:
+            break;
+        }
+    }
+
+    return (size_t)(p - buf);
+}
+
+/* render into a buffer of the exact size, plus a terminating nul. */
+char *tmpl_render(const struct tmpl *t, const struct tmpl_value values[], size_t *len)
+{
+    size_t sz = tmpl_render_length(t, values);
+    char *buf = malloc(sz + 1);
+    if (!buf)
+        return NULL;
+
+    tmpl_render_to(t, values, buf);
+    buf[sz] = 0;
+    if (len)
+        *len = sz;
+    return buf;
+}
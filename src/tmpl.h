@@ -1,36 +1,30 @@
 #pragma once
 
-static const char *tmpl_blog_info = \
-        "<div class='post-preview'>" \
-        "  <a href='/blogs/%d'>"\
-        "  <h2 class='post-title'>%s</h2>" \
-        "  <h3 class='post-subtitle'>%s</h3>"\
-        "  </a>" \
-        "  <p class='post-meta'>Posted by <a href='%s'>%s</a> on %s</p>"\
-        "</div>"\
-        "<hr>";
+#include <stdbool.h>
+#include <stddef.h>
 
-static const char *tmpl_blog = \
-    "<header class='intro-header' style=\"background-image: url('/img/post-bg.jpg')\">"\
-    "    <div class='container'>"\
-    "        <div class='row'>"\
-    "                <div class='col-lg-8 col-lg-offset-2 col-md-10 col-md-offset-1'>"\
-    "                    <div class='post-heading'>"\
-    "                    <h1>%s</h1>"\
-    "                    <h2 class='subheading'>%s</h2>"\
-    "                    <span class='meta'>Posted by <a href='%s'>%s</a> on %s</span>"\
-    "                </div>"\
-    "            </div>"\
-    "        </div>"\
-    "    </div>"\
-    "</header>"\
-    "<article>"\
-    "    <div class='container'>"\
-    "        <div class='row'>"\
-    "            <div class='col-lg-8 col-lg-offset-2 col-md-10 col-md-offset-1'>"\
-    "%s"\
-    "</div></div></div></article><hr>";
+/*
+ * tmpl - templates compiled once into literal and placeholder segments.
+ *
+ *   {{name}}                the value of name, html escaped
+ *   {{{name}}}              the value of name, as is
+ *   {{#name}} .. {{/name}}  the enclosed part, only if name is not empty
+ *
+ * names are resolved when compiling, against the NULL terminated list
+ * given; rendering takes the values in the order of that list.
+ */
 
+struct tmpl_value {
+    const char *str;
+    size_t len;     /* 0 for strlen(str) */
+};
 
+struct tmpl;
 
+struct tmpl *tmpl_compile(const char *text, size_t len, const char *const names[]);
+struct tmpl *tmpl_compile_file(const char *path, const char *const names[]);
+void tmpl_free(struct tmpl *t);
 
+size_t tmpl_render_length(const struct tmpl *t, const struct tmpl_value values[]);
+size_t tmpl_render_to(const struct tmpl *t, const struct tmpl_value values[], char *buf);
+char *tmpl_render(const struct tmpl *t, const struct tmpl_value values[], size_t *len);
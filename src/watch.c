@@ -0,0 +1,166 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <errno.h>
+#include <dirent.h>
+
+#include "config.h"
+#include "watch.h"
+
+#ifdef HAVE_INOTIFY
+#include <sys/inotify.h>
+
+#define WATCH_EVENTS (IN_CLOSE_WRITE | IN_CREATE | IN_DELETE | \
+        IN_MOVED_FROM | IN_MOVED_TO | IN_ATTRIB | IN_ONLYDIR)
+
+bool watcher_init(struct watcher *w, void (*on_change)(const char *path, int flags))
+{
+    w->loop = NULL;
+    w->on_change = on_change;
+    w->dirs = hash_int_new(NULL, free);
+    if (!w->dirs)
+        return false;
+
+    w->fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (w->fd < 0) {
+        hash_free(w->dirs);
+        w->dirs = NULL;
+        return false;
+    }
+
+    return true;
+}
+
+bool watcher_add(struct watcher *w, const char *dir)
+{
+    int wd = inotify_add_watch(w->fd, dir, WATCH_EVENTS);
+    if (wd < 0)
+        return false;
+
+    char *path = strdup(dir);
+    if (!path || hash_add(w->dirs, (void *)(intptr_t)wd, path) < 0) {
+        free(path);
+        inotify_rm_watch(w->fd, wd);
+        return false;
+    }
+
+    DIR *d = opendir(dir);
+    if (!d)
+        return true;
+
+    struct dirent *ent;
+    while ((ent = readdir(d)) != NULL) {
+        if (ent->d_name[0] == '.')
+            continue;
+        if (ent->d_type != DT_DIR && ent->d_type != DT_UNKNOWN)
+            continue;
+
+        char sub[1024];
+        if (snprintf(sub, sizeof(sub), "%s/%s", dir, ent->d_name) >= (int)sizeof(sub))
+            continue;
+        /* IN_ONLYDIR makes plain files fail here. */
+        watcher_add(w, sub);
+    }
+    closedir(d);
+
+    return true;
+}
+
+static void watcher_proc(aeEventLoop *loop, int fd, void *data, int mask)
+{
+    struct watcher *w = data;
+    char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+
+    (void)(loop);
+    (void)(mask);
+
+    for (;;) {
+        ssize_t len = read(fd, buf, sizeof(buf));
+        if (len <= 0)
+            return;
+
+        char *p;
+        const struct inotify_event *ev;
+        for (p = buf; p < buf + len; p += sizeof(*ev) + ev->len) {
+            ev = (const struct inotify_event *)p;
+
+            if (ev->mask & IN_Q_OVERFLOW) {
+                w->on_change(NULL, WATCH_CHANGED);
+                continue;
+            }
+            if (ev->mask & IN_IGNORED) {
+                hash_del(w->dirs, (void *)(intptr_t)ev->wd);
+                continue;
+            }
+
+            const char *dir = hash_find(w->dirs, (void *)(intptr_t)ev->wd);
+            if (!dir || !ev->len)
+                continue;
+
+            char path[1024];
+            if (snprintf(path, sizeof(path), "%s/%s", dir, ev->name) >= (int)sizeof(path))
+                continue;
+
+            int flags = (ev->mask & IN_ISDIR) ? WATCH_IS_DIR : 0;
+            if (ev->mask & (IN_DELETE | IN_MOVED_FROM)) {
+                flags |= WATCH_REMOVED;
+            } else {
+                flags |= WATCH_CHANGED;
+                /* new sub directories are watched as well. */
+                if ((flags & WATCH_IS_DIR) && (ev->mask & (IN_CREATE | IN_MOVED_TO)))
+                    watcher_add(w, path);
+            }
+            w->on_change(path, flags);
+        }
+    }
+}
+
+bool watcher_attach(struct watcher *w, aeEventLoop *loop)
+{
+    if (aeCreateFileEvent(loop, w->fd, AE_READABLE, watcher_proc, w) == AE_ERR)
+        return false;
+
+    w->loop = loop;
+    return true;
+}
+
+void watcher_destroy(struct watcher *w)
+{
+    if (w->loop)
+        aeDeleteFileEvent(w->loop, w->fd, AE_READABLE);
+    close(w->fd);
+    hash_free(w->dirs);
+}
+
+#else
+
+bool watcher_init(struct watcher *w, void (*on_change)(const char *path, int flags))
+{
+    (void)(w);
+    (void)(on_change);
+    return false;
+}
+
+bool watcher_add(struct watcher *w, const char *dir)
+{
+    (void)(w);
+    (void)(dir);
+    return false;
+}
+
+bool watcher_attach(struct watcher *w, aeEventLoop *loop)
+{
+    (void)(w);
+    (void)(loop);
+    return false;
+}
+
+void watcher_destroy(struct watcher *w)
+{
+    (void)(w);
+}
+
+#endif
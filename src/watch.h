@@ -0,0 +1,32 @@
+#pragma once
+
+#include <stdbool.h>
+
+#include "ae.h"
+#include "hash.h"
+
+/*
+ * watch - file change notifications delivered on an ae event loop.
+ *
+ * Directories are watched recursively; the callback gets the path of the
+ * changed entry, built the same way it was added (dir + "/" + name), or
+ * NULL when events were lost and everything should be considered stale.
+ */
+
+enum watch_flag {
+    WATCH_CHANGED = 1<<0,   /* written, created or moved in */
+    WATCH_REMOVED = 1<<1,   /* deleted or moved away */
+    WATCH_IS_DIR  = 1<<2,
+};
+
+struct watcher {
+    int fd;
+    aeEventLoop *loop;
+    struct hash *dirs; // watch descriptor -> dir path
+    void (*on_change)(const char *path, int flags);
+};
+
+bool watcher_init(struct watcher *w, void (*on_change)(const char *path, int flags));
+bool watcher_add(struct watcher *w, const char *dir);
+bool watcher_attach(struct watcher *w, aeEventLoop *loop);
+void watcher_destroy(struct watcher *w);